@@ -0,0 +1,207 @@
+// Host run of burst capture on the simulated ADC of src/interleaved.cpp and the simulated flash of src/spiflash.cpp.
+//
+// Records bursts into the log and reads them back the way `uploadBurstChunk()` uploads them, checking every sample
+// against the signal. Covers what is hard to provoke on the device: a reset in the middle of a recording, the log
+// wrapping around over old recordings, programming falling behind the conversions, stalls of more than a pass through
+// the buffer with and without the DMA interrupt, and chunks lost on the way to the server. Also prints how busy the flash would be on the device, with the typical program and erase times of a W25Q.
+//
+// Build and run from the detector directory:
+//     g++ -O2 -std=gnu++11 -Isrc bench/burstbench.cpp src/burst.cpp src/spiflash.cpp src/interleaved.cpp -o burstbench
+//     ./burstbench [sample rate in Hz] [duration in s]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "burst.h"
+#include "interleaved.h"
+#include "spiflash.h"
+
+// Values of `BURST_BUFFER_SAMPLES` and `BURST_UPLOAD_CHUNK_SIZE` in main.h.
+#define BURST_BUFFER_SAMPLES 8192
+#define BURST_UPLOAD_CHUNK_SIZE 16384
+// Typical times of a W25Q to program a page and erase a block. (ms)
+#define PAGE_PROGRAM_TIME 0.7
+#define BLOCK_ERASE_TIME 150.0
+// Fraction of chunks lost on the way to the server, and of responses lost on the way back.
+#define LOST_CHUNK_FRACTION 0.2
+#define LOST_RESPONSE_FRACTION 0.1
+
+static uint32_t sampleRate = 100000;
+static int failures = 0;
+
+static float generateSignal(double time)
+{
+    double mains = std::max(0.0, sin(2 * M_PI * 50 * time));
+    return 0.3 + 0.8 * mains * mains * mains + 0.2 * sin(2 * M_PI * 1234.5 * time);
+}
+
+/// @brief Returns the code the simulated ADC converts sample `index` to, as there is no noise.
+static uint16_t getExpectedCode(uint32_t index)
+{
+    long code = lround(generateSignal((double)index / sampleRate) / 3.3 * 4095);
+    return code < 0 ? 0 : (code > 4095 ? 4095 : code);
+}
+
+/// @brief Unpacks 12 bit codes like server/burst.py.
+static std::vector<uint16_t> unpackSamples(const std::vector<uint8_t> &data, uint32_t sampleCount)
+{
+    std::vector<uint16_t> samples(sampleCount);
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        const uint8_t *pair = &data[i / 2 * 3];
+        samples[i] = i % 2 ? (pair[1] >> 4) | (pair[2] << 4) : pair[0] | ((pair[1] & 0x0F) << 8);
+    }
+    return samples;
+}
+
+/// @brief Checks a recording as the server would receive it: with lost chunks and responses, resuming every time.
+static void checkRecording(const char *name, const BurstRecording *recording, uint32_t expectedSamples)
+{
+    uint32_t dataSize = getBurstDataSize(recording->sampleCount);
+    std::vector<uint8_t> server;
+    int requests = 0;
+    // `burstUploadOffset` of the device, `BURST_ERASED` while it has to ask the server.
+    uint32_t offset = BURST_ERASED;
+    while (offset == BURST_ERASED || offset < dataSize)
+    {
+        requests++;
+        if (offset == BURST_ERASED)
+        {
+            offset = rand() < LOST_RESPONSE_FRACTION * RAND_MAX ? BURST_ERASED : server.size();
+            continue;
+        }
+        uint32_t length = std::min(dataSize - offset, (uint32_t)BURST_UPLOAD_CHUNK_SIZE);
+        std::vector<uint8_t> chunk(length);
+        readBurstData(recording, offset, chunk.data(), length);
+        if (rand() < LOST_CHUNK_FRACTION * RAND_MAX)
+        {
+            offset = BURST_ERASED;
+            continue;
+        }
+        // The server only appends a chunk that continues where it is.
+        if (offset == server.size())
+        {
+            server.insert(server.end(), chunk.begin(), chunk.end());
+        }
+        offset = rand() < LOST_RESPONSE_FRACTION * RAND_MAX ? BURST_ERASED : server.size();
+    }
+
+    bool checksumValid = recording->dataChecksum == BURST_ERASED || updateBurstChecksum(0, server.data(), server.size()) == recording->dataChecksum;
+    std::vector<uint16_t> samples = unpackSamples(server, recording->sampleCount);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < samples.size(); i++)
+    {
+        mismatches += samples[i] != getExpectedCode(i);
+    }
+    bool success = checksumValid && mismatches == 0 && recording->sampleCount == expectedSamples;
+    failures += !success;
+
+    printf("%s: %s\n", name, success ? "ok" : "FAILED");
+    printf("    Recording %u: blocks %u-%u, %u samples (expected %u), %s\n", recording->recordingId, recording->firstBlock,
+           recording->firstBlock + recording->blockCount - 1, recording->sampleCount, expectedSamples,
+           recording->dataChecksum == BURST_ERASED ? "incomplete" : "complete");
+    printf("    Uploaded %u bytes in %d requests, checksum %s, %u mismatched samples\n", (unsigned int)server.size(), requests,
+           checksumValid ? "valid" : "INVALID", mismatches);
+}
+
+/// @brief Checks a recording with a stall, see `simulatedStallConversions`: it has to be cut short before the stall, or be
+/// complete when the stall was harmless.
+static void checkStall(const char *name, bool complete, const BurstRecording *recording, uint32_t numSamples, bool expectComplete)
+{
+    // The stall comes at the first poll after `simulatedStallStart`, and the recording only ends a copy later.
+    bool cutInTime = recording->sampleCount <= simulatedStallStart + BURST_BUFFER_SAMPLES;
+    bool success = complete == expectComplete && (expectComplete || cutInTime);
+    failures += !success;
+    printf("%s: %s\n", name, success ? (complete ? "ok, complete" : "ok, cut short") : (complete ? "FAILED, not detected" : "FAILED"));
+    checkRecording(complete ? "Complete" : "Cut short", recording, complete ? numSamples : recording->sampleCount);
+}
+
+static bool capture(uint32_t numSamples, BurstRecording *recording)
+{
+    std::vector<uint16_t> buffer(BURST_BUFFER_SAMPLES);
+    return captureBurst(0, 0, sampleRate, numSamples, buffer.data(), buffer.size(), recording);
+}
+
+int main(int argc, char **argv)
+{
+    sampleRate = argc > 1 ? atoi(argv[1]) : 100000;
+    double duration = argc > 2 ? atof(argv[2]) : 10;
+    uint32_t numSamples = duration * sampleRate;
+
+    simulatedSignal = generateSignal;
+    uint32_t logBlocks = beginBurstLog();
+    printf("Log of %u blocks, %u samples each\n", logBlocks, BURST_BLOCK_DATA_SIZE / 3 * 2);
+
+    // A full recording, and how long the flash would take for it on the device.
+    BurstRecording recording;
+    bool complete = capture(numSamples, &recording);
+    double programTime = simulatedFlashPrograms * PAGE_PROGRAM_TIME;
+    printf("Capture of %.1f s at %u Hz: %s\n", duration, sampleRate, complete ? "complete" : "CUT SHORT");
+    printf("    Erasing: %lu blocks, %.0f ms before recording\n", simulatedFlashErases, simulatedFlashErases * BLOCK_ERASE_TIME);
+    printf("    Programming: %lu pages, %.0f ms per s recorded\n", simulatedFlashPrograms, programTime / duration);
+    checkRecording("Upload", &recording, numSamples);
+
+    // A reset halfway through: the recording is found again, up to the last page that was programmed.
+    uint32_t pages = getBurstDataSize(numSamples) / SPI_FLASH_PAGE_SIZE;
+    simulatedFlashPrograms = 0;
+    simulatedFlashProgramLimit = pages / 2;
+    capture(numSamples, &recording);
+    simulatedFlashProgramLimit = -1;
+    beginBurstLog();
+    bool found = findNewestRecording(&recording);
+    failures += !found;
+    // The first program is the header of the first block, every block after it adds one more.
+    uint32_t dataPages = pages / 2 - 1 - (pages / 2 - 1) / (BURST_BLOCK_DATA_SIZE / SPI_FLASH_PAGE_SIZE + 1);
+    checkRecording("Reset halfway", &recording, dataPages * SPI_FLASH_PAGE_SIZE / 3 * 2);
+
+    // Enough recordings to wrap around the log a few times. Every one starts right after the previous one.
+    uint32_t wrapSamples = 3 * BURST_BLOCK_DATA_SIZE / 3 * 2 + 12345;
+    uint32_t expectedBlock = (recording.firstBlock + recording.blockCount) % logBlocks;
+    bool wrapped = true;
+    for (uint32_t i = 0; i < logBlocks; i++)
+    {
+        capture(wrapSamples, &recording);
+        wrapped = wrapped && recording.firstBlock == expectedBlock;
+        expectedBlock = (recording.firstBlock + recording.blockCount) % logBlocks;
+    }
+    failures += !wrapped || !findNewestRecording(&recording);
+    printf("Wrap around: %s\n", wrapped ? "ok" : "FAILED");
+    checkRecording("Newest after wrap around", &recording, wrapSamples);
+
+    // Programming falling behind: the recording ends before the first sample that was overwritten.
+    simulatedConversionsPerPoll = BURST_BUFFER_SAMPLES / 4;
+    complete = capture(numSamples, &recording);
+    simulatedConversionsPerPoll = 256;
+    failures += complete;
+    printf("Overrun: %s\n", complete ? "FAILED, not detected" : "ok, cut short");
+    checkRecording("Cut short", &recording, recording.sampleCount);
+
+    // Programming stalling for more than a pass through the buffer halfway. The DMA interrupt keeps counting the passes,
+    // so the recording ends before the first sample that was overwritten.
+    simulatedStallStart = numSamples / 2;
+    simulatedStallConversions = BURST_BUFFER_SAMPLES * 5 / 2;
+    simulatedStallMasksInterrupts = false;
+    complete = capture(numSamples, &recording);
+    checkStall("Stall", complete, &recording, numSamples, false);
+
+    // The same with the interrupt held off as well, so the passes can not be counted and the overrun has to end it. The
+    // count still makes up for one half pass the interrupt missed, so the stall crosses four half passes: starting an
+    // eighth into a pass it counts only two of them, and lags the conversions by a whole pass, which the count alone would
+    // take for a copy that is still in time.
+    simulatedStallStart = numSamples / 2 / BURST_BUFFER_SAMPLES * BURST_BUFFER_SAMPLES + BURST_BUFFER_SAMPLES / 8;
+    simulatedStallConversions = BURST_BUFFER_SAMPLES * 15 / 8;
+    simulatedStallMasksInterrupts = true;
+    complete = capture(numSamples, &recording);
+    checkStall("Stall with interrupts held off", complete, &recording, numSamples, false);
+
+    // Holding off the interrupt for less than half a pass is harmless.
+    simulatedStallConversions = BURST_BUFFER_SAMPLES / 4;
+    complete = capture(numSamples, &recording);
+    simulatedStallMasksInterrupts = false;
+    checkStall("Short stall with interrupts held off", complete, &recording, numSamples, true);
+
+    printf(failures ? "%d FAILED\n" : "All passed\n", failures);
+    return failures ? 1 : 0;
+}
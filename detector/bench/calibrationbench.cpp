@@ -0,0 +1,116 @@
+// Host check of the lookup tables of src/calibration.cpp against the polynomials they are built from.
+//
+// For every configuration the table is built with `buildCalibrationTables()` and compared with the polynomial in
+// double precision: at the points of the table, which have to match, and between them, where the interpolation has to
+// stay within `MAX_INTERPOLATION_ERROR` wherever the polynomial itself is monotonic. The interpolation also has to be
+// monotonic within every interval, which is what the slopes are limited for. Where the polynomial turns around the
+// table deliberately flattens it, so the error there is only reported.
+//
+// Build and run from the detector directory:
+//     g++ -O2 -std=gnu++11 -Isrc bench/calibrationbench.cpp src/calibration.cpp -o calibrationbench
+//     ./calibrationbench
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "calibration.h"
+
+// Number of voltages checked between two points of the table.
+#define POINTS_PER_INTERVAL 100
+// Largest difference at a point of the table, only the rounding to float. (cm)
+#define MAX_POINT_ERROR 1e-3
+// Largest difference between the points of the table where the polynomial is monotonic. (cm)
+#define MAX_INTERPOLATION_ERROR 0.1
+
+static double evaluatePolynomial(int index, double Vptp)
+{
+    double depth = 0;
+    for (int i = confFitDegrees[index]; i >= 0; i--)
+    {
+        depth = depth * Vptp + confFitCoefs[index][i];
+    }
+    return depth + 1;
+}
+
+/// @brief Returns whether the polynomial is monotonic between two voltages, by sampling it densely.
+static bool isPolynomialMonotonic(int index, double from, double to)
+{
+    double previous = evaluatePolynomial(index, from);
+    int direction = 0;
+    for (int i = 1; i <= POINTS_PER_INTERVAL; i++)
+    {
+        double depth = evaluatePolynomial(index, from + (to - from) * i / POINTS_PER_INTERVAL);
+        int step = depth > previous ? 1 : (depth < previous ? -1 : 0);
+        if (step != 0 && direction != 0 && step != direction)
+        {
+            return false;
+        }
+        direction = step != 0 ? step : direction;
+        previous = depth;
+    }
+    return true;
+}
+
+int main()
+{
+    buildCalibrationTables();
+
+    int failures = 0;
+    for (int index = 0; index < CALIBRATED_CONFIGURATIONS; index++)
+    {
+        double step = (double)(confDomainMax[index] - confDomainMin[index]) / (CALIBRATION_TABLE_SIZE - 1);
+
+        double pointError = 0;
+        double monotonicError = 0;
+        double turningError = 0;
+        int nonMonotonicIntervals = 0;
+        for (int k = 0; k < CALIBRATION_TABLE_SIZE; k++)
+        {
+            double Vptp = confDomainMin[index] + k * step;
+            pointError = std::max(pointError, fabs(lookupTable(index, Vptp) - evaluatePolynomial(index, Vptp)));
+            if (k == CALIBRATION_TABLE_SIZE - 1)
+            {
+                break;
+            }
+
+            // The interpolation may not leave the range of the two points it connects.
+            float low = std::min(confTableDepths[index][k], confTableDepths[index][k + 1]);
+            float high = std::max(confTableDepths[index][k], confTableDepths[index][k + 1]);
+            bool polynomialMonotonic = isPolynomialMonotonic(index, Vptp, Vptp + step);
+            bool interpolationMonotonic = true;
+            float previous = lookupTable(index, Vptp);
+            for (int i = 1; i <= POINTS_PER_INTERVAL; i++)
+            {
+                double x = Vptp + step * i / POINTS_PER_INTERVAL;
+                float depth = lookupTable(index, x);
+                double error = fabs(depth - evaluatePolynomial(index, x));
+                if (polynomialMonotonic)
+                {
+                    monotonicError = std::max(monotonicError, error);
+                }
+                else
+                {
+                    turningError = std::max(turningError, error);
+                }
+                bool direction = confTableDepths[index][k + 1] >= confTableDepths[index][k];
+                interpolationMonotonic = interpolationMonotonic && depth >= low - 1e-4 && depth <= high + 1e-4 &&
+                                         (direction ? depth >= previous - 1e-4 : depth <= previous + 1e-4);
+                previous = depth;
+            }
+            nonMonotonicIntervals += !interpolationMonotonic;
+        }
+
+        bool success = pointError <= MAX_POINT_ERROR && monotonicError <= MAX_INTERPOLATION_ERROR && nonMonotonicIntervals == 0;
+        failures += !success;
+        printf("Configuration %02x (degree %d, %s): %s\n", confSwitchConfigurations[index], confFitDegrees[index],
+               confUseLookupTable[index] ? "tabulated" : "polynomial", success ? "ok" : "FAILED");
+        printf("    Error at table points:            %.6f cm\n", pointError);
+        printf("    Error where polynomial monotonic: %.4f cm\n", monotonicError);
+        printf("    Error where polynomial turns:     %.4f cm\n", turningError);
+        printf("    Non-monotonic intervals:          %d\n", nonMonotonicIntervals);
+    }
+
+    printf(failures ? "%d FAILED\n" : "All passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+// Host benchmark of the waveform codec in src/codec.cpp.
+//
+// Reads recorded windows of voltages, one window per line (for example the `voltageArray` JSON arrays stored by the
+// server), encodes them like `uploadData()` does and reports the compression ratio and the encoding time per sample.
+// Every window is decoded again to check that the codec is lossless.
+//
+// Build and run from the detector directory:
+//     g++ -O2 -std=gnu++11 -Isrc bench/codecbench.cpp src/codec.cpp -o codecbench
+//     sqlite3 ../server/database.db "select json_extract(data, '$.voltageArray') from datatable;" | ./codecbench
+//
+// Pass the number of decimals of the voltages as the first argument, 2 by default (4 with `OversampledAcquisition`).
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "codec.h"
+
+// Number of times every window is encoded, to get a stable timing.
+#define BENCH_REPETITIONS 1000
+
+/// @brief Reads `count` bits from `data` at bit `position` and advances it, most significant bit first.
+static uint32_t readBits(const std::vector<uint8_t> &data, size_t *position, int count)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++, (*position)++)
+    {
+        value = (value << 1) | ((data[*position / 8] >> (7 - *position % 8)) & 1);
+    }
+    return value;
+}
+
+/// @brief Decodes an encoding made by `WaveformEncoder`, see codec.h.
+static std::vector<int32_t> decode(const std::vector<uint8_t> &data)
+{
+    std::vector<int32_t> samples;
+    size_t count = data[0] | (data[1] << 8);
+    size_t position = 16;
+    int32_t previous = 0;
+    while (samples.size() < count)
+    {
+        int k = readBits(data, &position, 5);
+        for (size_t i = 0; i < CODEC_BLOCK_SIZE && samples.size() < count; i++)
+        {
+            uint32_t quotient = 0;
+            while (quotient < CODEC_ESCAPE_LENGTH && readBits(data, &position, 1))
+            {
+                quotient++;
+            }
+            uint32_t value = quotient < CODEC_ESCAPE_LENGTH ? (quotient << k) | readBits(data, &position, k)
+                                                            : readBits(data, &position, CODEC_ESCAPE_BITS);
+            previous += (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+            samples.push_back(previous);
+        }
+    }
+    return samples;
+}
+
+static uint64_t readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    int decimals = argc > 1 ? atoi(argv[1]) : 2;
+    double scale = pow(10, decimals);
+
+    size_t totalSamples = 0;
+    size_t totalText = 0;
+    size_t totalEncoded = 0;
+    double totalNanoseconds = 0;
+    uint64_t totalCycles = 0;
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        // Parse the numbers and the length they have as text in an upload.
+        std::vector<int32_t> samples;
+        size_t textLength = 0;
+        const char *c = line.c_str();
+        while (*c)
+        {
+            char *end;
+            double value = strtod(c, &end);
+            if (end == c)
+            {
+                c++;
+                continue;
+            }
+            samples.push_back((int32_t)lround(value * scale));
+            textLength += snprintf(NULL, 0, "%.*f,", decimals, value);
+            c = end;
+        }
+        if (samples.empty())
+        {
+            continue;
+        }
+
+        std::vector<uint8_t> buffer(CODEC_MAX_ENCODED_SIZE(samples.size()));
+        WaveformEncoder encoder;
+        size_t length = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startCycles = readCycles();
+        for (int repetition = 0; repetition < BENCH_REPETITIONS; repetition++)
+        {
+            beginWaveformEncoding(&encoder, buffer.data(), buffer.size());
+            for (int32_t sample : samples)
+            {
+                encodeWaveformSample(&encoder, sample);
+            }
+            length = endWaveformEncoding(&encoder);
+        }
+        totalCycles += readCycles() - startCycles;
+        totalNanoseconds += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        buffer.resize(length);
+        if (decode(buffer) != samples)
+        {
+            fprintf(stderr, "Window %zu does not decode to the original samples!\n", totalSamples / samples.size());
+            return 1;
+        }
+
+        totalSamples += samples.size();
+        totalText += textLength;
+        totalEncoded += length;
+    }
+
+    if (totalSamples == 0)
+    {
+        fprintf(stderr, "No windows read.\n");
+        return 1;
+    }
+
+    size_t encodedSamples = totalSamples * BENCH_REPETITIONS;
+    printf("Samples:             %zu\n", totalSamples);
+    printf("Encoded size:        %zu bytes, %.2f bits/sample\n", totalEncoded, 8.0 * totalEncoded / totalSamples);
+    printf("Ratio to JSON text:  %.1fx (base64 in JSON: %.1fx)\n", (double)totalText / totalEncoded, (double)totalText / (totalEncoded * 4.0 / 3.0));
+    printf("Ratio to 16 bit raw: %.1fx\n", 2.0 * totalSamples / totalEncoded);
+    printf("Encoding:            %.1f ns/sample", totalNanoseconds / encodedSamples);
+    if (totalCycles)
+    {
+        printf(", %.1f cycles/sample", (double)totalCycles / encodedSamples);
+    }
+    printf("\n");
+    return 0;
+}
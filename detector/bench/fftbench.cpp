@@ -0,0 +1,178 @@
+// Host benchmark of the fixed-point spectrum in src/spectrum.cpp.
+//
+// Reads recorded windows of voltages, one window per line (for example the `voltageArray` JSON arrays stored by the
+// server), computes their spectrum like spectrum mode does and compares it to a double precision FFT of the same
+// window. Reports the error of the uploaded bins, whether the dominant bin agrees and the time per transform.
+//
+// Build and run from the detector directory:
+//     g++ -O2 -std=gnu++11 -Isrc bench/fftbench.cpp src/spectrum.cpp -o fftbench
+//     sqlite3 ../server/database.db "select json_extract(data, '$.voltageArray') from datatable;" | ./fftbench
+
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "spectrum.h"
+
+// Number of times every window is transformed, to get a stable timing.
+#define BENCH_REPETITIONS 1000
+
+/// @brief Transforms `data` in place with a recursive radix-2 FFT. The size of `data` must be a power of 2.
+static void transform(std::vector<std::complex<double>> &data)
+{
+    size_t size = data.size();
+    if (size == 1)
+    {
+        return;
+    }
+    std::vector<std::complex<double>> even(size / 2), odd(size / 2);
+    for (size_t i = 0; i < size / 2; i++)
+    {
+        even[i] = data[2 * i];
+        odd[i] = data[2 * i + 1];
+    }
+    transform(even);
+    transform(odd);
+    for (size_t k = 0; k < size / 2; k++)
+    {
+        std::complex<double> product = std::polar(1.0, -2 * M_PI * k / size) * odd[k];
+        data[k] = even[k] + product;
+        data[k + size / 2] = even[k] - product;
+    }
+}
+
+/// @brief Computes the reference spectrum of a window, in the same units as `computeSpectrum()`.
+static std::vector<double> computeReferenceSpectrum(const std::vector<float> &voltages)
+{
+    size_t count = voltages.size();
+    double mean = 0;
+    for (float voltage : voltages)
+    {
+        mean += voltage;
+    }
+    mean /= count;
+
+    std::vector<std::complex<double>> data(FFT_SIZE);
+    for (size_t i = 0; i < count; i++)
+    {
+        double window = 0.5 - 0.5 * cos(2 * M_PI * i / (count - 1));
+        data[i] = (voltages[i] - mean) * SPECTRUM_INPUT_SCALE * window;
+    }
+    transform(data);
+
+    std::vector<double> spectrum(FFT_SIZE / 2);
+    for (size_t k = 0; k < spectrum.size(); k++)
+    {
+        spectrum[k] = std::abs(data[k]) / (FFT_SIZE / 2);
+    }
+    return spectrum;
+}
+
+static uint64_t readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int main()
+{
+    size_t windows = 0;
+    size_t dominantMatches = 0;
+    double totalSignal = 0;
+    double totalError = 0;
+    double maxError = 0;
+    double totalNanoseconds = 0;
+    uint64_t totalCycles = 0;
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        std::vector<float> voltages;
+        const char *c = line.c_str();
+        while (*c)
+        {
+            char *end;
+            double value = strtod(c, &end);
+            if (end == c)
+            {
+                c++;
+                continue;
+            }
+            voltages.push_back((float)value);
+            c = end;
+        }
+        if (voltages.size() < 2 || voltages.size() > 1000)
+        {
+            continue;
+        }
+
+        SpectrumBuffer buffer;
+        uint16_t spectrum[SPECTRUM_BINS];
+        SpectrumPeak peak;
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startCycles = readCycles();
+        for (int repetition = 0; repetition < BENCH_REPETITIONS; repetition++)
+        {
+            // The transform overwrites the window, so copying it back is part of the timing.
+            std::copy(voltages.begin(), voltages.end(), buffer.voltages);
+            computeSpectrum(&buffer, voltages.size(), spectrum, &peak);
+        }
+        totalCycles += readCycles() - startCycles;
+        totalNanoseconds += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<double> reference = computeReferenceSpectrum(voltages);
+        size_t referencePeak = 1;
+        for (size_t k = 1; k < reference.size(); k++)
+        {
+            if (reference[k] > reference[referencePeak])
+            {
+                referencePeak = k;
+            }
+        }
+        // Neighbouring bins of a tone between two bins can be almost equal, so allow either.
+        if (std::abs((long)peak.bin - (long)referencePeak) <= 1)
+        {
+            dominantMatches++;
+        }
+
+        double scale = getSpectrumScale(voltages.size());
+        for (size_t k = 1; k < SPECTRUM_BINS; k++)
+        {
+            double error = (spectrum[k] - reference[k]) * scale;
+            totalSignal += reference[k] * scale * reference[k] * scale;
+            totalError += error * error;
+            maxError = std::max(maxError, std::abs(error));
+        }
+        windows++;
+    }
+
+    if (windows == 0)
+    {
+        fprintf(stderr, "No windows read.\n");
+        return 1;
+    }
+
+    size_t transforms = windows * BENCH_REPETITIONS;
+    printf("Windows:             %zu\n", windows);
+    printf("Dominant bin agrees: %zu/%zu\n", dominantMatches, windows);
+    printf("Bin error:           %.2f dB below signal, at most %.2f mV\n", 10 * log10(totalSignal / totalError), maxError * 1000);
+    printf("Transform:           %.1f us/window", totalNanoseconds / transforms / 1000);
+    if (totalCycles)
+    {
+        printf(", %.0f cycles/window", (double)totalCycles / transforms);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Host run of the measurement pipeline on windows from the simulated interleaved ADCs in src/interleaved.cpp.
+//
+// Measures the same signal at the rate of a single ADC and at the interleaved rate, and runs every window through the
+// spectrum of spectrum mode and the codec of `CompressedUpload`. The signal is rectified mains on a baseline plus a
+// tone above the Nyquist frequency of a single ADC: a single ADC sees it aliased at `rate` - f, while the interleaved
+// ADCs resolve it and only leave a small spur at the same frequency, caused by the mismatch between the two ADCs.
+//
+// Build and run from the detector directory:
+//     g++ -O2 -std=gnu++11 -Isrc bench/interleavebench.cpp src/interleaved.cpp src/spectrum.cpp src/codec.cpp -o interleavebench
+//     ./interleavebench [tone frequency in Hz] [gain mismatch] [offset mismatch in V]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "codec.h"
+#include "interleaved.h"
+#include "spectrum.h"
+
+// Number of windows measured at every rate.
+#define BENCH_WINDOWS 100
+// Rate of `analogRead()` in a window of `doMeasurement()`. (Hz)
+#define SINGLE_SAMPLE_RATE 10000
+// Rate of `InterleavedAcquisition` with the default `INTERLEAVED_SAMPLE_RATE`. (Hz)
+#define INTERLEAVED_SAMPLE_RATE 20000
+
+static double toneFrequency = 6500;
+// Start of the current window, so consecutive windows see different phases of the signal. (s)
+static double windowStart = 0;
+
+static float generateSignal(double time)
+{
+    time += windowStart;
+    double mains = std::max(0.0, sin(2 * M_PI * 50 * time));
+    return 0.3 + 0.8 * mains * mains * mains + 0.2 * sin(2 * M_PI * toneFrequency * time);
+}
+
+/// @brief Returns the amplitude of the component of `frequency` in a window, with a Hann window like the spectrum. (V)
+static double getToneAmplitude(const std::vector<float> &voltages, double frequency, double sampleRate)
+{
+    double real = 0;
+    double imaginary = 0;
+    double windowSum = 0;
+    for (size_t i = 0; i < voltages.size(); i++)
+    {
+        double window = 0.5 - 0.5 * cos(2 * M_PI * i / (voltages.size() - 1));
+        real += voltages[i] * window * cos(2 * M_PI * frequency * i / sampleRate);
+        imaginary -= voltages[i] * window * sin(2 * M_PI * frequency * i / sampleRate);
+        windowSum += window;
+    }
+    return 2 * sqrt(real * real + imaginary * imaginary) / windowSum;
+}
+
+static void runPipeline(const char *name, uint32_t sampleRate, float gainMismatch, float offsetMismatch)
+{
+    simulatedGainMismatch = gainMismatch;
+    simulatedOffsetMismatch = offsetMismatch;
+
+    // Where a single ADC sees the tone, and where the interleaved ADCs leave their spur.
+    double aliasFrequency = fabs(SINGLE_SAMPLE_RATE - toneFrequency);
+    double dominantFrequency = 0;
+    double dominantAmplitude = 0;
+    double toneAmplitude = 0;
+    double aliasAmplitude = 0;
+    size_t encodedBytes = 0;
+
+    for (int window = 0; window < BENCH_WINDOWS; window++)
+    {
+        windowStart = window * 0.123;
+
+        SpectrumBuffer buffer;
+        float loopTime = 0;
+        captureInterleavedWindow(0, 0, sampleRate, buffer.voltages, 1000, &loopTime);
+        std::vector<float> voltages(buffer.voltages, buffer.voltages + 1000);
+
+        uint8_t encoded[CODEC_MAX_ENCODED_SIZE(1000)];
+        WaveformEncoder encoder;
+        beginWaveformEncoding(&encoder, encoded, sizeof(encoded));
+        for (float voltage : voltages)
+        {
+            encodeWaveformSample(&encoder, lround(voltage * 100));
+        }
+        encodedBytes += endWaveformEncoding(&encoder);
+
+        toneAmplitude += sampleRate > 2 * toneFrequency ? getToneAmplitude(voltages, toneFrequency, sampleRate) : 0;
+        aliasAmplitude += getToneAmplitude(voltages, aliasFrequency, sampleRate);
+
+        uint16_t spectrum[SPECTRUM_BINS];
+        SpectrumPeak peak;
+        computeSpectrum(&buffer, 1000, spectrum, &peak);
+        dominantFrequency += getBinFrequency(peak.bin, loopTime);
+        dominantAmplitude += peak.magnitude * getSpectrumScale(1000);
+    }
+
+    printf("%s, %u Hz, window of %.0f ms:\n", name, sampleRate, 1000.0 * 1000 / sampleRate);
+    printf("    Dominant bin:      %.0f Hz, %.3f V\n", dominantFrequency / BENCH_WINDOWS, dominantAmplitude / BENCH_WINDOWS);
+    printf("    Tone at %5.0f Hz:  %.4f V\n", toneFrequency, toneAmplitude / BENCH_WINDOWS);
+    printf("    Alias at %5.0f Hz: %.4f V\n", aliasFrequency, aliasAmplitude / BENCH_WINDOWS);
+    printf("    Compressed:        %.2f bits/sample\n", 8.0 * encodedBytes / (BENCH_WINDOWS * 1000));
+}
+
+int main(int argc, char **argv)
+{
+    toneFrequency = argc > 1 ? atof(argv[1]) : 6500;
+    float gainMismatch = argc > 2 ? atof(argv[2]) : 1.003;
+    float offsetMismatch = argc > 3 ? atof(argv[3]) : 0.002;
+
+    simulatedSignal = generateSignal;
+    simulatedNoise = 0.002;
+
+    runPipeline("Single ADC", SINGLE_SAMPLE_RATE, 1, 0);
+    runPipeline("Interleaved ADCs", INTERLEAVED_SAMPLE_RATE, gainMismatch, offsetMismatch);
+    return 0;
+}
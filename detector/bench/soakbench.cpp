@@ -0,0 +1,149 @@
+// Soak test of the memory use of the measurement pipeline on host, with the memory statistics of src/profiling.cpp.
+//
+// Runs the work of a depth mode window over and over: a window from the simulated ADCs of src/interleaved.cpp, its
+// statistics, the median filter, the depth and sensor advice, the LCD lines, and the upload both compressed and as
+// decimal text built up by appending, like `uploadData()` does with `String`. Every eighth window also gets the
+// spectrum of spectrum mode. After a warm-up the heap high-water mark and the stack usage have to stay where they are:
+// anything that grows with the number of windows would show up here long before it takes down a device.
+//
+// Build and run from the detector directory:
+//     g++ -O2 -std=gnu++11 -Isrc bench/soakbench.cpp src/profiling.cpp src/interleaved.cpp src/peaks.cpp src/filter.cpp
+//         src/calibration.cpp src/lcdline.cpp src/codec.cpp src/spectrum.cpp -o soakbench
+//     ./soakbench [number of windows, 1000000 by default]
+
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "calibration.h"
+#include "codec.h"
+#include "filter.h"
+#include "interleaved.h"
+#include "lcdline.h"
+#include "peaks.h"
+#include "profiling.h"
+#include "spectrum.h"
+
+// Number of windows before the memory use is expected to have settled.
+#define WARMUP_WINDOWS 1000
+// Number of windows between checks of the memory use.
+#define CHECK_INTERVAL 10000
+// Growth of the heap high-water mark after the warm-up that is still accepted, for the allocator rounding differently. (bytes)
+#define MAX_HEAP_GROWTH 256
+// Rate of the simulated ADCs, about that of `analogRead()`. (Hz)
+#define SAMPLE_RATE 10000
+
+// Global like `windowBuffer` in main.cpp.
+static SpectrumBuffer windowBuffer;
+static double windowStart = 0;
+
+static float generateSignal(double time)
+{
+    time += windowStart;
+    double mains = std::max(0.0, sin(2 * M_PI * 50 * time));
+    // Slowly changing amplitude, so the depth and the advice change over the run.
+    return 0.2 + (0.4 + 0.3 * sin(time / 10)) * mains;
+}
+
+/// @brief Runs one window through the pipeline. Not inlined, so its frame is on the stack like a mode routine's.
+__attribute__((noinline)) static float runWindow(MedianFilter *filter, uint8_t activatedSwitches, bool spectrumMode)
+{
+    float loopTime = 0;
+    captureInterleavedWindow(0, 0, SAMPLE_RATE, windowBuffer.voltages, 1000, &loopTime);
+
+    WindowStatistics statistics;
+    analyzeWindow(windowBuffer.voltages, 1000, loopTime, &statistics);
+    addToMedianFilter(filter, statistics.Vptp);
+    float filteredVptp = getMedian(filter);
+    float depth = getDepthByFit(activatedSwitches, filteredVptp);
+    uint8_t recommendedSwitches = recommendSwitchConfiguration(activatedSwitches, filteredVptp);
+
+    LcdLine firstLine;
+    LcdLine secondLine;
+    setLine(&firstLine, "Depth = ");
+    appendFixed(&firstLine, depth, 1);
+    setLine(&secondLine, "Try sens. ");
+    appendInt(&secondLine, recommendedSwitches);
+
+    // The compressed upload, with the buffers `uploadData()` keeps static.
+    static uint8_t encoded[1024];
+    static char encodedBase64[(1024 + 2) / 3 * 4 + 1];
+    WaveformEncoder encoder;
+    beginWaveformEncoding(&encoder, encoded, sizeof(encoded));
+    for (size_t i = 0; i < 1000; i++)
+    {
+        encodeWaveformSample(&encoder, lround(windowBuffer.voltages[i] * 100));
+    }
+    encodeBase64(encoded, endWaveformEncoding(&encoder), encodedBase64, sizeof(encodedBase64));
+
+    // The text upload, which grows a string on the heap one measurement at a time. Formatted without printf, like
+    // `String(float, int)` on the device.
+    std::string text = "[";
+    LcdLine number;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        setLine(&number, "");
+        appendFixed(&number, windowBuffer.voltages[i], 2);
+        appendChar(&number, ',');
+        text += number.text;
+    }
+    text.back() = ']';
+
+    if (spectrumMode)
+    {
+        uint16_t spectrum[SPECTRUM_BINS];
+        SpectrumPeak peak;
+        computeSpectrum(&windowBuffer, 1000, spectrum, &peak);
+    }
+    return depth + text.size() + firstLine.length + secondLine.length;
+}
+
+int main(int argc, char **argv)
+{
+    long windows = argc > 1 ? atol(argv[1]) : 1000000;
+
+    // First, like at the start of `setup()`.
+    paintStack();
+    buildCalibrationTables();
+    simulatedSignal = generateSignal;
+    simulatedNoise = 0.005;
+
+    MedianFilter filter;
+    resetMedianFilter(&filter);
+    MemoryStatistics warm = {0, 0, 0, 0};
+    MemoryStatistics memory = {0, 0, 0, 0};
+    float checksum = 0;
+    bool stable = true;
+    printf("%10s %10s %12s %12s %10s\n", "windows", "freeHeap", "maxUsedHeap", "largestFree", "stackUsed");
+    for (long window = 1; window <= windows; window++)
+    {
+        windowStart = window * 0.1;
+        checksum += runWindow(&filter, confSwitchConfigurations[window / 5000 % CALIBRATED_CONFIGURATIONS], window % 8 == 0);
+
+        if (window == WARMUP_WINDOWS || window % CHECK_INTERVAL == 0 || window == windows)
+        {
+            getMemoryStatistics(&memory);
+            printf("%10ld %10u %12u %12u %10u\n", window, memory.freeHeap, memory.maxUsedHeap, memory.largestFreeBlock, memory.stackUsed);
+            if (window == WARMUP_WINDOWS)
+            {
+                warm = memory;
+            }
+            else if (window > WARMUP_WINDOWS)
+            {
+                stable = stable && memory.maxUsedHeap <= warm.maxUsedHeap + MAX_HEAP_GROWTH && memory.stackUsed == warm.stackUsed;
+            }
+        }
+    }
+
+    bool saturated = memory.stackUsed >= STACK_PAINT_HOST_SIZE;
+    printf("Heap high-water mark grew %d bytes, stack usage %d bytes after the warm-up (checksum %.0f)\n",
+           (int)(memory.maxUsedHeap - warm.maxUsedHeap), (int)(memory.stackUsed - warm.stackUsed), checksum);
+    if (saturated)
+    {
+        printf("FAILED: the stack grew past the painted region, so its usage is unknown\n");
+    }
+    printf(stable && !saturated ? "Memory use stayed flat\n" : "FAILED: memory use grew\n");
+    return stable && !saturated ? 0 : 1;
+}
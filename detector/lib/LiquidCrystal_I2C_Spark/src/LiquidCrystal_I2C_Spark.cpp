@@ -70,7 +70,6 @@ void LiquidCrystal_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
 
         // Now we pull both RS and R/W low to begin commands
         expanderWrite(_backlightval);   // reset expanderand turn backlight off (Bit 8 =1)
-        delay(1000);
 
         //put the LCD into 4 bit mode
         // this is according to the hitachi HD44780 datasheet
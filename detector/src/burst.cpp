@@ -0,0 +1,304 @@
+#include "burst.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "interleaved.h"
+
+// Number of blocks in the log, see `beginBurstLog()`.
+static uint32_t logBlocks = 0;
+
+uint32_t updateBurstChecksum(uint32_t checksum, const void *data, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint32_t crc = ~checksum;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t getHeaderChecksum(const BurstBlockHeader *header)
+{
+    return updateBurstChecksum(0, header, offsetof(BurstBlockHeader, headerChecksum));
+}
+
+/// @brief Returns the flash address of a byte of packed samples of a recording.
+static uint32_t getDataAddress(const BurstRecording *recording, uint32_t offset)
+{
+    uint32_t block = (recording->firstBlock + offset / BURST_BLOCK_DATA_SIZE) % logBlocks;
+    return block * SPI_FLASH_BLOCK_SIZE + BURST_HEADER_SIZE + offset % BURST_BLOCK_DATA_SIZE;
+}
+
+/// @brief Reads the header of a block.
+/// @return whether it is a valid header.
+static bool readBlockHeader(uint32_t block, BurstBlockHeader *header)
+{
+    readSpiFlash(block * SPI_FLASH_BLOCK_SIZE, header, sizeof(*header));
+    return header->magic == BURST_BLOCK_MAGIC && header->headerChecksum == getHeaderChecksum(header);
+}
+
+uint32_t beginBurstLog()
+{
+    logBlocks = beginSpiFlash() / SPI_FLASH_BLOCK_SIZE;
+    return logBlocks;
+}
+
+uint32_t getBurstDataSize(uint32_t sampleCount)
+{
+    return (sampleCount * 3 + 1) / 2;
+}
+
+bool findNewestRecording(BurstRecording *recording)
+{
+    // The first block of the recording with the highest id. Later blocks of the same recording follow it directly.
+    bool found = false;
+    BurstBlockHeader first = {0, 0, 0, 0, 0, 0, 0};
+    for (uint32_t block = 0; block < logBlocks; block++)
+    {
+        BurstBlockHeader header;
+        if (readBlockHeader(block, &header) && header.blockIndex == 0 && (!found || header.recordingId > recording->recordingId))
+        {
+            found = true;
+            first = header;
+            recording->recordingId = header.recordingId;
+            recording->firstBlock = block;
+        }
+    }
+    if (!found)
+    {
+        return false;
+    }
+
+    recording->sampleRate = first.sampleRate;
+    recording->blockCount = 1;
+    while (recording->blockCount < logBlocks)
+    {
+        BurstBlockHeader header;
+        uint32_t block = (recording->firstBlock + recording->blockCount) % logBlocks;
+        if (!readBlockHeader(block, &header) || header.recordingId != recording->recordingId || header.blockIndex != recording->blockCount)
+        {
+            break;
+        }
+        recording->blockCount++;
+    }
+
+    if (first.sampleCount != BURST_ERASED && first.dataChecksum != BURST_ERASED)
+    {
+        recording->sampleCount = first.sampleCount;
+        recording->dataChecksum = first.dataChecksum;
+        return true;
+    }
+
+    // Incomplete, so the samples end with the last page that was programmed. Every page but the last of a recording is
+    // programmed whole, so this only misses a last page of samples that happened to be all ones.
+    uint32_t lastBlock = (recording->firstBlock + recording->blockCount - 1) % logBlocks;
+    uint32_t pages = BURST_BLOCK_DATA_SIZE / SPI_FLASH_PAGE_SIZE;
+    for (; pages > 0; pages--)
+    {
+        uint8_t page[SPI_FLASH_PAGE_SIZE];
+        readSpiFlash(lastBlock * SPI_FLASH_BLOCK_SIZE + BURST_HEADER_SIZE + (pages - 1) * SPI_FLASH_PAGE_SIZE, page, sizeof(page));
+        bool erased = true;
+        for (size_t i = 0; i < sizeof(page) && erased; i++)
+        {
+            erased = page[i] == 0xFF;
+        }
+        if (!erased)
+        {
+            break;
+        }
+    }
+    uint32_t dataSize = (recording->blockCount - 1) * BURST_BLOCK_DATA_SIZE + pages * SPI_FLASH_PAGE_SIZE;
+    recording->sampleCount = dataSize / 3 * 2;
+    recording->dataChecksum = BURST_ERASED;
+    return true;
+}
+
+void readBurstData(const BurstRecording *recording, uint32_t offset, void *data, size_t length)
+{
+    uint8_t *bytes = (uint8_t *)data;
+    while (length > 0)
+    {
+        // Up to the end of the block, after which the next block starts with its header.
+        size_t part = BURST_BLOCK_DATA_SIZE - offset % BURST_BLOCK_DATA_SIZE;
+        part = part < length ? part : length;
+        readSpiFlash(getDataAddress(recording, offset), bytes, part);
+        offset += part;
+        bytes += part;
+        length -= part;
+    }
+}
+
+/// @brief Programs the header of a block of the recording. The block must be erased.
+static void programBlockHeader(const BurstRecording *recording, uint32_t blockIndex)
+{
+    BurstBlockHeader header;
+    header.magic = BURST_BLOCK_MAGIC;
+    header.recordingId = recording->recordingId;
+    header.blockIndex = blockIndex;
+    header.sampleRate = recording->sampleRate;
+    header.headerChecksum = getHeaderChecksum(&header);
+    // Left erased, see `endBurstRecording()`.
+    programSpiFlash(((recording->firstBlock + blockIndex) % logBlocks) * SPI_FLASH_BLOCK_SIZE, &header, offsetof(BurstBlockHeader, sampleCount));
+}
+
+uint32_t beginBurstRecording(BurstWriter *writer, uint32_t sampleRate, uint32_t maxSamples)
+{
+    if (logBlocks == 0)
+    {
+        return 0;
+    }
+
+    BurstRecording *recording = &writer->recording;
+    BurstRecording newest;
+    if (findNewestRecording(&newest))
+    {
+        recording->recordingId = newest.recordingId + 1;
+        recording->firstBlock = (newest.firstBlock + newest.blockCount) % logBlocks;
+    }
+    else
+    {
+        recording->recordingId = 1;
+        recording->firstBlock = 0;
+    }
+    recording->blockCount = 1;
+    recording->sampleRate = sampleRate;
+    recording->sampleCount = 0;
+    recording->dataChecksum = BURST_ERASED;
+
+    uint32_t blocks = (getBurstDataSize(maxSamples) + BURST_BLOCK_DATA_SIZE - 1) / BURST_BLOCK_DATA_SIZE;
+    writer->erasedBlocks = blocks < 1 ? 1 : (blocks > logBlocks ? logBlocks : blocks);
+    for (uint32_t i = 0; i < writer->erasedBlocks; i++)
+    {
+        eraseSpiFlashBlock(((recording->firstBlock + i) % logBlocks) * SPI_FLASH_BLOCK_SIZE);
+    }
+    programBlockHeader(recording, 0);
+
+    writer->dataSize = 0;
+    writer->pageFill = 0;
+    writer->holdingSample = false;
+    writer->checksum = 0;
+
+    // A block holds a whole number of pairs of samples.
+    uint32_t capacity = writer->erasedBlocks * BURST_BLOCK_DATA_SIZE / 3 * 2;
+    return capacity < maxSamples ? capacity : maxSamples;
+}
+
+/// @brief Appends bytes to the page, programming it when it is full.
+static void appendBytes(BurstWriter *writer, const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        writer->page[writer->pageFill++] = bytes[i];
+        if (writer->pageFill == SPI_FLASH_PAGE_SIZE)
+        {
+            // The first page of every block after the first is preceded by the header of the block.
+            if (writer->dataSize > 0 && writer->dataSize % BURST_BLOCK_DATA_SIZE == 0)
+            {
+                programBlockHeader(&writer->recording, writer->dataSize / BURST_BLOCK_DATA_SIZE);
+                writer->recording.blockCount++;
+            }
+            programSpiFlash(getDataAddress(&writer->recording, writer->dataSize), writer->page, SPI_FLASH_PAGE_SIZE);
+            writer->checksum = updateBurstChecksum(writer->checksum, writer->page, SPI_FLASH_PAGE_SIZE);
+            writer->dataSize += SPI_FLASH_PAGE_SIZE;
+            writer->pageFill = 0;
+        }
+    }
+}
+
+uint32_t writeBurstSamples(BurstWriter *writer, const uint16_t *samples, uint32_t count)
+{
+    uint32_t capacity = writer->erasedBlocks * BURST_BLOCK_DATA_SIZE / 3 * 2;
+    if (writer->recording.sampleCount + count > capacity)
+    {
+        count = capacity - writer->recording.sampleCount;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint16_t sample = samples[i] & 0x0FFF;
+        if (!writer->holdingSample)
+        {
+            writer->heldSample = sample;
+            writer->holdingSample = true;
+            continue;
+        }
+        uint8_t packed[3] = {(uint8_t)writer->heldSample, (uint8_t)((writer->heldSample >> 8) | (sample << 4)), (uint8_t)(sample >> 4)};
+        appendBytes(writer, packed, sizeof(packed));
+        writer->holdingSample = false;
+    }
+    writer->recording.sampleCount += count;
+    return count;
+}
+
+void endBurstRecording(BurstWriter *writer)
+{
+    if (writer->holdingSample)
+    {
+        uint8_t packed[2] = {(uint8_t)writer->heldSample, (uint8_t)(writer->heldSample >> 8)};
+        appendBytes(writer, packed, sizeof(packed));
+        writer->holdingSample = false;
+    }
+    if (writer->pageFill > 0)
+    {
+        if (writer->dataSize > 0 && writer->dataSize % BURST_BLOCK_DATA_SIZE == 0)
+        {
+            programBlockHeader(&writer->recording, writer->dataSize / BURST_BLOCK_DATA_SIZE);
+            writer->recording.blockCount++;
+        }
+        programSpiFlash(getDataAddress(&writer->recording, writer->dataSize), writer->page, writer->pageFill);
+        writer->checksum = updateBurstChecksum(writer->checksum, writer->page, writer->pageFill);
+        writer->dataSize += writer->pageFill;
+        writer->pageFill = 0;
+    }
+
+    BurstRecording *recording = &writer->recording;
+    recording->dataChecksum = writer->checksum;
+    uint32_t trailer[2] = {recording->sampleCount, recording->dataChecksum};
+    programSpiFlash(recording->firstBlock * SPI_FLASH_BLOCK_SIZE + offsetof(BurstBlockHeader, sampleCount), trailer, sizeof(trailer));
+}
+
+bool captureBurst(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, uint32_t numSamples, uint16_t *buffer, unsigned int bufferSize, BurstRecording *recording)
+{
+    BurstWriter writer;
+    uint32_t capacity = beginBurstRecording(&writer, sampleRate, numSamples);
+    if (capacity == 0)
+    {
+        memset(recording, 0, sizeof(*recording));
+        return false;
+    }
+    bool complete = capacity == numSamples;
+
+    uint16_t copy[BURST_COPY_SAMPLES];
+    uint32_t consumed = 0;
+    startContinuousAcquisition(pin, sampleTime, sampleRate, buffer, bufferSize);
+    while (consumed < capacity)
+    {
+        uint32_t count = getContinuousAcquisitionCount() - consumed;
+        count = count < BURST_COPY_SAMPLES ? count : BURST_COPY_SAMPLES;
+        count = count < capacity - consumed ? count : capacity - consumed;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            copy[i] = buffer[(consumed + i) % bufferSize];
+        }
+
+        // The copy is only valid when the conversions did not lap it before it was done, and none went missing.
+        if (getContinuousAcquisitionCount() - consumed > bufferSize || hasContinuousAcquisitionOverrun())
+        {
+            complete = false;
+            break;
+        }
+        writeBurstSamples(&writer, copy, count);
+        consumed += count;
+    }
+    stopContinuousAcquisition();
+
+    endBurstRecording(&writer);
+    *recording = writer.recording;
+    return complete;
+}
@@ -0,0 +1,141 @@
+#ifndef _BURST_H_
+#define _BURST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spiflash.h"
+
+// Burst capture: gap-free recordings far longer than a window, written to SPI flash (see spiflash.h) while they are
+// measured and uploaded to the server in chunks afterwards, see `captureBurst()`.
+//
+// The flash is a circular log of blocks. A recording takes up consecutive blocks, starting right after the newest
+// recording and overwriting the oldest ones. Every block starts with a header page, see `BurstBlockHeader`, followed by
+// samples packed as 12 bit codes: two samples in three bytes, the first in the low 12 bits, little-endian. A recording
+// with an odd number of samples ends with the last sample in two bytes. All blocks of a recording are erased before it
+// starts, as erasing is far slower than programming.
+//
+// Nothing is kept in RAM between recordings: after a reset the recordings are found again by scanning the headers.
+// Once a recording is complete its length and checksum are programmed into the still-erased end of its first header.
+// A recording cut short by a reset has neither, and its length is recovered from its last programmed page instead.
+
+// Identifies a block header. Reads "DDBB" in memory.
+#define BURST_BLOCK_MAGIC 0x42424444
+// Size of the header at the start of every block. A whole page, so the samples start on a page boundary. (bytes)
+#define BURST_HEADER_SIZE SPI_FLASH_PAGE_SIZE
+// Size of the samples in a block, a multiple of 3 bytes. (bytes)
+#define BURST_BLOCK_DATA_SIZE (SPI_FLASH_BLOCK_SIZE - BURST_HEADER_SIZE)
+// Value of a 32 bit field that has not been programmed.
+#define BURST_ERASED 0xFFFFFFFF
+// Number of samples copied out of the acquisition buffer at once while capturing.
+#define BURST_COPY_SAMPLES 512
+
+// Start of every block of a recording. Keep it in sync with server/burst.py.
+struct BurstBlockHeader
+{
+    uint32_t magic;
+    // Increases by one for every recording, so the newest one can be found.
+    uint32_t recordingId;
+    // Index of the block within the recording.
+    uint32_t blockIndex;
+    // Rate the recording was sampled at. (Hz)
+    uint32_t sampleRate;
+    // CRC-32 of the fields above.
+    uint32_t headerChecksum;
+    // Number of samples in the recording. Only in the first block, and only once the recording is complete.
+    uint32_t sampleCount;
+    // CRC-32 of the packed samples of the whole recording, next to `sampleCount`.
+    uint32_t dataChecksum;
+};
+
+// Recording found in the log, see `findNewestRecording()`.
+struct BurstRecording
+{
+    uint32_t recordingId;
+    uint32_t firstBlock;
+    uint32_t blockCount;
+    // (Hz)
+    uint32_t sampleRate;
+    uint32_t sampleCount;
+    // CRC-32 of the packed samples, or `BURST_ERASED` when the recording is incomplete.
+    uint32_t dataChecksum;
+};
+
+// Recording being written, see `beginBurstRecording()`.
+struct BurstWriter
+{
+    BurstRecording recording;
+    // Number of blocks that were erased for the recording.
+    uint32_t erasedBlocks;
+    // Number of bytes of packed samples programmed so far, excluding `page`.
+    uint32_t dataSize;
+    // Packed samples that do not fill a page yet.
+    uint8_t page[SPI_FLASH_PAGE_SIZE];
+    size_t pageFill;
+    // First sample of a pair, while waiting for the second.
+    uint16_t heldSample;
+    bool holdingSample;
+    uint32_t checksum;
+};
+
+/// @brief Finds the flash. Must be called before anything else in this file.
+/// @return the number of blocks in the log, or 0 when there is no flash.
+uint32_t beginBurstLog();
+
+/// @brief Finds the newest recording in the log by scanning the block headers.
+/// @param recording is where the recording is written to.
+/// @return whether there is a recording.
+bool findNewestRecording(BurstRecording *recording);
+
+/// @brief Returns the number of bytes the packed samples of a recording take up.
+/// @param sampleCount is the number of samples.
+uint32_t getBurstDataSize(uint32_t sampleCount);
+
+/// @brief Reads packed samples of a recording, as if they were stored without headers.
+/// @param recording is the recording to read.
+/// @param offset is the offset into the packed samples to start reading at. (bytes)
+/// @param data is where the bytes are written to.
+/// @param length is the number of bytes to read. Must not read past `getBurstDataSize()`.
+void readBurstData(const BurstRecording *recording, uint32_t offset, void *data, size_t length);
+
+/// @brief Starts a recording right after the newest one, erasing all blocks it can take up.
+/// @param writer is where the state of the recording is kept.
+/// @param sampleRate is the rate of the samples. (Hz)
+/// @param maxSamples is the most samples the recording will have. Limited to what fits in the whole log.
+/// @return the number of samples that fit in the erased blocks, or 0 when there is no flash.
+uint32_t beginBurstRecording(BurstWriter *writer, uint32_t sampleRate, uint32_t maxSamples);
+
+/// @brief Appends samples to a recording, programming every page once it is full.
+/// @param writer is the recording.
+/// @param samples are the 12 bit codes to append.
+/// @param count is the number of samples.
+/// @return the number of samples appended, less than `count` when the erased blocks are full.
+uint32_t writeBurstSamples(BurstWriter *writer, const uint16_t *samples, uint32_t count);
+
+/// @brief Programs the last partial page and marks the recording as complete.
+/// @param writer is the recording. Its `recording` holds the complete recording afterwards.
+void endBurstRecording(BurstWriter *writer);
+
+/// @brief Records a pin to the log without gaps. Blocks until the recording is complete.
+/// The conversions run in the background into `buffer` (see `startContinuousAcquisition()`), while they are copied out
+/// and programmed into the flash. When programming falls behind so far that the conversions overtake it, or conversions
+/// are lost (see `hasContinuousAcquisitionOverrun()`), the recording ends with the last sample that was copied in time,
+/// so it never contains a gap.
+/// @param pin is the analog pin to record.
+/// @param sampleTime is the sample time of every conversion, one of the `ADC_SampleTime_...` values.
+/// @param sampleRate is the rate to sample at. (Hz)
+/// @param numSamples is the number of samples to record.
+/// @param buffer is where the conversions are written to before they are programmed.
+/// @param bufferSize is the number of samples that fit in `buffer`. Even, and at least twice `BURST_COPY_SAMPLES`.
+/// @param recording is where the complete recording is written to.
+/// @return whether all `numSamples` samples were recorded.
+bool captureBurst(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, uint32_t numSamples, uint16_t *buffer, unsigned int bufferSize, BurstRecording *recording);
+
+/// @brief Continues a CRC-32 (IEEE 802.3, like `zlib.crc32()`) over more bytes.
+/// @param checksum is the checksum so far, 0 to start.
+/// @param data is the bytes to add.
+/// @param length is the number of bytes.
+/// @return the checksum including `data`.
+uint32_t updateBurstChecksum(uint32_t checksum, const void *data, size_t length);
+
+#endif
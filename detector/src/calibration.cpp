@@ -1,5 +1,10 @@
+#ifdef PLATFORM_ID
 #include "Particle.h"
+#endif
+#include <algorithm>
 #include <math.h>
+#include <stddef.h>
+#include <string.h>
 #include "calibration.h"
 
 /*
@@ -17,89 +22,240 @@ const float confDomainMax[] = {1.2f, 1.2f, 1.2f, 1.2f, 1.1f};
 const float confDomainMin[] = {0.3f, 0.3f, 0.3f, 0.3f, 0.3f};
 */
 
-const int confFitDegrees[] = {5, 5, 10, 5, 4};
+// The active calibration. Initialized with the compiled-in calibration and replaced by `applyCalibrationBlob()`
+// when a valid calibration is stored in EEPROM or received from the server.
 
-const float confFitCoefs3[] = {17.04581097, -63.96595693, 162.59782668, -236.94073226, 172.67443738, -48.59816129};
-const float confFitCoefs23[] = {27.07158011, -60.2291715, 153.70828641, -266.83179527, 232.16236735,
-                                -76.46715652};
-const float confFitCoefs234[] = {1.59112513e+04, -2.40368298e+05, 1.59750198e+06, -6.14565500e+06,
-                                 1.51710358e+07, -2.51335002e+07, 2.83203836e+07, -2.14455395e+07,
-                                 1.04508195e+07, -2.96128701e+06, 3.70716515e+05};
-const float confFitCoefs1234[] = {897.2211744, -5332.28472534, 13028.07943322, -15780.41280462,
-                                  9450.77066586, -2240.63451999};
-const float confFitCoefs12345[] = {-3849.72945749, 16788.40269701, -26916.67106135, 18981.87620309,
-                                   -4976.51328562};
+int confFitDegrees[] = {5, 5, 10, 5, 4};
 
-const float *confFitCoefs[] = {confFitCoefs3, confFitCoefs23, confFitCoefs234, confFitCoefs1234, confFitCoefs12345};
+float confFitCoefs[CALIBRATED_CONFIGURATIONS][CALIBRATION_MAX_DEGREE + 1] = {
+    // Sensor 3.
+    {17.04581097, -63.96595693, 162.59782668, -236.94073226, 172.67443738, -48.59816129},
+    // Sensors 2 and 3.
+    {27.07158011, -60.2291715, 153.70828641, -266.83179527, 232.16236735, -76.46715652},
+    // Sensors 2 to 4.
+    {1.59112513e+04, -2.40368298e+05, 1.59750198e+06, -6.14565500e+06,
+     1.51710358e+07, -2.51335002e+07, 2.83203836e+07, -2.14455395e+07,
+     1.04508195e+07, -2.96128701e+06, 3.70716515e+05},
+    // Sensors 1 to 4.
+    {897.2211744, -5332.28472534, 13028.07943322, -15780.41280462, 9450.77066586, -2240.63451999},
+    // Sensors 1 to 5.
+    {-3849.72945749, 16788.40269701, -26916.67106135, 18981.87620309, -4976.51328562}};
+
+float confDomainMax[] = {1.25f, 1.2f, 1.1f, 1.15f, 1.15f};
+float confDomainMin[] = {0.3f, 0.4f, 0.5f, 0.6f, 0.9f};
+
+uint8_t confSwitchConfigurations[] = {0b00100, 0b00110, 0b01110, 0b01111, 0b11111};
+
+// Whether a configuration uses the lookup table instead of evaluating its polynomial directly.
+// The degree 10 fit of configuration 234 has very large coefficients and is therefore tabulated.
+bool confUseLookupTable[] = {false, false, true, false, false};
 
-const float confDomainMax[] = {1.25f, 1.2f, 1.1f, 1.15f, 1.15f};
-const float confDomainMin[] = {0.3f, 0.4f, 0.5f, 0.6f, 0.9f};
+// Checksum of the active calibration blob. 0 when the compiled-in calibration is used.
+uint32_t activeCalibrationChecksum = 0;
+
+// Depths at `CALIBRATION_TABLE_SIZE` uniformly spaced voltages over [confDomainMin, confDomainMax].
+float confTableDepths[CALIBRATED_CONFIGURATIONS][CALIBRATION_TABLE_SIZE];
+// Derivatives of the depth with respect to the voltage at the same points, limited so the interpolation is monotonic.
+float confTableSlopes[CALIBRATED_CONFIGURATIONS][CALIBRATION_TABLE_SIZE];
 
 int getIndexByConfiguration(uint8_t activatedSwitches)
 {
-    switch (activatedSwitches)
-    {
-    case 0b00100:
-        return 0;
-    case 0b00110:
-        return 1;
-    case 0b01110:
-        return 2;
-    case 0b01111:
-        return 3;
-    case 0b11111:
-        return 4;
-    default:
-        // Going here should have been prevented as it is undefined behaviour.
-        return 5;
+    for (int index = 0; index < CALIBRATED_CONFIGURATIONS; index++)
+    {
+        if (confSwitchConfigurations[index] == activatedSwitches)
+        {
+            return index;
+        }
     }
+
+    // Going here should have been prevented as it is undefined behaviour.
+    return CALIBRATED_CONFIGURATIONS;
 }
 
-bool checkForValidCalibrationSwitchConfiguration(uint8_t activatedSwitches)
+void getDepthRangeByIndex(int index, float *depthMin, float *depthMax)
 {
-    switch (activatedSwitches)
-    {
-    case 0b00100:
-    case 0b00110:
-    case 0b01110:
-    case 0b01111:
-    case 0b11111:
-        return true;
-    default:
-        return false;
-    }
+    // Depth decreases with increasing voltage, so the edges of the domain are swapped.
+    *depthMin = getDepthByFit(confSwitchConfigurations[index], confDomainMax[index]);
+    *depthMax = getDepthByFit(confSwitchConfigurations[index], confDomainMin[index]);
 }
 
-float getDepthByFit(uint8_t activatedSwitches, float Vptp)
+uint8_t recommendSwitchConfiguration(uint8_t activatedSwitches, float Vptp)
 {
-    float depth = 0;
+    // Without a calibration for the current configuration there is nothing to compare against.
+    if (!checkForValidCalibrationSwitchConfiguration(activatedSwitches))
+    {
+        return activatedSwitches;
+    }
+
+    int currentIndex = getIndexByConfiguration(activatedSwitches);
+
+    float currentDepthMin = 0;
+    float currentDepthMax = 0;
+    getDepthRangeByIndex(currentIndex, &currentDepthMin, &currentDepthMax);
 
-    switch (activatedSwitches)
+    bool domainTooHigh = Vptp >= confDomainMax[currentIndex];
+    bool domainTooLow = Vptp <= confDomainMin[currentIndex];
+    float depth = getDepthByFit(activatedSwitches, Vptp);
+
+    // Within the range the current configuration is kept unless another one is clearly better, so noise on `Vptp`
+    // does not make the advice flip between two configurations that are about as good.
+    int bestIndex = currentIndex;
+    float bestScore = 0;
+    if (!domainTooHigh && !domainTooLow)
     {
-    /*
-    case 0b00100:
+        bestScore = std::min(depth - currentDepthMin, currentDepthMax - depth) / (currentDepthMax - currentDepthMin) + CALIBRATION_RECOMMENDATION_MARGIN;
+    }
+
+    for (int i = 0; i < CALIBRATED_CONFIGURATIONS; i++)
     {
-        float a = confFitCoefs3[0];
-        float b = confFitCoefs3[1];
-        float c = confFitCoefs3[2];
-        depth = a / (Vptp + b) + c;
-        break;
-    }*/
-    case 0b00100:
+        float depthMin = 0;
+        float depthMax = 0;
+        getDepthRangeByIndex(i, &depthMin, &depthMax);
 
-    case 0b00110:
-    case 0b01110:
-    case 0b01111:
-    case 0b11111:
+        float score = 0;
+        if (domainTooHigh)
+        {
+            // The cable is shallower than the current configuration can measure.
+            // Prefer the configuration that reaches furthest towards the surface.
+            score = currentDepthMin - depthMin;
+        }
+        else if (domainTooLow)
+        {
+            // The cable is deeper than the current configuration can measure.
+            // Prefer the configuration that reaches deepest.
+            score = depthMax - currentDepthMax;
+        }
+        else
+        {
+            // Prefer the configuration in which the depth lies furthest from the edges of its range.
+            score = std::min(depth - depthMin, depthMax - depth) / (depthMax - depthMin);
+        }
+
+        if (score > bestScore)
+        {
+            bestScore = score;
+            bestIndex = i;
+        }
+    }
+
+    return confSwitchConfigurations[bestIndex];
+}
+
+void buildCalibrationTables()
+{
+    for (int index = 0; index < CALIBRATED_CONFIGURATIONS; index++)
     {
-        int index = getIndexByConfiguration(activatedSwitches);
-        depth = polynomial(Vptp, confFitCoefs[index], confFitDegrees[index]) + 1;
-        break;
+        float *depths = confTableDepths[index];
+        float *slopes = confTableSlopes[index];
+
+        double step = (double)(confDomainMax[index] - confDomainMin[index]) / (CALIBRATION_TABLE_SIZE - 1);
+
+        // Sample the polynomial. This only happens once, so it is done in double precision using Horner's method.
+        for (int k = 0; k < CALIBRATION_TABLE_SIZE; k++)
+        {
+            double Vptp = confDomainMin[index] + k * step;
+            double depth = 0;
+            for (int i = confFitDegrees[index]; i >= 0; i--)
+            {
+                depth = depth * Vptp + confFitCoefs[index][i];
+            }
+            depths[k] = depth + 1;
+        }
+
+        // Fritsch-Carlson: start with the average of the neighbouring secants, or zero at a local extremum.
+        float secants[CALIBRATION_TABLE_SIZE - 1];
+        for (int k = 0; k < CALIBRATION_TABLE_SIZE - 1; k++)
+        {
+            secants[k] = (depths[k + 1] - depths[k]) / step;
+        }
+
+        slopes[0] = secants[0];
+        slopes[CALIBRATION_TABLE_SIZE - 1] = secants[CALIBRATION_TABLE_SIZE - 2];
+        for (int k = 1; k < CALIBRATION_TABLE_SIZE - 1; k++)
+        {
+            if (secants[k - 1] * secants[k] <= 0)
+            {
+                slopes[k] = 0;
+            }
+            else
+            {
+                slopes[k] = (secants[k - 1] + secants[k]) / 2;
+            }
+        }
+
+        // Limit the slopes so every interval stays monotonic.
+        for (int k = 0; k < CALIBRATION_TABLE_SIZE - 1; k++)
+        {
+            if (secants[k] == 0)
+            {
+                slopes[k] = 0;
+                slopes[k + 1] = 0;
+                continue;
+            }
+
+            float alpha = slopes[k] / secants[k];
+            float beta = slopes[k + 1] / secants[k];
+            float magnitude = alpha * alpha + beta * beta;
+            if (magnitude > 9)
+            {
+                float tau = 3 / sqrt(magnitude);
+                slopes[k] = tau * alpha * secants[k];
+                slopes[k + 1] = tau * beta * secants[k];
+            }
+        }
+    }
+}
+
+float lookupTable(int index, float Vptp)
+{
+    float domainMin = confDomainMin[index];
+    float step = (confDomainMax[index] - domainMin) / (CALIBRATION_TABLE_SIZE - 1);
+
+    // Outside the calibrated domain the depth is clamped to the edges of the table.
+    float position = (Vptp - domainMin) / step;
+    if (position <= 0)
+    {
+        return confTableDepths[index][0];
     }
-    default:
+    if (position >= CALIBRATION_TABLE_SIZE - 1)
+    {
+        return confTableDepths[index][CALIBRATION_TABLE_SIZE - 1];
+    }
+
+    int k = (int)position;
+    float t = position - k;
+    float t2 = t * t;
+    float t3 = t2 * t;
+
+    // Cubic Hermite interpolation between point k and k + 1.
+    return (2 * t3 - 3 * t2 + 1) * confTableDepths[index][k] +
+           (t3 - 2 * t2 + t) * step * confTableSlopes[index][k] +
+           (-2 * t3 + 3 * t2) * confTableDepths[index][k + 1] +
+           (t3 - t2) * step * confTableSlopes[index][k + 1];
+}
+
+bool checkForValidCalibrationSwitchConfiguration(uint8_t activatedSwitches)
+{
+    return getIndexByConfiguration(activatedSwitches) < CALIBRATED_CONFIGURATIONS;
+}
+
+float getDepthByFit(uint8_t activatedSwitches, float Vptp)
+{
+    float depth = 0;
+
+    int index = getIndexByConfiguration(activatedSwitches);
+    if (index == CALIBRATED_CONFIGURATIONS)
+    {
         // Going here should have been prevented as it is undefined behaviour.
         depth = 0.0;
-        break;
+    }
+    else if (confUseLookupTable[index])
+    {
+        depth = lookupTable(index, Vptp);
+    }
+    else
+    {
+        depth = polynomial(Vptp, confFitCoefs[index], confFitDegrees[index]) + 1;
     }
 
     return depth;
@@ -115,4 +271,89 @@ float polynomial(float Vptp, const float *coefs, int deg)
     }
 
     return output;
-}
\ No newline at end of file
+}
+
+uint32_t calculateCalibrationChecksum(const CalibrationBlob *blob)
+{
+    // CRC-32 (IEEE 802.3) over everything except the checksum itself.
+    const uint8_t *bytes = (const uint8_t *)blob;
+    size_t length = offsetof(CalibrationBlob, checksum);
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
+
+bool validateCalibrationBlob(const CalibrationBlob *blob)
+{
+    if (blob->magic != CALIBRATION_BLOB_MAGIC || blob->version != CALIBRATION_BLOB_VERSION)
+    {
+        return false;
+    }
+
+    if (blob->entryCount != CALIBRATED_CONFIGURATIONS)
+    {
+        return false;
+    }
+
+    for (int index = 0; index < CALIBRATED_CONFIGURATIONS; index++)
+    {
+        const CalibrationEntry *entry = &blob->entries[index];
+        if (entry->degree > CALIBRATION_MAX_DEGREE || !(entry->domainMin < entry->domainMax))
+        {
+            return false;
+        }
+    }
+
+    return blob->checksum == calculateCalibrationChecksum(blob);
+}
+
+bool applyCalibrationBlob(const CalibrationBlob *blob)
+{
+    if (!validateCalibrationBlob(blob))
+    {
+        return false;
+    }
+
+    for (int index = 0; index < CALIBRATED_CONFIGURATIONS; index++)
+    {
+        const CalibrationEntry *entry = &blob->entries[index];
+        confSwitchConfigurations[index] = entry->switchConfiguration;
+        confFitDegrees[index] = entry->degree;
+        confUseLookupTable[index] = entry->useLookupTable;
+        confDomainMin[index] = entry->domainMin;
+        confDomainMax[index] = entry->domainMax;
+        memcpy(confFitCoefs[index], entry->coefs, sizeof(entry->coefs));
+    }
+
+    activeCalibrationChecksum = blob->checksum;
+    buildCalibrationTables();
+
+    return true;
+}
+
+// Only the EEPROM depends on the device, everything above is also built into the server's native extension.
+#ifdef PLATFORM_ID
+
+bool loadCalibrationFromEEPROM()
+{
+    CalibrationBlob blob;
+    EEPROM.get(CALIBRATION_EEPROM_ADDRESS, blob);
+
+    return applyCalibrationBlob(&blob);
+}
+
+void storeCalibrationInEEPROM(const CalibrationBlob *blob)
+{
+    EEPROM.put(CALIBRATION_EEPROM_ADDRESS, *blob);
+}
+
+#endif
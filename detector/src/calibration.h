@@ -1,22 +1,81 @@
 #ifndef _CALIBRATION_H_
 #define _CALIBRATION_H_
 
+#include <stdint.h>
+
+// Number of switch configurations for which a calibration is available.
+#define CALIBRATED_CONFIGURATIONS 5
+// Number of points in the lookup table of a configuration.
+#define CALIBRATION_TABLE_SIZE 32
+
+// Highest polynomial degree a calibration fit can have.
+#define CALIBRATION_MAX_DEGREE 10
+// How much further from the edges of its range, as a fraction of the range, the depth has to lie in another
+// configuration before `recommendSwitchConfiguration()` recommends it over the current one.
+#define CALIBRATION_RECOMMENDATION_MARGIN 0.1
+
+// #### Calibration blob ####
+//
+// Binary format in which a calibration is stored in EEPROM and sent by the server.
+// All fields are little-endian. `calibration.ipynb` contains the tooling to create a blob.
+
+// Identifies a calibration blob. Spells ``DDCB`` in memory.
+#define CALIBRATION_BLOB_MAGIC 0x42434444
+// Version of the blob format. Blobs with a different version are rejected.
+#define CALIBRATION_BLOB_VERSION 1
+// EEPROM address at which the calibration blob is stored.
+#define CALIBRATION_EEPROM_ADDRESS 0
+
+// Calibration of a single switch configuration.
+struct CalibrationEntry
+{
+    uint8_t switchConfiguration;
+    uint8_t degree;
+    uint8_t useLookupTable;
+    uint8_t reserved;
+    float domainMin;
+    float domainMax;
+    float coefs[CALIBRATION_MAX_DEGREE + 1];
+};
+
+struct CalibrationBlob
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entryCount;
+    CalibrationEntry entries[CALIBRATED_CONFIGURATIONS];
+    // CRC-32 of all preceding bytes.
+    uint32_t checksum;
+};
+
+static_assert(sizeof(CalibrationBlob) == 292, "CalibrationBlob layout must match the tooling in calibration.ipynb.");
+
 bool checkForValidCalibrationSwitchConfiguration(uint8_t activatedSwitches);
 float getDepthByFit(uint8_t activatedSwitches, float Vptp);
 float polynomial(float Vptp, const float *coefs, int deg);
+void buildCalibrationTables();
+float lookupTable(int index, float Vptp);
 int getIndexByConfiguration(uint8_t activatedSwitches);
+void getDepthRangeByIndex(int index, float *depthMin, float *depthMax);
+uint8_t recommendSwitchConfiguration(uint8_t activatedSwitches, float Vptp);
+uint32_t calculateCalibrationChecksum(const CalibrationBlob *blob);
+bool validateCalibrationBlob(const CalibrationBlob *blob);
+bool applyCalibrationBlob(const CalibrationBlob *blob);
+bool loadCalibrationFromEEPROM();
+void storeCalibrationInEEPROM(const CalibrationBlob *blob);
+
+extern int confFitDegrees[];
 
-extern const int confFitDegrees[];
+extern float confFitCoefs[CALIBRATED_CONFIGURATIONS][CALIBRATION_MAX_DEGREE + 1];
 
-extern const float confFitCoefs3[];
-extern const float confFitCoefs23[];
-extern const float confFitCoefs234[];
-extern const float confFitCoefs1234[];
-extern const float confFitCoefs12345[];
+extern float confDomainMax[];
+extern float confDomainMin[];
 
-extern const float *confFitCoefs[];
+extern uint8_t confSwitchConfigurations[];
 
-extern const float confDomainMax[];
-extern const float confDomainMin[];
+extern bool confUseLookupTable[];
+extern uint32_t activeCalibrationChecksum;
+extern float confTableDepths[CALIBRATED_CONFIGURATIONS][CALIBRATION_TABLE_SIZE];
+extern float confTableSlopes[CALIBRATED_CONFIGURATIONS][CALIBRATION_TABLE_SIZE];
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#include "clocksync.h"
+
+void resetClockSync(ClockSync *sync)
+{
+    sync->synced = false;
+    sync->localTime = 0;
+    sync->serverTime = 0;
+    sync->roundTrip = 0;
+}
+
+void addClockSample(ClockSync *sync, uint32_t sendTime, uint64_t serverTime, uint32_t receiveTime)
+{
+    uint32_t roundTrip = receiveTime - sendTime;
+    if (sync->synced && roundTrip >= sync->roundTrip)
+    {
+        return;
+    }
+
+    sync->synced = true;
+    sync->localTime = sendTime + roundTrip / 2;
+    sync->serverTime = serverTime;
+    sync->roundTrip = roundTrip;
+}
+
+uint64_t toServerTime(const ClockSync *sync, uint32_t localTime)
+{
+    // Signed, so times shortly before the sample convert correctly too.
+    int32_t elapsed = (int32_t)(localTime - sync->localTime);
+    return sync->serverTime + elapsed;
+}
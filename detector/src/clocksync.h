@@ -0,0 +1,41 @@
+#ifndef _CLOCKSYNC_H_
+#define _CLOCKSYNC_H_
+
+#include <stdint.h>
+
+// Mapping of `millis()` to the clock of the server, so the device can timestamp its measurements in server time.
+//
+// A sync round asks the server for its time a few times. For every sample the server time is assumed to have been read
+// halfway the round trip, so the error of a sample is at most half its round trip. The sample with the shortest round
+// trip is kept. Times are converted relative to that sample, so `millis()` wrapping around does not matter.
+
+struct ClockSync
+{
+    // Whether a sample has been added since the last reset.
+    bool synced;
+    // Local time halfway the round trip of the kept sample, see `millis()`. (ms)
+    uint32_t localTime;
+    // Server time at `localTime`, in ms since the Unix epoch. (ms)
+    uint64_t serverTime;
+    // Round trip of the kept sample, twice the largest error of the conversion. (ms)
+    uint32_t roundTrip;
+};
+
+/// @brief Forgets all samples, to start a new sync round.
+/// @param sync is the clock sync to reset.
+void resetClockSync(ClockSync *sync);
+
+/// @brief Adds a sample of the server clock. Only kept when its round trip is shorter than that of the samples before it.
+/// @param sync is the clock sync to add the sample to.
+/// @param sendTime is the local time the request was sent. (ms)
+/// @param serverTime is the server time in the response. (ms)
+/// @param receiveTime is the local time the response was received. (ms)
+void addClockSample(ClockSync *sync, uint32_t sendTime, uint64_t serverTime, uint32_t receiveTime);
+
+/// @brief Converts a local time to server time. The sync must have a sample.
+/// @param sync is the clock sync to convert with.
+/// @param localTime is the local time, see `millis()`. Within 24 days of the kept sample. (ms)
+/// @return the server time, in ms since the Unix epoch. (ms)
+uint64_t toServerTime(const ClockSync *sync, uint32_t localTime);
+
+#endif
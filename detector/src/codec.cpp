@@ -0,0 +1,141 @@
+#include "codec.h"
+
+/// @brief Appends the lowest `count` bits of `value` to the encoding. `count` is at most 24.
+void writeBits(WaveformEncoder *encoder, uint32_t value, uint8_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    encoder->bits = (encoder->bits << count) | (value & ((1UL << count) - 1));
+    encoder->bitCount += count;
+
+    while (encoder->bitCount >= 8)
+    {
+        encoder->bitCount -= 8;
+        if (encoder->length < encoder->capacity)
+        {
+            encoder->buffer[encoder->length++] = encoder->bits >> encoder->bitCount;
+        }
+        else
+        {
+            encoder->overflow = true;
+        }
+    }
+    encoder->bits &= (1UL << encoder->bitCount) - 1;
+}
+
+/// @brief Writes the buffered residuals of the current block with the Rice parameter that suits them best.
+void flushBlock(WaveformEncoder *encoder)
+{
+    if (encoder->blockLength == 0)
+    {
+        return;
+    }
+
+    // A Rice parameter of about log2 of the mean residual gives the shortest code.
+    uint32_t sum = 0;
+    for (int i = 0; i < encoder->blockLength; i++)
+    {
+        sum += encoder->block[i];
+    }
+    uint8_t k = 0;
+    while (k < CODEC_ESCAPE_BITS && ((uint32_t)encoder->blockLength << (k + 1)) <= sum)
+    {
+        k++;
+    }
+    writeBits(encoder, k, 5);
+
+    for (int i = 0; i < encoder->blockLength; i++)
+    {
+        uint32_t value = encoder->block[i];
+        uint32_t quotient = value >> k;
+        if (quotient < CODEC_ESCAPE_LENGTH)
+        {
+            // `quotient` 1 bits followed by a 0 bit.
+            writeBits(encoder, (1UL << (quotient + 1)) - 2, quotient + 1);
+            writeBits(encoder, value, k);
+        }
+        else
+        {
+            writeBits(encoder, (1UL << CODEC_ESCAPE_LENGTH) - 1, CODEC_ESCAPE_LENGTH);
+            writeBits(encoder, value, CODEC_ESCAPE_BITS);
+        }
+    }
+    encoder->blockLength = 0;
+}
+
+void beginWaveformEncoding(WaveformEncoder *encoder, uint8_t *buffer, size_t capacity)
+{
+    encoder->buffer = buffer;
+    encoder->capacity = capacity;
+    encoder->length = 0;
+    encoder->overflow = false;
+    encoder->bits = 0;
+    encoder->bitCount = 0;
+    encoder->previous = 0;
+    encoder->sampleCount = 0;
+    encoder->blockLength = 0;
+
+    // Room for the number of samples, which is filled in at the end.
+    writeBits(encoder, 0, 8);
+    writeBits(encoder, 0, 8);
+}
+
+void encodeWaveformSample(WaveformEncoder *encoder, int32_t sample)
+{
+    int32_t residual = sample - encoder->previous;
+    encoder->previous = sample;
+    encoder->sampleCount++;
+
+    // Zigzag encoding interleaves negative and positive residuals: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+    encoder->block[encoder->blockLength++] = ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+    if (encoder->blockLength == CODEC_BLOCK_SIZE)
+    {
+        flushBlock(encoder);
+    }
+}
+
+size_t endWaveformEncoding(WaveformEncoder *encoder)
+{
+    flushBlock(encoder);
+    // Pad the last byte with zeros.
+    writeBits(encoder, 0, (8 - encoder->bitCount) % 8);
+
+    if (encoder->overflow)
+    {
+        return 0;
+    }
+    encoder->buffer[0] = encoder->sampleCount & 0xFF;
+    encoder->buffer[1] = encoder->sampleCount >> 8;
+    return encoder->length;
+}
+
+size_t encodeBase64(const uint8_t *data, size_t length, char *output, size_t capacity)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t outputLength = (length + 2) / 3 * 4;
+    if (outputLength + 1 > capacity)
+    {
+        return 0;
+    }
+
+    char *out = output;
+    for (size_t i = 0; i < length; i += 3)
+    {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < length)
+            group |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length)
+            group |= data[i + 2];
+
+        *out++ = alphabet[(group >> 18) & 0x3F];
+        *out++ = alphabet[(group >> 12) & 0x3F];
+        *out++ = i + 1 < length ? alphabet[(group >> 6) & 0x3F] : '=';
+        *out++ = i + 2 < length ? alphabet[group & 0x3F] : '=';
+    }
+    *out = 0;
+    return outputLength;
+}
@@ -0,0 +1,72 @@
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Lossless codec for windows of measurements, see `WaveformEncoder`. Decoded by server/codec.py.
+//
+// Format:
+//     - 2 bytes: number of samples, little endian.
+//     - Blocks of `CODEC_BLOCK_SIZE` samples (the last block may be shorter), packed most significant bit first:
+//         - 5 bits: Rice parameter k of the block.
+//         - Per sample, the residual from the previous sample (the first sample is predicted as 0), zigzag encoded to u:
+//             - u >> k in unary (that many 1 bits and a 0 bit), followed by the lowest k bits of u.
+//             - When u >> k >= `CODEC_ESCAPE_LENGTH`: `CODEC_ESCAPE_LENGTH` 1 bits followed by u in `CODEC_ESCAPE_BITS` bits.
+//     - Zero padding up to the next byte.
+
+// Number of samples that share a Rice parameter.
+#define CODEC_BLOCK_SIZE 32
+// Length of the unary code that marks an escaped residual.
+#define CODEC_ESCAPE_LENGTH 16
+// Number of bits of an escaped residual. Samples should differ by less than 2^(`CODEC_ESCAPE_BITS` - 1).
+#define CODEC_ESCAPE_BITS 24
+// Largest encoded size of `n` samples, in bytes.
+#define CODEC_MAX_ENCODED_SIZE(n) (2 + ((n) * (CODEC_ESCAPE_LENGTH + CODEC_ESCAPE_BITS) + ((n) / CODEC_BLOCK_SIZE + 1) * 5 + 7) / 8)
+
+// State of an encoding in progress. Samples are added one at a time, so a window can be encoded while it is measured.
+// Everything lives in this struct and in the output buffer supplied by the caller, nothing is allocated.
+struct WaveformEncoder
+{
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    // Set when the encoding did not fit in `buffer`.
+    bool overflow;
+
+    // Bits that don't fill a byte yet, in the lowest `bitCount` bits.
+    uint32_t bits;
+    uint8_t bitCount;
+
+    int32_t previous;
+    uint16_t sampleCount;
+    // Zigzag encoded residuals of the current block, which are written once the Rice parameter is known.
+    uint32_t block[CODEC_BLOCK_SIZE];
+    uint8_t blockLength;
+};
+
+/// @brief Starts a new encoding.
+/// @param encoder is the encoder to start.
+/// @param buffer is where the encoded samples are written to.
+/// @param capacity is the size of `buffer` in bytes. See `CODEC_MAX_ENCODED_SIZE()` for a size that always suffices.
+void beginWaveformEncoding(WaveformEncoder *encoder, uint8_t *buffer, size_t capacity);
+
+/// @brief Adds a sample to the encoding.
+/// @param encoder is the encoder to add the sample to.
+/// @param sample is the sample, for example a voltage in units of 10 mV.
+void encodeWaveformSample(WaveformEncoder *encoder, int32_t sample);
+
+/// @brief Finishes the encoding.
+/// @param encoder is the encoder to finish.
+/// @return the length of the encoding in bytes, or 0 when it did not fit in the buffer.
+size_t endWaveformEncoding(WaveformEncoder *encoder);
+
+/// @brief Encodes data to base64, so it can be put in a JSON string.
+/// @param data is the data to encode.
+/// @param length is the length of `data` in bytes.
+/// @param output is where the null terminated base64 text is written to.
+/// @param capacity is the size of `output`. Should be at least 4 * ceil(`length` / 3) + 1.
+/// @return the length of the base64 text, or 0 when it did not fit in `output`.
+size_t encodeBase64(const uint8_t *data, size_t length, char *output, size_t capacity);
+
+#endif
@@ -0,0 +1,74 @@
+#ifdef PLATFORM_ID
+#include "Particle.h"
+#endif
+#include <math.h>
+#include <string.h>
+#include "filter.h"
+
+/// @brief Returns the median of an array. The array is sorted in place.
+float medianOf(float *values, int count)
+{
+    // Insertion sort, the arrays are tiny.
+    for (int i = 1; i < count; i++)
+    {
+        float value = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > value)
+        {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = value;
+    }
+
+    if (count % 2)
+    {
+        return values[count / 2];
+    }
+    return (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+void resetMedianFilter(MedianFilter *filter)
+{
+    filter->count = 0;
+    filter->next = 0;
+}
+
+void addToMedianFilter(MedianFilter *filter, float value)
+{
+    filter->values[filter->next] = value;
+    filter->next = (filter->next + 1) % MEDIAN_FILTER_SIZE;
+    if (filter->count < MEDIAN_FILTER_SIZE)
+    {
+        filter->count++;
+    }
+}
+
+float getMedian(const MedianFilter *filter)
+{
+    if (filter->count == 0)
+    {
+        return 0;
+    }
+
+    float values[MEDIAN_FILTER_SIZE];
+    memcpy(values, filter->values, filter->count * sizeof(float));
+    return medianOf(values, filter->count);
+}
+
+float getMedianAbsoluteDeviation(const MedianFilter *filter)
+{
+    if (filter->count == 0)
+    {
+        return 0;
+    }
+
+    float median = getMedian(filter);
+
+    float deviations[MEDIAN_FILTER_SIZE];
+    for (int i = 0; i < filter->count; i++)
+    {
+        deviations[i] = fabs(filter->values[i] - median);
+    }
+    return medianOf(deviations, filter->count);
+}
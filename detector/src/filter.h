@@ -0,0 +1,34 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+// Number of values a median filter keeps.
+#define MEDIAN_FILTER_SIZE 7
+
+// Keeps the last `MEDIAN_FILTER_SIZE` values, so their median can be used as a robust estimate.
+struct MedianFilter
+{
+    float values[MEDIAN_FILTER_SIZE];
+    int count;
+    int next;
+};
+
+/// @brief Removes all values from the filter.
+/// @param filter is the filter to reset.
+void resetMedianFilter(MedianFilter *filter);
+
+/// @brief Adds a value to the filter, replacing the oldest value when the filter is full.
+/// @param filter is the filter to add the value to.
+/// @param value is the value to add.
+void addToMedianFilter(MedianFilter *filter, float value);
+
+/// @brief Returns the median of the values in the filter.
+/// @param filter is the filter to return the median of.
+/// @return the median, or 0 when the filter is empty.
+float getMedian(const MedianFilter *filter);
+
+/// @brief Returns the median absolute deviation of the values in the filter, a measure of their spread that ignores outliers.
+/// @param filter is the filter to return the median absolute deviation of.
+/// @return the median absolute deviation, or 0 when the filter is empty.
+float getMedianAbsoluteDeviation(const MedianFilter *filter);
+
+#endif
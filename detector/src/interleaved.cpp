@@ -0,0 +1,445 @@
+#include "interleaved.h"
+
+// State of continuous acquisition, see `getContinuousAcquisitionCount()`.
+static unsigned int continuousBufferSize = 0;
+// Half passes through the buffer, counted by the half and full transfer interrupts of the DMA.
+static volatile uint32_t continuousHalfPasses = 0;
+static volatile bool continuousOverrun = false;
+
+/// @brief Counts the half passes of the transfer flags the DMA interrupt found set. Only called from the interrupt.
+static void countContinuousHalfPasses(bool halfTransfer, bool transferComplete)
+{
+    // Both at once means the interrupt was held off for at least half a pass, so it can not tell how many went by.
+    if (halfTransfer && transferComplete)
+    {
+        continuousOverrun = true;
+    }
+    continuousHalfPasses += halfTransfer + transferComplete;
+}
+
+/// @brief Returns the number of conversions from the counted half passes and the position the DMA writes to next.
+/// The interrupt may not have counted a half pass that just ended, so the position is taken relative to the start of
+/// the half the counted passes end in, which also counts it.
+static uint32_t countContinuousConversions(uint32_t halfPasses, unsigned int position)
+{
+    unsigned int half = continuousBufferSize / 2;
+    unsigned int halfStart = halfPasses % 2 * half;
+    return halfPasses * half + (position + continuousBufferSize - halfStart) % continuousBufferSize;
+}
+
+#ifdef PLATFORM_ID
+
+#include "Particle.h"
+#include "stm32f2xx.h"
+
+// DMA streams and channels that serve the requests of ADC1 and ADC2, see the DMA2 request mapping.
+#define ADC1_DMA_STREAM DMA2_Stream0
+#define ADC1_DMA_CHANNEL 0
+#define ADC2_DMA_STREAM DMA2_Stream2
+#define ADC2_DMA_CHANNEL 1
+
+// Longest time to wait for the DMA on top of the duration of the window. (ms)
+#define INTERLEAVED_TIMEOUT_MARGIN 10
+
+// Conversions of ADC1 and ADC2, which the DMA writes to while the window is measured.
+static uint16_t interleavedSamples[2][INTERLEAVED_MAX_SAMPLES / 2];
+
+// Registers changed by an interleaved capture. `analogRead()` expects to find them the way it left them.
+struct SavedRegisters
+{
+    uint32_t commonControl;
+    uint32_t adcControl1[2];
+    uint32_t adcControl2[2];
+    uint32_t adcSampleTime1[2];
+    uint32_t adcSampleTime2[2];
+    uint32_t adcSequence1[2];
+    uint32_t adcSequence3[2];
+    uint32_t dmaControl[2];
+    uint32_t dmaPeripheralAddress[2];
+    uint32_t dmaMemoryAddress[2];
+    uint32_t dmaCount[2];
+    uint32_t dmaFifoControl[2];
+    uint32_t timerControl;
+    uint32_t timerPrescaler;
+    uint32_t timerReload;
+    uint32_t timerCompareMode;
+    uint32_t timerCompareEnable;
+    uint32_t timerCompare1;
+    uint32_t timerCompare2;
+    uint32_t timerBreak;
+};
+
+static ADC_TypeDef *const adcs[2] = {ADC1, ADC2};
+static DMA_Stream_TypeDef *const dmaStreams[2] = {ADC1_DMA_STREAM, ADC2_DMA_STREAM};
+static const uint32_t dmaChannels[2] = {ADC1_DMA_CHANNEL, ADC2_DMA_CHANNEL};
+
+static void saveRegisters(SavedRegisters *saved)
+{
+    saved->commonControl = ADC->CCR;
+    for (int i = 0; i < 2; i++)
+    {
+        saved->adcControl1[i] = adcs[i]->CR1;
+        saved->adcControl2[i] = adcs[i]->CR2;
+        saved->adcSampleTime1[i] = adcs[i]->SMPR1;
+        saved->adcSampleTime2[i] = adcs[i]->SMPR2;
+        saved->adcSequence1[i] = adcs[i]->SQR1;
+        saved->adcSequence3[i] = adcs[i]->SQR3;
+        saved->dmaControl[i] = dmaStreams[i]->CR;
+        saved->dmaPeripheralAddress[i] = dmaStreams[i]->PAR;
+        saved->dmaMemoryAddress[i] = dmaStreams[i]->M0AR;
+        saved->dmaCount[i] = dmaStreams[i]->NDTR;
+        saved->dmaFifoControl[i] = dmaStreams[i]->FCR;
+    }
+    saved->timerControl = TIM1->CR1;
+    saved->timerPrescaler = TIM1->PSC;
+    saved->timerReload = TIM1->ARR;
+    saved->timerCompareMode = TIM1->CCMR1;
+    saved->timerCompareEnable = TIM1->CCER;
+    saved->timerCompare1 = TIM1->CCR1;
+    saved->timerCompare2 = TIM1->CCR2;
+    saved->timerBreak = TIM1->BDTR;
+}
+
+static void disableDmaStream(DMA_Stream_TypeDef *stream)
+{
+    stream->CR &= ~DMA_SxCR_EN;
+    while (stream->CR & DMA_SxCR_EN)
+    {
+    }
+}
+
+static void restoreRegisters(const SavedRegisters *saved)
+{
+    TIM1->CR1 = 0;
+    TIM1->PSC = saved->timerPrescaler;
+    TIM1->ARR = saved->timerReload;
+    TIM1->CCMR1 = saved->timerCompareMode;
+    TIM1->CCER = saved->timerCompareEnable;
+    TIM1->CCR1 = saved->timerCompare1;
+    TIM1->CCR2 = saved->timerCompare2;
+    TIM1->BDTR = saved->timerBreak;
+    TIM1->CR1 = saved->timerControl;
+
+    for (int i = 0; i < 2; i++)
+    {
+        adcs[i]->CR2 = 0;
+        adcs[i]->SR = 0;
+        adcs[i]->CR1 = saved->adcControl1[i];
+        adcs[i]->SMPR1 = saved->adcSampleTime1[i];
+        adcs[i]->SMPR2 = saved->adcSampleTime2[i];
+        adcs[i]->SQR1 = saved->adcSequence1[i];
+        adcs[i]->SQR3 = saved->adcSequence3[i];
+        adcs[i]->CR2 = saved->adcControl2[i];
+
+        // Left disabled, `analogRead()` enables the stream when it needs it.
+        disableDmaStream(dmaStreams[i]);
+        dmaStreams[i]->PAR = saved->dmaPeripheralAddress[i];
+        dmaStreams[i]->M0AR = saved->dmaMemoryAddress[i];
+        dmaStreams[i]->NDTR = saved->dmaCount[i];
+        dmaStreams[i]->FCR = saved->dmaFifoControl[i];
+        dmaStreams[i]->CR = saved->dmaControl[i] & ~DMA_SxCR_EN;
+    }
+    ADC->CCR = saved->commonControl;
+}
+
+/// @brief Starts TIM1 with a period of `period` timer clocks. Compare channel 1 rises 1 clock into every period, and
+/// compare channel 2 half a period later.
+static void startTimer(uint32_t period)
+{
+    // In PWM mode 2 the reference of a compare channel rises when the counter reaches the compare value.
+    TIM1->PSC = 0;
+    TIM1->ARR = period - 1;
+    TIM1->CCR1 = 1;
+    TIM1->CCR2 = 1 + period / 2;
+    TIM1->CCMR1 = (7UL << 4) | (7UL << 12);
+    TIM1->CCER = TIM_CCER_CC1E | TIM_CCER_CC2E;
+    TIM1->BDTR = TIM_BDTR_MOE;
+    TIM1->CNT = 0;
+    TIM1->EGR = TIM_EGR_UG;
+    TIM1->CR1 = TIM_CR1_CEN;
+}
+
+/// @brief Sets the sample time of a channel, which is spread over two registers.
+static void setChannelSampleTime(ADC_TypeDef *adc, uint8_t channel, uint8_t sampleTime)
+{
+    if (channel >= 10)
+    {
+        adc->SMPR1 = (adc->SMPR1 & ~(7UL << (3 * (channel - 10)))) | ((uint32_t)sampleTime << (3 * (channel - 10)));
+    }
+    else
+    {
+        adc->SMPR2 = (adc->SMPR2 & ~(7UL << (3 * channel))) | ((uint32_t)sampleTime << (3 * channel));
+    }
+}
+
+bool captureInterleavedWindow(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, float *voltageArray, unsigned int numMeasurements, float *loopTime)
+{
+    uint8_t channel = HAL_Pin_Map()[pin].adc_channel;
+    unsigned int samplesPerAdc = numMeasurements / 2;
+    // Every ADC converts once per timer period.
+    uint32_t period = INTERLEAVED_TIMER_CLOCK / (sampleRate / 2);
+
+    RCC->APB2ENR |= RCC_APB2ENR_TIM1EN | RCC_APB2ENR_ADC1EN | RCC_APB2ENR_ADC2EN;
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+
+    SavedRegisters saved;
+    saveRegisters(&saved);
+
+    TIM1->CR1 = 0;
+    // Independent mode, keeping the ADC clock prescaler.
+    ADC->CCR &= ADC_CCR_ADCPRE;
+    // Clear all flags of both DMA streams.
+    DMA2->LIFCR = 0x3DUL | (0x3DUL << 16);
+
+    for (int i = 0; i < 2; i++)
+    {
+        disableDmaStream(dmaStreams[i]);
+        dmaStreams[i]->PAR = (uint32_t)&adcs[i]->DR;
+        dmaStreams[i]->M0AR = (uint32_t)interleavedSamples[i];
+        dmaStreams[i]->NDTR = samplesPerAdc;
+        dmaStreams[i]->FCR = 0;
+        // 16 bit transfers from the peripheral to incrementing memory addresses.
+        dmaStreams[i]->CR = dmaChannels[i] * DMA_SxCR_CHSEL_0 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_EN;
+
+        adcs[i]->CR2 = 0;
+        adcs[i]->SR = 0;
+        adcs[i]->CR1 = 0;
+        setChannelSampleTime(adcs[i], channel, sampleTime);
+        adcs[i]->SQR1 = 0;
+        adcs[i]->SQR3 = channel;
+        // Convert on the rising edge of TIM1_CC1 for ADC1 and of TIM1_CC2 for ADC2.
+        adcs[i]->CR2 = ADC_CR2_ADON | ADC_CR2_DMA | ADC_CR2_EXTEN_0 | i * ADC_CR2_EXTSEL_0;
+    }
+    // The ADCs need a few microseconds to power up.
+    delayMicroseconds(3);
+
+    // The compare channels trigger their ADC half a period apart.
+    startTimer(period);
+
+    unsigned long timeout = numMeasurements * 1000UL / sampleRate + INTERLEAVED_TIMEOUT_MARGIN;
+    unsigned long startTime = millis();
+    bool complete = false;
+    while (millis() - startTime < timeout)
+    {
+        if ((DMA2->LISR & DMA_LISR_TCIF0) && (DMA2->LISR & DMA_LISR_TCIF2))
+        {
+            complete = true;
+            break;
+        }
+    }
+
+    restoreRegisters(&saved);
+
+    if (!complete)
+    {
+        return false;
+    }
+
+    // ADC1 took the even measurements and ADC2 the odd ones.
+    for (unsigned int i = 0; i < numMeasurements; i++)
+    {
+        voltageArray[i] = interleavedSamples[i % 2][i / 2] * 3.3 / 4095.0;
+    }
+    *loopTime = 1000.0 / sampleRate;
+
+    return true;
+}
+
+// Registers changed by continuous acquisition, restored when it stops.
+static SavedRegisters continuousSaved;
+
+static void handleContinuousDmaInterrupt()
+{
+    uint32_t flags = DMA2->LISR;
+    DMA2->LIFCR = flags & (DMA_LISR_HTIF0 | DMA_LISR_TCIF0 | DMA_LISR_TEIF0);
+    if (flags & DMA_LISR_TEIF0)
+    {
+        continuousOverrun = true;
+    }
+    countContinuousHalfPasses(flags & DMA_LISR_HTIF0, flags & DMA_LISR_TCIF0);
+}
+
+void startContinuousAcquisition(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, uint16_t *buffer, unsigned int bufferSize)
+{
+    uint8_t channel = HAL_Pin_Map()[pin].adc_channel;
+
+    RCC->APB2ENR |= RCC_APB2ENR_TIM1EN | RCC_APB2ENR_ADC1EN;
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+
+    saveRegisters(&continuousSaved);
+    continuousBufferSize = bufferSize;
+    continuousHalfPasses = 0;
+    continuousOverrun = false;
+
+    TIM1->CR1 = 0;
+    ADC->CCR &= ADC_CCR_ADCPRE;
+    DMA2->LIFCR = 0x3DUL;
+
+    disableDmaStream(ADC1_DMA_STREAM);
+    ADC1_DMA_STREAM->PAR = (uint32_t)&ADC1->DR;
+    ADC1_DMA_STREAM->M0AR = (uint32_t)buffer;
+    ADC1_DMA_STREAM->NDTR = bufferSize;
+    ADC1_DMA_STREAM->FCR = 0;
+    // Like an interleaved capture, but circular so it never stops by itself, and interrupting at every half pass.
+    attachInterruptDirect(DMA2_Stream0_IRQn, handleContinuousDmaInterrupt);
+    ADC1_DMA_STREAM->CR = ADC1_DMA_CHANNEL * DMA_SxCR_CHSEL_0 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_CIRC |
+                          DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_TEIE | DMA_SxCR_EN;
+
+    ADC1->CR2 = 0;
+    ADC1->SR = 0;
+    ADC1->CR1 = 0;
+    setChannelSampleTime(ADC1, channel, sampleTime);
+    ADC1->SQR1 = 0;
+    ADC1->SQR3 = channel;
+    // DDS keeps the DMA requests going after the first pass through the buffer.
+    ADC1->CR2 = ADC_CR2_ADON | ADC_CR2_DMA | ADC_CR2_DDS | ADC_CR2_EXTEN_0;
+    delayMicroseconds(3);
+
+    startTimer(INTERLEAVED_TIMER_CLOCK / sampleRate);
+}
+
+uint32_t getContinuousAcquisitionCount()
+{
+    // Read again when the interrupt counted a half pass in between, so the position goes with the half passes.
+    uint32_t halfPasses;
+    unsigned int position;
+    do
+    {
+        halfPasses = continuousHalfPasses;
+        position = continuousBufferSize - ADC1_DMA_STREAM->NDTR;
+    } while (halfPasses != continuousHalfPasses);
+    return countContinuousConversions(halfPasses, position);
+}
+
+bool hasContinuousAcquisitionOverrun()
+{
+    // With DDS the ADC stops requesting transfers after an overrun, so no more conversions would arrive either.
+    return continuousOverrun || (ADC1->SR & ADC_SR_OVR);
+}
+
+void stopContinuousAcquisition()
+{
+    restoreRegisters(&continuousSaved);
+    detachInterruptDirect(DMA2_Stream0_IRQn);
+}
+
+#else
+
+#include <math.h>
+#include <stdlib.h>
+
+float (*simulatedSignal)(double time) = NULL;
+float simulatedGainMismatch = 1.0;
+float simulatedOffsetMismatch = 0.0;
+float simulatedNoise = 0.0;
+
+/// @brief Returns normally distributed noise with a standard deviation of 1.
+static float getGaussianNoise()
+{
+    // Box-Muller transform.
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+bool captureInterleavedWindow(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, float *voltageArray, unsigned int numMeasurements, float *loopTime)
+{
+    (void)pin;
+    (void)sampleTime;
+
+    for (unsigned int i = 0; i < numMeasurements; i++)
+    {
+        double time = (double)i / sampleRate;
+        float voltage = simulatedSignal ? simulatedSignal(time) : 0;
+        // ADC2 took the odd measurements.
+        if (i % 2)
+        {
+            voltage = voltage * simulatedGainMismatch + simulatedOffsetMismatch;
+        }
+        voltage += simulatedNoise * getGaussianNoise();
+
+        // Quantize like the 12 bit ADCs, which also clip at the supply rails.
+        long code = lround(voltage / 3.3 * 4095);
+        code = code < 0 ? 0 : (code > 4095 ? 4095 : code);
+        voltageArray[i] = code * 3.3 / 4095.0;
+    }
+    *loopTime = 1000.0 / sampleRate;
+
+    return true;
+}
+
+unsigned int simulatedConversionsPerPoll = 256;
+unsigned int simulatedStallConversions = 0;
+uint32_t simulatedStallStart = 0;
+bool simulatedStallMasksInterrupts = false;
+
+static uint16_t *continuousBuffer = NULL;
+static uint32_t continuousSampleRate = 0;
+// Conversions made by the simulated ADC, which the count has to match.
+static uint32_t simulatedConversions = 0;
+// Transfer flags of the simulated DMA stream that the interrupt has not handled yet.
+static bool pendingHalfTransfer = false;
+static bool pendingTransferComplete = false;
+
+/// @brief Makes conversions into the buffer like the DMA does, and runs the interrupt for every half pass, or only
+/// once afterwards when interrupts are held off.
+static void simulateConversions(unsigned int conversions, bool interruptsEnabled)
+{
+    for (unsigned int i = 0; i < conversions; i++)
+    {
+        double time = (double)simulatedConversions / continuousSampleRate;
+        float voltage = (simulatedSignal ? simulatedSignal(time) : 0) + simulatedNoise * getGaussianNoise();
+        long code = lround(voltage / 3.3 * 4095);
+        continuousBuffer[simulatedConversions % continuousBufferSize] = (uint16_t)(code < 0 ? 0 : (code > 4095 ? 4095 : code));
+        simulatedConversions++;
+
+        unsigned int position = simulatedConversions % continuousBufferSize;
+        pendingHalfTransfer = pendingHalfTransfer || position == continuousBufferSize / 2;
+        pendingTransferComplete = pendingTransferComplete || position == 0;
+        if (interruptsEnabled)
+        {
+            countContinuousHalfPasses(pendingHalfTransfer, pendingTransferComplete);
+            pendingHalfTransfer = false;
+            pendingTransferComplete = false;
+        }
+    }
+    countContinuousHalfPasses(pendingHalfTransfer, pendingTransferComplete);
+    pendingHalfTransfer = false;
+    pendingTransferComplete = false;
+}
+
+void startContinuousAcquisition(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, uint16_t *buffer, unsigned int bufferSize)
+{
+    (void)pin;
+    (void)sampleTime;
+
+    continuousBuffer = buffer;
+    continuousBufferSize = bufferSize;
+    continuousSampleRate = sampleRate;
+    continuousHalfPasses = 0;
+    continuousOverrun = false;
+    simulatedConversions = 0;
+}
+
+uint32_t getContinuousAcquisitionCount()
+{
+    simulateConversions(simulatedConversionsPerPoll, true);
+    if (simulatedStallConversions > 0 && simulatedConversions >= simulatedStallStart)
+    {
+        simulateConversions(simulatedStallConversions, !simulatedStallMasksInterrupts);
+        simulatedStallConversions = 0;
+    }
+    return countContinuousConversions(continuousHalfPasses, simulatedConversions % continuousBufferSize);
+}
+
+bool hasContinuousAcquisitionOverrun()
+{
+    return continuousOverrun;
+}
+
+void stopContinuousAcquisition()
+{
+    continuousBuffer = NULL;
+}
+
+#endif
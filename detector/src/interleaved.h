@@ -0,0 +1,76 @@
+#ifndef _INTERLEAVED_H_
+#define _INTERLEAVED_H_
+
+#include <stdint.h>
+
+// Interleaved acquisition with two ADCs, see `captureInterleavedWindow()`.
+//
+// On the device ADC1 and ADC2 convert the same channel independently, each started by its own compare channel of TIM1.
+// The compare channels are half a period apart, so the ADCs take turns and the window is sampled at twice the rate of
+// a single ADC. Every ADC writes its conversions to its own buffer with DMA, nothing is read by the CPU until the
+// window is complete. The ADC, DMA and timer registers are restored afterwards, so `analogRead()` keeps working.
+//
+// Continuous acquisition, see `startContinuousAcquisition()`, uses the same timer and DMA setup with ADC1 alone. It keeps
+// converting into a circular buffer until it is stopped, for recordings longer than any window.
+//
+// On any other platform the ADCs are simulated, so the rest of the pipeline can be run on host at the same rate.
+
+// Most measurements a window can have.
+#define INTERLEAVED_MAX_SAMPLES 1000
+// Clock of TIM1, which runs at twice the APB2 clock. (Hz)
+#define INTERLEAVED_TIMER_CLOCK 120000000
+
+/// @brief Samples a pin into `voltageArray` at a fixed rate, alternating between two ADCs.
+/// @param pin is the analog pin to sample.
+/// @param sampleTime is the sample time of every conversion, one of the `ADC_SampleTime_...` values. Every ADC has to
+/// finish a conversion within 2 / `sampleRate`.
+/// @param sampleRate is the combined rate of both ADCs. (Hz)
+/// @param voltageArray is where the measurements are written to. (V)
+/// @param numMeasurements is the number of measurements to take. Must be even and at most `INTERLEAVED_MAX_SAMPLES`.
+/// @param loopTime is where the time between measurements is written to. (ms)
+/// @return whether the window was completed. When the conversions time out, `voltageArray` is left unchanged.
+bool captureInterleavedWindow(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, float *voltageArray, unsigned int numMeasurements, float *loopTime);
+
+/// @brief Starts sampling a pin at a fixed rate with ADC1 into a circular buffer, until `stopContinuousAcquisition()`.
+/// @param pin is the analog pin to sample.
+/// @param sampleTime is the sample time of every conversion, one of the `ADC_SampleTime_...` values. The ADC has to
+/// finish a conversion within 1 / `sampleRate`.
+/// @param sampleRate is the rate of the conversions. (Hz)
+/// @param buffer is where the conversions are written to as 12 bit codes, starting over at the start when it is full.
+/// @param bufferSize is the number of conversions that fit in `buffer`. Even, and at most 65534.
+void startContinuousAcquisition(uint16_t pin, uint8_t sampleTime, uint32_t sampleRate, uint16_t *buffer, unsigned int bufferSize);
+
+/// @brief Returns the number of conversions written to the buffer since the start.
+/// The passes through the buffer are counted by the half and full transfer interrupts of the DMA, so it does not have to
+/// be called at any particular rate. When the interrupt is held off for half a pass or more, the count can fall behind,
+/// which `hasContinuousAcquisitionOverrun()` reports.
+uint32_t getContinuousAcquisitionCount();
+
+/// @brief Returns whether conversions may have been lost or miscounted since the start, so the buffer can no longer be
+/// trusted: the DMA interrupt was held off for half a pass or more, or the ADC or the DMA overran.
+bool hasContinuousAcquisitionOverrun();
+
+/// @brief Stops continuous acquisition and restores the registers, so `analogRead()` works again.
+void stopContinuousAcquisition();
+
+#ifndef PLATFORM_ID
+// Signal seen by the simulated ADCs, as a function of the time since the start of the window. (s -> V)
+extern float (*simulatedSignal)(double time);
+// Gain of the second simulated ADC relative to the first. Real ADCs differ slightly, which shows up as a spur at
+// half the sample rate minus the signal frequency.
+extern float simulatedGainMismatch;
+// Offset of the second simulated ADC relative to the first, which shows up at half the sample rate. (V)
+extern float simulatedOffsetMismatch;
+// Standard deviation of the noise of the simulated ADCs. (V)
+extern float simulatedNoise;
+// Number of conversions the simulated continuous acquisition makes between calls of `getContinuousAcquisitionCount()`.
+extern unsigned int simulatedConversionsPerPoll;
+// Number of conversions made without a poll, like during a long flash operation, at the first poll after
+// `simulatedStallStart` conversions. Only once, it goes back to 0 afterwards.
+extern unsigned int simulatedStallConversions;
+extern uint32_t simulatedStallStart;
+// Whether the DMA interrupt is held off during the stall as well, so it only runs once afterwards.
+extern bool simulatedStallMasksInterrupts;
+#endif
+
+#endif
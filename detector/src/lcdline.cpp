@@ -0,0 +1,82 @@
+#include <math.h>
+#include "lcdline.h"
+
+void setLine(LcdLine *line, const char *text)
+{
+    line->length = 0;
+    line->text[0] = 0;
+    appendText(line, text);
+}
+
+void appendText(LcdLine *line, const char *text)
+{
+    while (*text)
+    {
+        appendChar(line, *text++);
+    }
+}
+
+void appendChar(LcdLine *line, char c)
+{
+    if (line->length < LCD_COLUMNS)
+    {
+        line->text[line->length++] = c;
+        line->text[line->length] = 0;
+    }
+}
+
+/// @brief Appends the digits of `value`, padded with zeros to at least `minDigits` digits.
+void appendDigits(LcdLine *line, uint32_t value, int minDigits)
+{
+    // Digits come out least significant first, so collect them before appending.
+    char digits[10];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    while (count < minDigits)
+    {
+        digits[count++] = '0';
+    }
+    while (count > 0)
+    {
+        appendChar(line, digits[--count]);
+    }
+}
+
+void appendInt(LcdLine *line, int32_t value)
+{
+    if (value < 0)
+    {
+        appendChar(line, '-');
+    }
+    // Take the magnitude unsigned, so the most negative value does not overflow.
+    appendDigits(line, value < 0 ? 0 - (uint32_t)value : (uint32_t)value, 1);
+}
+
+void appendFixed(LcdLine *line, float value, int decimals)
+{
+    uint32_t scale = 1;
+    for (int i = 0; i < decimals; i++)
+    {
+        scale *= 10;
+    }
+
+    // Round once on the scaled value, so the carry into the integer part is handled.
+    int32_t scaled = lroundf(value * scale);
+    if (scaled < 0)
+    {
+        appendChar(line, '-');
+    }
+    uint32_t magnitude = scaled < 0 ? 0 - (uint32_t)scaled : (uint32_t)scaled;
+
+    appendDigits(line, magnitude / scale, 1);
+    if (decimals > 0)
+    {
+        appendChar(line, '.');
+        appendDigits(line, magnitude % scale, decimals);
+    }
+}
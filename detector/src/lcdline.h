@@ -0,0 +1,49 @@
+#ifndef _LCDLINE_H_
+#define _LCDLINE_H_
+
+#include <stdint.h>
+
+// Size of the LCD.
+#define LCD_COLUMNS 16
+#define LCD_ROWS 2
+
+// Character code that shows the ``≈`` character registered at CGRAM address 0.
+// The LCD mirrors addresses 0-7 at 8-15, so unlike 0 it can be part of a null terminated line.
+#define LCD_APPROXIMATELY_CHAR '\x08'
+
+// Text of one line of the LCD. It is both printed to the LCD and uploaded, so there is no separate copy for either.
+// Text that does not fit on the LCD is cut off. `text` is always null terminated.
+struct LcdLine
+{
+    char text[LCD_COLUMNS + 1];
+    uint8_t length;
+};
+
+/// @brief Replaces the text of a line.
+/// @param line is the line to change.
+/// @param text is the new text.
+void setLine(LcdLine *line, const char *text);
+
+/// @brief Appends text to a line.
+/// @param line is the line to append to.
+/// @param text is the text to append.
+void appendText(LcdLine *line, const char *text);
+
+/// @brief Appends a single character to a line.
+/// @param line is the line to append to.
+/// @param c is the character to append.
+void appendChar(LcdLine *line, char c);
+
+/// @brief Appends an integer in decimal notation to a line.
+/// @param line is the line to append to.
+/// @param value is the integer to append.
+void appendInt(LcdLine *line, int32_t value);
+
+/// @brief Appends a number with a fixed number of decimals to a line, like ``%.<decimals>f`` would.
+/// Uses integer arithmetic only, so nothing is allocated.
+/// @param line is the line to append to.
+/// @param value is the number to append.
+/// @param decimals is the number of decimals. At most 6.
+void appendFixed(LcdLine *line, float value, int decimals);
+
+#endif
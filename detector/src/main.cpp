@@ -3,19 +3,26 @@
 // #####################
 //
 // These define if certain functions are disabled or enabled.
-
-// Enables serial logging of HTTP requests made to the API server.
-//#define LOG_HTTP_REQUEST
-// Disables the LCD.
-//#define NO_LCD
-// Locks the operating mode to 'position mode'.
-//#define PERMA_MODE_POSITION
-// Locks the operating mode to 'depth mode'.
-//#define PERMA_MODE_DEPTH
-// Disables checking if switches are enabled.
-//#define DONT_CHECK_SWITCHES
-// Disables the discharge cycle before every measurement.
-//#define NO_DISCHARGE_CYCLE
+// How a step of the measurement loop is done (the LCD, mode switch, sensor switches, discharge cycle, acquisition,
+// upload format and request logging) is selected by `Features` below instead. The flags here add whole subsystems with
+// state, connections or pin assignments of their own, or only serve debugging.
+
+// Replaces the window-by-window feedback in position mode with a continuously updated sliding amplitude estimate.
+//#define FAST_POSITION_MODE
+// Streams every measurement to the server in small frames over a persistent connection, for a live oscilloscope view.
+// Only has effect when `FAST_POSITION_MODE` is defined.
+//#define LIVE_STREAM
+// Periodically uploads the timing statistics of every stage of the measurement loop.
+//#define UPLOAD_PROFILING
+// Waits up to 5 s for a serial monitor before starting, so no boot messages are missed. Delays the first measurement.
+//#define WAIT_FOR_SERIAL
+// Timestamps every upload with when its window was captured and when it was sent, in server time. The clock is synced
+// with the server on connect and every `CLOCK_SYNC_INTERVAL` ms after. See clocksync.h.
+//#define LATENCY_TRACING
+// Records gap-free bursts of up to `BURST_MAX_DURATION` s at `BURST_SAMPLE_RATE` into an external SPI flash when the
+// server asks for one, and uploads them in chunks between measurements afterwards. Needs a W25Q flash on the SPI pins,
+// which moves `DISCHARGE_PIN` to A7. See burst.h.
+//#define BURST_CAPTURE
 
 // #######################
 // # Necessary libraries #
@@ -30,6 +37,34 @@
 
 #include "main.h"
 #include "calibration.h"
+#include "profiling.h"
+#include "filter.h"
+#include "peaks.h"
+#include "policies.h"
+#include "lcdline.h"
+#include "codec.h"
+#include "spectrum.h"
+#include "interleaved.h"
+#include "clocksync.h"
+#include "burst.h"
+
+// ############
+// # Features #
+// ############
+//
+// Selects the policy for every feature. See policies.h.
+//     - Display: `LcdDisplay`, or `NullDisplay` to disable the LCD.
+//     - Mode: `SwitchedMode`, or `FixedMode<Mode::POSITION>`/`FixedMode<Mode::DEPTH>`/`FixedMode<Mode::SPECTRUM>` to lock the operating mode.
+//       The mode switch only selects position or depth mode, so spectrum mode is only reachable with `FixedMode<Mode::SPECTRUM>`.
+//     - Sensors: `SwitchedSensors`, or `FixedSensors<0b...>` to disable checking which switches are enabled.
+//     - Discharge: `PulldownDischarge`, `AdaptiveDischarge<false>` to end the discharge cycle as soon as the voltage has
+//       settled, `AdaptiveDischarge<true>` to also skip it after unsaturated measurements, or `NoDischarge` to disable it.
+//     - Acquisition: `SingleAcquisition`, `OversampledAcquisition` to average several conversions per measurement,
+//       `InterleavedAcquisition` to sample the window with two ADCs taking turns, or `TriggeredAcquisition` to align
+//       windows on a trigger.
+//     - Upload: `TextUpload`, or `CompressedUpload` to upload the window losslessly compressed.
+//     - Request log: `NullRequestLog`, or `SerialRequestLog` to enable serial logging of HTTP requests made to the API server.
+typedef DetectorFeatures<LcdDisplay, SwitchedMode, SwitchedSensors, PulldownDischarge, SingleAcquisition, TextUpload, NullRequestLog> Features;
 
 // ################
 // # System modes #
@@ -47,21 +82,80 @@ Mode currentMode = Mode::POSITION;
 // LCD class for interfacing with the LCD.
 LiquidCrystal_I2C *lcd;
 // First line displayed on the LCD.
-String lcdFirstLine = "";
-// Second line displayed on the LCD>
-String lcdSecondLine = "";
+LcdLine lcdFirstLine = {"", 0};
+// Second line displayed on the LCD.
+LcdLine lcdSecondLine = {"", 0};
 
 // TCPClient for interfacing with the internet.
 TCPClient client;
 
+// Window of measurements of the mode routines. Spectrum mode transforms it in place, see `SpectrumBuffer`.
+// Global, so its 4 KB neither takes up most of the 6 KB stack nor fragments the heap by being allocated every window.
+SpectrumBuffer windowBuffer;
+
+// Persistent connection for the live stream, see `LIVE_STREAM`.
+TCPClient liveClient;
+// Frame of the live stream that is being filled.
+LiveFrame liveFrame = {LIVE_FRAME_MAGIC, 0, 0, 0, 0, {0}};
+// Time of the last attempt to open the live stream connection.
+unsigned long lastLiveConnectTime = 0;
+// Time to wait after `lastLiveConnectTime` before trying again. Doubles with every failed attempt. (ms)
+unsigned long liveReconnectInterval = 0;
+
+// Time of the last upload of the timing statistics.
+unsigned long lastProfilingUploadTime = 0;
+
+// Whether the last measurement reached `DISCHARGE_SATURATION_VOLTAGE`.
+// Starts as true so the very first measurement is always preceded by a discharge.
+bool lastMeasurementSaturated = true;
+
+// Time every phase of the startup finished. See `BootTimings`.
+BootTimings bootTimings = {0, 0, 0, 0, 0, 0};
+// Whether WiFi connected since boot, see `isNetworkReady()`.
+bool networkSessionEstablished = false;
+bool bootTimingsUploaded = false;
+// Time of the last calibration check while the server has not responded since boot. (ms)
+unsigned long lastServerCheckTime = 0;
+
+// Whether the mode routines start with their instructions on the LCD.
+// Not after boot, so the first reading is available right away. Set once the mode switch has been changed.
+bool showModeInstructions = false;
+
+// Whether the last measurement was aligned on a trigger. Always true unless `Features::Acquisition` is `TriggeredAcquisition`.
+bool lastMeasurementTriggered = true;
+
+// Time the window of the last measurement started and finished being captured, see `millis()`. (ms)
+unsigned long lastCaptureStart = 0;
+unsigned long lastCaptureEnd = 0;
+
+// Mapping of `millis()` to server time when `LATENCY_TRACING` is defined, see `syncClock()`.
+ClockSync clockSync = {false, 0, 0, 0};
+// Time of the last clock sync round.
+unsigned long lastClockSyncTime = 0;
+
+// Number of blocks of the burst log when `BURST_CAPTURE` is defined, 0 without a flash.
+uint32_t burstLogBlocks = 0;
+// Recording that is uploaded by `serviceBurstCapture()`, while `burstUploadPending`.
+BurstRecording burstUpload;
+bool burstUploadPending = false;
+// Number of bytes of `burstUpload` the server has, or `BURST_ERASED` when it has to be asked first.
+uint32_t burstUploadOffset = BURST_ERASED;
+// Time of the last burst request or failed upload of a chunk.
+unsigned long lastBurstPollTime = 0;
+
 // ############################
 // # Function implementations #
 // ############################
 
 void setup()
 {
+    // Prepare stack usage measurement before anything else uses the stack.
+    paintStack();
+    bootTimings.setup = millis();
+
     // Prepare pins for the correct output type.
     pinMode(MEASUREMENT_PIN, AN_INPUT);
+    Features::Acquisition::begin();
     pinMode(SWITCH_HIGH_PIN, OUTPUT);
     pinMode(SWITCH_1_PIN, INPUT_PULLDOWN);
     pinMode(SWITCH_2_PIN, INPUT_PULLDOWN);
@@ -76,50 +170,65 @@ void setup()
 
     // Prepare Serial communication.
     Serial.begin(9600);
+#ifdef WAIT_FOR_SERIAL
     waitFor(Serial.isConnected, 5000);
-    Serial.println("### Draad Detectinator 2000 ###");
-
-    // Prepare LCD.
-#ifndef NO_LCD
-    Serial.println("[LCD] Initializing LCD...");
-    lcd = new LiquidCrystal_I2C(LCD_ADDRESS, 16, 2);
-    lcd->init();
-    lcd->backlight();
-
-    // Register the ``≈`` character at address 0.
-    byte approximatelyChar[] = {
-        0B00000,
-        0B01000,
-        0B10101,
-        0B00010,
-        0B01000,
-        0B10101,
-        0B00010,
-        0B00000};
-    lcd->createChar(0, approximatelyChar);
-
-    lcdFirstLine = "Welcome!";
-    lcdSecondLine = "";
-    lcd_clear_printLines();
-    Serial.println("[LCD] Success!");
-#else
-    Serial.println("[LCD] LCD has been disabled.");
 #endif
+    Serial.println("### Draad Detectinator 2000 ###");
+    if (Features::Acquisition::oversampling > 1)
+    {
+        Serial.println(String::format("[ADC] Oversampling %dx.", Features::Acquisition::oversampling));
+    }
 
-    // Connect to WiFi.
-    lcdFirstLine = "Welcome!";
-    lcdSecondLine = "WiFi connecting";
-    lcd_clear_printLines();
+    // Start connecting right away. The system thread connects in the background while measuring starts.
     Serial.println("[WiFi] Connecting to WiFi...");
     Serial.println("[WiFi] SSID: " + wifi_SSID);
     Serial.println("[WiFi] Password: " + wifi_password);
     WiFi.on();
     WiFi.setCredentials(wifi_SSID, wifi_password, wifi_security);
     WiFi.connect();
-    waitUntil(WiFi.ready);
-    Serial.println("[WiFi] Success!");
 
-    // Finalize setup.
+    // Load calibration.
+    Serial.println("[Calibration] Loading calibration from EEPROM...");
+    if (loadCalibrationFromEEPROM())
+    {
+        Serial.println(String::format("[Calibration] Success! Checksum: %08lx", activeCalibrationChecksum));
+    }
+    else
+    {
+        // Tabulate the compiled-in calibration fits that use a lookup table.
+        buildCalibrationTables();
+        Serial.println("[Calibration] No valid calibration stored, using built-in calibration.");
+    }
+    recordBootPhase(&bootTimings.calibration);
+
+    // Prepare LCD.
+    if (Features::Display::enabled)
+    {
+        Serial.println("[LCD] Initializing LCD...");
+        Features::Display::begin();
+        Serial.println("[LCD] Success!");
+    }
+    else
+    {
+        Serial.println("[LCD] LCD has been disabled.");
+    }
+    recordBootPhase(&bootTimings.lcd);
+
+#ifdef BURST_CAPTURE
+    // A recording that was not uploaded before the reset is picked up where it was left, see `uploadBurstChunk()`.
+    burstLogBlocks = beginBurstLog();
+    if (burstLogBlocks == 0)
+    {
+        Serial.println("[Burst] No flash found, burst capture disabled.");
+    }
+    else if (findNewestRecording(&burstUpload))
+    {
+        burstUploadPending = true;
+        Serial.println(String::format("[Burst] Newest recording: %lu, %lu samples.", burstUpload.recordingId, burstUpload.sampleCount));
+    }
+#endif
+
+    // Finalize setup. Uploads start by themselves once WiFi is ready, see `isNetworkReady()`.
     lcd_clear();
     Serial.println("### Setup complete ###");
 
@@ -136,44 +245,60 @@ void loop()
     case Mode::DEPTH:
         depthModeRoutine(&currentMode);
         break;
+    case Mode::SPECTRUM:
+        spectrumModeRoutine(&currentMode);
+        break;
     default:
         currentMode = Mode::POSITION;
         break;
     }
+
+    // A routine only returns when the mode switch changed, so from now on the user is looking for instructions.
+    showModeInstructions = true;
 }
 
 void positionModeRoutine(Mode *currentMode)
 {
-    lcdFirstLine = "Change mode:";
-    lcdSecondLine = "Position";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+    // Right after boot the first reading comes first, see `showModeInstructions`.
+    if (showModeInstructions)
+    {
+        setLine(&lcdFirstLine, "Change mode:");
+        setLine(&lcdSecondLine, "Position");
+        lcd_clear_printLines();
+        uploadLCDData();
 
-    lcdFirstLine = "Move right until";
-    lcdSecondLine = "cable found.";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        // Changing modes is a natural pause, so use it to pick up a new calibration.
+        checkForCalibrationUpdate();
+        delay(2000);
 
-    lcdFirstLine = "If device is too";
-    lcdSecondLine = "sensitive...";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        setLine(&lcdFirstLine, "Move right until");
+        setLine(&lcdSecondLine, "cable found.");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
 
-    lcdFirstLine = "Or not sensitive";
-    lcdSecondLine = "enough...";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        setLine(&lcdFirstLine, "If device is too");
+        setLine(&lcdSecondLine, "sensitive...");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
 
-    lcdFirstLine = "consider chan-";
-    lcdSecondLine = "ging switches.";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        setLine(&lcdFirstLine, "Or not sensitive");
+        setLine(&lcdSecondLine, "enough...");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
+
+        setLine(&lcdFirstLine, "consider chan-");
+        setLine(&lcdSecondLine, "ging switches.");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
+    }
 
+#ifdef FAST_POSITION_MODE
+    fastPositionModeLoop(currentMode);
+#else
     Mode selectedMode = getModeSwitchState();
     uint8_t activatedSwitches = determineActivatedSwitches();
 
@@ -181,35 +306,38 @@ void positionModeRoutine(Mode *currentMode)
 
     while (selectedMode == *currentMode)
     {
-        float *voltageArray = new float[1000];
+        float *voltageArray = windowBuffer.voltages;
         float loopTime = 0;
         float Vmax = 0;
         float Vmin = 0;
         float Vptp = 0;
         float peakWidth = 0;
-        doMeasurement(voltageArray, &loopTime, &Vmax, &Vmin, &Vptp, &peakWidth);
+        unsigned long dischargeTime = 0;
+        doMeasurement(voltageArray, &loopTime, &Vmax, &Vmin, &Vptp, &peakWidth, &dischargeTime);
 
         if (bestResultSoFar == 0)
         {
-            lcdFirstLine = "Scanning: Cold";
+            setLine(&lcdFirstLine, "Scanning: Cold");
         }
 
         if (Vptp > bestResultSoFar)
         {
             bestResultSoFar = Vptp;
-            lcdFirstLine = "Scanning: Warmer";
+            setLine(&lcdFirstLine, "Scanning: Warmer");
         }
         else if (Vptp < bestResultSoFar)
         {
-            lcdFirstLine = "Scanning: Colder";
+            setLine(&lcdFirstLine, "Scanning: Colder");
         }
 
-        lcdSecondLine = String::format("Vptp = %.2f V", Vptp);
+        setLine(&lcdSecondLine, "Vptp = ");
+        appendFixed(&lcdSecondLine, Vptp, 2);
+        appendText(&lcdSecondLine, " V");
         lcd_clear_printLines();
 
-        uploadData((int)*currentMode, voltageArray, loopTime, Vmax, Vptp, peakWidth, activatedSwitches);
+        uploadData((int)*currentMode, voltageArray, loopTime, Vmax, Vptp, peakWidth, activatedSwitches, dischargeTime, -1);
 
-        delete[] voltageArray;
+        serviceBurstCapture();
 
         selectedMode = getModeSwitchState();
         activatedSwitches = determineActivatedSwitches();
@@ -217,51 +345,175 @@ void positionModeRoutine(Mode *currentMode)
         delay(400);
     }
 
+    *currentMode = selectedMode;
+#endif
+}
+
+void fastPositionModeLoop(Mode *currentMode)
+{
+    // Circular buffer holding the most recent measurements.
+    float sampleBuffer[POSITION_BUFFER_SIZE];
+    size_t sampleIndex = 0;
+    bool bufferFilled = false;
+
+    float lastAmplitude = 0;
+    bool amplitudeAvailable = false;
+    // Exponentially weighted slope of the amplitude. (V/s)
+    float amplitudeSlope = 0;
+
+    unsigned long lastUpdateTime = millis();
+    unsigned long lastDisplayTime = lastUpdateTime;
+    unsigned long lastUploadTime = lastUpdateTime;
+
+    Mode selectedMode = getModeSwitchState();
+
+    runDischargeCycle();
+#ifdef LIVE_STREAM
+    connectLiveStream();
+#endif
+
+    while (selectedMode == *currentMode)
+    {
+        sampleBuffer[sampleIndex] = readMeasurementVoltage();
+#ifdef LIVE_STREAM
+        streamLiveMeasurement(sampleBuffer[sampleIndex]);
+#endif
+        sampleIndex++;
+        if (sampleIndex == POSITION_BUFFER_SIZE)
+        {
+            sampleIndex = 0;
+            bufferFilled = true;
+        }
+
+        unsigned long currentTime = millis();
+
+        // Update the sliding amplitude estimate and its trend.
+        if (bufferFilled && currentTime - lastUpdateTime >= POSITION_UPDATE_INTERVAL)
+        {
+            float maxMeasurement = 0;
+            float minMeasurement = 3.5;
+            for (size_t i = 0; i < POSITION_BUFFER_SIZE; i++)
+            {
+                maxMeasurement = std::max(maxMeasurement, sampleBuffer[i]);
+                minMeasurement = std::min(minMeasurement, sampleBuffer[i]);
+            }
+            float amplitude = maxMeasurement - minMeasurement;
+
+            if (amplitudeAvailable)
+            {
+                float instantSlope = (amplitude - lastAmplitude) * 1000.0 / (float)(currentTime - lastUpdateTime);
+                amplitudeSlope = POSITION_SLOPE_SMOOTHING * instantSlope + (1 - POSITION_SLOPE_SMOOTHING) * amplitudeSlope;
+            }
+
+            lastAmplitude = amplitude;
+            amplitudeAvailable = true;
+            lastUpdateTime = currentTime;
+            recordBootPhase(&bootTimings.firstMeasurement);
+        }
+
+        // Refresh the LCD.
+        if (amplitudeAvailable && currentTime - lastDisplayTime >= POSITION_DISPLAY_INTERVAL)
+        {
+            if (amplitudeSlope > POSITION_SLOPE_THRESHOLD)
+            {
+                setLine(&lcdFirstLine, "Scanning: Warmer");
+            }
+            else if (amplitudeSlope < -POSITION_SLOPE_THRESHOLD)
+            {
+                setLine(&lcdFirstLine, "Scanning: Colder");
+            }
+            else
+            {
+                setLine(&lcdFirstLine, "Scanning: Steady");
+            }
+
+            setLine(&lcdSecondLine, "Vptp = ");
+            appendFixed(&lcdSecondLine, lastAmplitude, 2);
+            appendText(&lcdSecondLine, " V");
+            lcd_clear_printLines();
+            lastDisplayTime = currentTime;
+
+            selectedMode = getModeSwitchState();
+
+            if (currentTime - lastUploadTime >= POSITION_UPLOAD_INTERVAL)
+            {
+                uploadLCDData();
+                serviceBurstCapture();
+#ifdef LIVE_STREAM
+                connectLiveStream();
+#endif
+                lastUploadTime = millis();
+
+                // Uploading blocks sampling, so start over with a fresh buffer to prevent a jump in the slope.
+                sampleIndex = 0;
+                bufferFilled = false;
+                amplitudeAvailable = false;
+            }
+        }
+    }
+
     *currentMode = selectedMode;
 }
 
 void depthModeRoutine(Mode *currentMode)
 {
-    lcdFirstLine = "Change mode:";
-    lcdSecondLine = "Depth";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+    // Right after boot the first reading comes first, see `showModeInstructions`.
+    if (showModeInstructions)
+    {
+        setLine(&lcdFirstLine, "Change mode:");
+        setLine(&lcdSecondLine, "Depth");
+        lcd_clear_printLines();
+        uploadLCDData();
 
-    lcdFirstLine = "Assuming pos.";
-    lcdSecondLine = "already found";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        checkForCalibrationUpdate();
+        delay(2000);
 
-    lcdFirstLine = "Play with acti-";
-    lcdSecondLine = "vated sensors...";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        setLine(&lcdFirstLine, "Assuming pos.");
+        setLine(&lcdSecondLine, "already found");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
 
-    lcdFirstLine = "until proper";
-    lcdSecondLine = "range found.";
-    lcd_clear_printLines();
-    uploadLCDData();
-    delay(2000);
+        setLine(&lcdFirstLine, "Set the sensors");
+        setLine(&lcdSecondLine, "when advised...");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
+
+        setLine(&lcdFirstLine, "until proper");
+        setLine(&lcdSecondLine, "range found.");
+        lcd_clear_printLines();
+        uploadLCDData();
+        delay(2000);
+    }
 
     Mode selectedMode = getModeSwitchState();
     uint8_t activatedSwitches = determineActivatedSwitches();
 
+    // Combines the Vptp of consecutive windows. Reset whenever the sensor switches change.
+    MedianFilter VptpFilter;
+    resetMedianFilter(&VptpFilter);
+
     while (selectedMode == *currentMode)
     {
-        float voltageArray[1000];
+        float *voltageArray = windowBuffer.voltages;
         float loopTime = 0;
         float Vmax = 0;
         float Vmin = 0;
         float Vptp = 0;
         float peakWidth = 0;
-        doMeasurement(voltageArray, &loopTime, &Vmax, &Vmin, &Vptp, &peakWidth);
+        unsigned long dischargeTime = 0;
+        doMeasurement(voltageArray, &loopTime, &Vmax, &Vmin, &Vptp, &peakWidth, &dischargeTime);
+
+        // The median of the last windows rejects outliers and steadies the displayed depth.
+        addToMedianFilter(&VptpFilter, Vptp);
+        float filteredVptp = getMedian(&VptpFilter);
 
         // Check if switch configuration is valid.
         bool invalidSwitchConfiguration = !checkForValidCalibrationSwitchConfiguration(activatedSwitches);
 
+        uint32_t calibrationStartTicks = getProfilingTicks();
+
         int switchIndex = getIndexByConfiguration(activatedSwitches);
 
         float domainMax = confDomainMax[switchIndex];
@@ -269,42 +521,140 @@ void depthModeRoutine(Mode *currentMode)
         int rangeMax = round(getDepthByFit(activatedSwitches, domainMin));
         int rangeMin = round(getDepthByFit(activatedSwitches, domainMax));        
 
-        bool domainTooHigh = Vptp >= domainMax;
-        bool domainTooLow = Vptp <= domainMin;
+        bool domainTooHigh = filteredVptp >= domainMax;
+        bool domainTooLow = filteredVptp <= domainMin;
 
-        int depthBestGuess = getDepthByFit(activatedSwitches, Vptp);
+        int depthBestGuess = getDepthByFit(activatedSwitches, filteredVptp);
 
-        lcd_clear();
+        // The estimate is stable once the spread of the windows corresponds to at most `DEPTH_STABLE_TOLERANCE`.
+        float VptpDeviation = getMedianAbsoluteDeviation(&VptpFilter);
+        float depthUncertainty = fabs(getDepthByFit(activatedSwitches, filteredVptp - VptpDeviation) -
+                                      getDepthByFit(activatedSwitches, filteredVptp + VptpDeviation)) / 2;
+        bool depthStable = VptpFilter.count >= DEPTH_FILTER_MIN_WINDOWS && depthUncertainty <= DEPTH_STABLE_TOLERANCE;
+
+        // Determine which calibrated sensor configuration fits the measured depth best.
+        uint8_t recommendedSwitches = recommendSwitchConfiguration(activatedSwitches, filteredVptp);
+
+        recordStage(Stage::CALIBRATION, calibrationStartTicks);
 
-        bool printFirstLCDLine = true;
         if (invalidSwitchConfiguration)
         {
-            lcdFirstLine = "Invalid switches";
+            setLine(&lcdFirstLine, "Invalid switches");
         }
         else if (domainTooHigh)
         {
-            lcdFirstLine = String::format("Depth <= %d cm", rangeMin);
+            setLine(&lcdFirstLine, "Depth <= ");
+            appendInt(&lcdFirstLine, rangeMin);
+            appendText(&lcdFirstLine, " cm");
         }
         else if (domainTooLow)
         {
-            lcdFirstLine = String::format("Depth >= %d cm", rangeMax);
+            setLine(&lcdFirstLine, "Depth >= ");
+            appendInt(&lcdFirstLine, rangeMax);
+            appendText(&lcdFirstLine, " cm");
+        }
+        else
+        {
+            // Shows ``Depth ≈ %d cm``.
+            setLine(&lcdFirstLine, "Depth ");
+            appendChar(&lcdFirstLine, LCD_APPROXIMATELY_CHAR);
+            appendChar(&lcdFirstLine, ' ');
+            appendInt(&lcdFirstLine, depthBestGuess);
+            appendText(&lcdFirstLine, " cm");
+        }
+
+        if (!invalidSwitchConfiguration && recommendedSwitches != activatedSwitches)
+        {
+            setLine(&lcdSecondLine, "Try sens. ");
+            for (int position = 1; position <= 5; position++)
+            {
+                if (isSwitchActivated(recommendedSwitches, position))
+                {
+                    appendChar(&lcdSecondLine, '0' + position);
+                }
+            }
+        }
+        else if (depthStable && !invalidSwitchConfiguration && !domainTooHigh && !domainTooLow)
+        {
+            setLine(&lcdSecondLine, "Vptp=");
+            appendFixed(&lcdSecondLine, filteredVptp, 2);
+            appendText(&lcdSecondLine, " stable");
         }
         else
         {
-            lcdFirstLine = String::format("Depth \\approx %d cm", depthBestGuess);
-            printFirstLCDLine = false;
+            setLine(&lcdSecondLine, "Vptp = ");
+            appendFixed(&lcdSecondLine, filteredVptp, 2);
+            appendText(&lcdSecondLine, " V");
+        }
+        lcd_clear_printLines();
+
+        // Only upload a depth when it lies within the calibrated range.
+        float depth = (invalidSwitchConfiguration || domainTooHigh || domainTooLow) ? -1 : getDepthByFit(activatedSwitches, filteredVptp);
+        uploadData((int)*currentMode, voltageArray, loopTime, Vmax, Vptp, peakWidth, activatedSwitches, dischargeTime, depth);
+
+        serviceBurstCapture();
+
+        selectedMode = getModeSwitchState();
 
-            // Prints ``Depth ≈ %d cm`` to the LCD.
-            lcd_setCursor(0, 0);
-            lcd_print("Depth ");
-            lcd_write(byte(0));
-            lcd_print(String::format(" %d cm", depthBestGuess));
+        uint8_t previousSwitches = activatedSwitches;
+        activatedSwitches = determineActivatedSwitches();
+        if (activatedSwitches != previousSwitches)
+        {
+            // Windows measured with other sensors can not be compared.
+            resetMedianFilter(&VptpFilter);
         }
 
-        lcdSecondLine = String::format("Vptp = %.2f V", Vptp);
-        lcd_clear_printLines(printFirstLCDLine, true, false);
+        delay(400);
+    }
+
+    *currentMode = selectedMode;
+}
+
+void spectrumModeRoutine(Mode *currentMode)
+{
+    // Right after boot the first reading comes first, see `showModeInstructions`.
+    if (showModeInstructions)
+    {
+        setLine(&lcdFirstLine, "Change mode:");
+        setLine(&lcdSecondLine, "Spectrum");
+        lcd_clear_printLines();
+        uploadLCDData();
+
+        // Changing modes is a natural pause, so use it to pick up a new calibration.
+        checkForCalibrationUpdate();
+        delay(2000);
+    }
+
+    Mode selectedMode = getModeSwitchState();
+    uint8_t activatedSwitches = determineActivatedSwitches();
+
+    while (selectedMode == *currentMode)
+    {
+        // The spectrum is computed in place, in the memory of the window.
+        SpectrumBuffer *buffer = &windowBuffer;
+        float loopTime = 0;
+        float Vmax = 0;
+        float Vmin = 0;
+        float Vptp = 0;
+        float peakWidth = 0;
+        unsigned long dischargeTime = 0;
+        doMeasurement(buffer->voltages, &loopTime, &Vmax, &Vmin, &Vptp, &peakWidth, &dischargeTime);
+
+        uint16_t spectrum[SPECTRUM_BINS];
+        SpectrumPeak peak;
+        computeSpectrum(buffer, 1000, spectrum, &peak);
+
+        setLine(&lcdFirstLine, "f = ");
+        appendFixed(&lcdFirstLine, getBinFrequency(peak.bin, loopTime), 0);
+        appendText(&lcdFirstLine, " Hz");
+        setLine(&lcdSecondLine, "A = ");
+        appendFixed(&lcdSecondLine, peak.magnitude * getSpectrumScale(1000), 2);
+        appendText(&lcdSecondLine, " V");
+        lcd_clear_printLines();
+
+        uploadSpectrum(spectrum, peak, loopTime, Vptp, activatedSwitches);
 
-        uploadData((int)*currentMode, voltageArray, loopTime, Vmax, Vptp, peakWidth, activatedSwitches);
+        serviceBurstCapture();
 
         selectedMode = getModeSwitchState();
         activatedSwitches = determineActivatedSwitches();
@@ -315,33 +665,82 @@ void depthModeRoutine(Mode *currentMode)
     *currentMode = selectedMode;
 }
 
-void doMeasurement(float *voltageArray, float *loopTime, float *Vmax, float *Vmin, float *Vptp, float *peakWidth)
+void doMeasurement(float *voltageArray, float *loopTime, float *Vmax, float *Vmin, float *Vptp, float *peakWidth, unsigned long *dischargeTime)
 {
     unsigned int numMeasurements = 1000;
 
     float minMeasurement = 3.5;
     float maxMeasurement = 0;
 
-    unsigned long startPeak = 0;
-    float peakBase = 0;
-    float peakSummit = 0;
-    bool peakPassed = false;
-    unsigned long stopPeak = 0;
+    PeakDetector peakDetector;
+    resetPeakDetector(&peakDetector);
 
-    unsigned long totalPeakTime = 0;
-    float totalVptp = 0;
-    int countedPeaks = 0;
+    uint32_t stageStartTicks = getProfilingTicks();
+    *dischargeTime = runDischargeCycle();
+    recordStage(Stage::DISCHARGE, stageStartTicks);
+
+    // The window is timed from here, so `loopTime` does not include the discharge cycle. It is in `dischargeTime` instead.
+    // Acquisition and peak detection are interleaved, so the time spent in `analogRead()` is summed separately. Only with
+    // `UPLOAD_PROFILING`, as reading the cycle counter around every measurement would slow down the window it times.
+    uint32_t acquisitionTicks = 0;
+    uint32_t measurementStartTicks = getProfilingTicks();
 
     unsigned long startTime = millis();
     unsigned long currentTime = millis();
+    lastCaptureStart = startTime;
 
-    runDischargeCycle();
+    // Time it took to do one measurement of a window that was captured before it is analysed.
+    float capturedLoopTime = 0;
+    if (Features::Acquisition::triggered)
+    {
+        // Capture the whole window first, then analyse it as if it was being measured.
+        lastMeasurementTriggered = captureTriggeredWindow(voltageArray, numMeasurements, &capturedLoopTime);
+        acquisitionTicks = getProfilingTicks() - measurementStartTicks;
+    }
+    else if (Features::Acquisition::interleaved)
+    {
+        // Capture the whole window first, then analyse it as if it was being measured.
+        if (!captureInterleavedWindow(MEASUREMENT_PIN, INTERLEAVED_SAMPLE_TIME, INTERLEAVED_SAMPLE_RATE, voltageArray, numMeasurements, &capturedLoopTime))
+        {
+            // Fall back to single conversions, so there still is a window to analyse.
+            unsigned long startMicros = micros();
+            for (size_t i = 0; i < numMeasurements; i++)
+            {
+                voltageArray[i] = readMeasurementVoltage();
+            }
+            capturedLoopTime = (float)(micros() - startMicros) / 1000.0 / (float)numMeasurements;
+        }
+        acquisitionTicks = getProfilingTicks() - measurementStartTicks;
+    }
+    if (Features::Acquisition::captureFirst)
+    {
+        lastCaptureEnd = millis();
+    }
 
     // Fill voltageArray with 1000 measurements, which takes approximately 100ms.
     for (size_t i = 0; i < numMeasurements; i++)
     {
-        float currentMeasurement = map((float)analogRead(MEASUREMENT_PIN), 0.0, 4095.0, 0.0, 3.3);
-        voltageArray[i] = round(currentMeasurement * 100) / 100;
+        float currentMeasurement;
+        unsigned long sampleTime;
+        if (Features::Acquisition::captureFirst)
+        {
+            currentMeasurement = voltageArray[i];
+            // Time at which this measurement was taken, relative to the start of the window.
+            sampleTime = startTime + (unsigned long)(i * capturedLoopTime);
+        }
+        else
+        {
+#ifdef UPLOAD_PROFILING
+            uint32_t sampleStartTicks = getProfilingTicks();
+#endif
+            currentMeasurement = readMeasurementVoltage();
+#ifdef UPLOAD_PROFILING
+            acquisitionTicks += getProfilingTicks() - sampleStartTicks;
+#endif
+            sampleTime = millis();
+        }
+        // Oversampled measurements keep their extra resolution.
+        voltageArray[i] = Features::Acquisition::oversampling > 1 ? currentMeasurement : round(currentMeasurement * 100) / 100;
 
         if (currentMeasurement > maxMeasurement)
         {
@@ -368,178 +767,340 @@ void doMeasurement(float *voltageArray, float *loopTime, float *Vmax, float *Vmi
         }
         */
 
-        // ### Peak detection, version 2. Works well enough.
-        // Peak detection doesn't work when can't look back far enough, so skip it.
-        if (i < PEAK_DETECTION_BACKSEARCH)
-        {
-            continue;
-        }
-
-        // Check if there is a rising trend in voltage.
-        if (currentMeasurement > voltageArray[i - PEAK_DETECTION_BACKSEARCH] + PEAK_MEASUREMENT_THRESHOLD)
-        {
-            // If a peak has already been passen but we're measuring an upwards trend,
-            // then something has gone wrong. So we reset.
-            if (peakPassed)
-            {
-                peakPassed = false;
-                startPeak = 0;
-            }
-
-            // If we haven't measured a rising voltage before, anticipate that a peak
-            // is coming and start the timer.
-            if (!startPeak)
-            {
-                startPeak = millis();
-
-                // Set the lower threshold that defines the base of the peak.
-                peakBase = voltageArray[i - PEAK_DETECTION_BACKSEARCH];
-            }
-        }
-
-        // If we're measuring a peak, save the highest value we're finding.
-        if (currentMeasurement > peakSummit && startPeak)
-        {
-            peakSummit = currentMeasurement;
-        }
+        addPeakMeasurement(&peakDetector, voltageArray, i, currentMeasurement, sampleTime);
+    }
 
-        /* Old way of doing it
-        // Check is there is a falling trend in voltage and if we had already anticipated
-        // there to be a peak coming.
-        // if (currentMeasurement < voltageArray[i - PEAK_DETECTION_BACKSEARCH] - PEAK_MEASUREMENT_THRESHOLD && startPeak)
-        */
-        // Check if the current measurement is lower than half the current measured max
-        // peak height.
-        if (currentMeasurement < peakBase + 0.5 * (peakSummit - peakBase))
-        {
-            // We anticipated a peak and measure a falling voltage, so we must have passed
-            // the peak. So set the corresponding variable to true.
-            peakPassed = true;
-        }
+    currentTime = millis();
+    if (!Features::Acquisition::captureFirst)
+    {
+        lastCaptureEnd = currentTime;
+    }
 
-        // If a peak has been passed and the foot of the peak is reached, we stop the timer.
-        if (currentMeasurement < peakBase && peakPassed)
-        {
-            stopPeak = millis();
-        }
+    recordStageTicks(Stage::ACQUISITION, acquisitionTicks);
+    recordStageTicks(Stage::PEAK_DETECTION, getProfilingTicks() - measurementStartTicks - acquisitionTicks);
 
-        // Save the timing result if we have a starting time and a stopping time of a peak.
-        if (startPeak && stopPeak)
-        {
-            totalPeakTime += stopPeak - startPeak;
-            totalVptp += peakSummit - peakBase;
-            countedPeaks++;
+    lastMeasurementSaturated = maxMeasurement >= DISCHARGE_SATURATION_VOLTAGE;
+    recordBootPhase(&bootTimings.firstMeasurement);
 
-            startPeak = 0;
-            stopPeak = 0;
-            peakPassed = false;
-            peakBase = 0;
-            peakSummit = 0;
-        }
+    if (Features::Acquisition::captureFirst)
+    {
+        *loopTime = capturedLoopTime;
+    }
+    else
+    {
+        *loopTime = (float)(currentTime - startTime) / (float)numMeasurements;
     }
-
-    currentTime = millis();
-
-    *loopTime = (float)(currentTime - startTime) / (float)numMeasurements;
     *Vmax = maxMeasurement;
     *Vmin = minMeasurement;
     // Prevent division by zero.
-    if (countedPeaks)
+    if (peakDetector.countedPeaks)
     {
-        *peakWidth = (float)totalPeakTime / (float)countedPeaks;
-        // *Vptp = totalVptp / countedPeaks;
+        *peakWidth = (float)peakDetector.totalPeakTime / (float)peakDetector.countedPeaks;
+        // *Vptp = peakDetector.totalVptp / peakDetector.countedPeaks;
     }
     *Vptp = maxMeasurement - minMeasurement;
 }
 
-void uploadData(int currentMode, float *voltageArray, float loopTime, float Vmax, float Vptp, float peakWidth, uint8_t activatedSwitches)
+bool captureTriggeredWindow(float *voltageArray, unsigned int numMeasurements, float *loopTime)
 {
-    if (client.connect(SERVER_ADDRESS, SERVER_PORT))
+    // `voltageArray` is used as a circular buffer until the window is complete.
+    unsigned int index = 0;
+    unsigned long samplesTaken = 0;
+    unsigned int samplesRemaining = 0;
+    bool armed = false;
+    bool triggered = false;
+
+    unsigned long startTime = millis();
+    unsigned long startMicros = micros();
+
+    while (true)
     {
-        char json[300];
-        JSONBufferWriter jsonWriter(json, sizeof(json));
-        jsonWriter.beginObject();
-        jsonWriter.name("currentMode").value(currentMode);
-        jsonWriter.name("voltageArray").value("{{insert}}");
-        jsonWriter.name("loopTime").value(loopTime, 2);
-        jsonWriter.name("Vmax").value(Vmax, 2);
-        jsonWriter.name("Vptp").value(Vptp, 2);
-        jsonWriter.name("peakWidth").value(round(peakWidth * 100 / 100));
-        jsonWriter.name("activatedSwitches").value(activatedSwitches);
-        jsonWriter.name("lcdFirstLine").value(lcdFirstLine);
-        jsonWriter.name("lcdSecondLine").value(lcdSecondLine);
-        jsonWriter.endObject();
-        jsonWriter.buffer()[std::min(jsonWriter.bufferSize(), jsonWriter.dataSize())] = 0;
+        float currentMeasurement = readMeasurementVoltage();
+        voltageArray[index] = currentMeasurement;
+        index = (index + 1) % numMeasurements;
+        samplesTaken++;
+
+        if (triggered)
+        {
+            samplesRemaining--;
+            if (samplesRemaining == 0)
+            {
+                break;
+            }
+            continue;
+        }
 
-        String arrayString = "[";
+        // Distance to the trigger level in the direction of the trigger slope.
+        float level = TRIGGER_SLOPE * (currentMeasurement - TRIGGER_LEVEL);
 
-        for (size_t i = 0; i < 1000; i++)
+        // Only trigger after the signal was clearly on the other side of the level, so noise can't trigger.
+        if (level < -TRIGGER_HYSTERESIS)
+        {
+            armed = true;
+        }
+        else if (armed && level >= 0 && samplesTaken > TRIGGER_PRE_SAMPLES)
+        {
+            // Take the remaining samples so the trigger ends up at index `TRIGGER_PRE_SAMPLES`.
+            triggered = true;
+            samplesRemaining = numMeasurements - TRIGGER_PRE_SAMPLES - 1;
+            if (samplesRemaining == 0)
+            {
+                break;
+            }
+        }
+        else if (millis() - startTime >= TRIGGER_TIMEOUT && samplesTaken >= numMeasurements)
         {
-            arrayString += String::format("%.2f,", voltageArray[i]);
+            // No trigger, return the last window like an oscilloscope in auto mode.
+            break;
         }
+    }
 
-        arrayString = arrayString.remove(arrayString.length() - 1);
-        arrayString += "]";
+    *loopTime = (float)(micros() - startMicros) / 1000.0 / (float)samplesTaken;
 
-        String jsonOutput = String(json);
-        jsonOutput = jsonOutput.replace("\"{{insert}}\"", arrayString);
-
-#ifdef LOG_HTTP_REQUEST
-        Serial.println("POST /api HTTP/1.0");
-        Serial.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
-        Serial.println("Content-Type: application/json");
-        Serial.println(String::format("Content-Length: %d", jsonOutput.length()));
-        Serial.println("");
-        Serial.println(jsonOutput); // Data goes here.
-        Serial.println();
-#endif
+    // Put the oldest measurement at the start.
+    std::rotate(voltageArray, voltageArray + index, voltageArray + numMeasurements);
 
-        client.println("POST /api HTTP/1.0");
-        client.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
-        client.println("Content-Type: application/json");
-        client.println(String::format("Content-Length: %d", jsonOutput.length()));
-        client.println("");
-        client.println(jsonOutput); // Data goes here.
-        client.println();
-        client.stop();
+    return triggered;
+}
+
+void uploadData(int currentMode, float *voltageArray, float loopTime, float Vmax, float Vptp, float peakWidth, uint8_t activatedSwitches, unsigned long dischargeTime, float depth)
+{
+    // Without a trigger there is no signal worth uploading.
+    if (Features::Acquisition::triggered && !lastMeasurementTriggered)
+    {
+        return;
     }
-    else
+
+    if (!isNetworkReady())
     {
-        Serial.println("Data upload failed!");
+        return;
     }
-}
 
-void uploadLCDData()
-{
-    if (client.connect(SERVER_ADDRESS, SERVER_PORT))
+    uint32_t stageStartTicks = getProfilingTicks();
+    bool connected = client.connect(SERVER_ADDRESS, SERVER_PORT);
+    recordStage(Stage::TCP_CONNECT, stageStartTicks);
+
+    if (connected)
     {
-        char json[200];
+        stageStartTicks = getProfilingTicks();
+
+        MemoryStatistics memory;
+        getMemoryStatistics(&memory);
+
+        // Base64 text of the compressed window, or NULL to upload the window as decimal text.
+        // Either is inserted after the rest of the JSON is written, as it does not fit in `json`.
+        const char *encodedVoltagesText = NULL;
+        if (Features::Upload::compressed)
+        {
+            // Encode in the units the voltages would have as text, so nothing is lost compared to it.
+            static uint8_t encodedVoltages[COMPRESSED_UPLOAD_BUFFER_SIZE];
+            static char encodedVoltagesBase64[(COMPRESSED_UPLOAD_BUFFER_SIZE + 2) / 3 * 4 + 1];
+            WaveformEncoder encoder;
+            beginWaveformEncoding(&encoder, encodedVoltages, sizeof(encodedVoltages));
+            for (size_t i = 0; i < 1000; i++)
+            {
+                encodeWaveformSample(&encoder, lround(voltageArray[i] * Features::Acquisition::voltageScale));
+            }
+            size_t encodedLength = endWaveformEncoding(&encoder);
+
+            // A window too noisy to fit in the buffer is sent as text.
+            if (encodedLength > 0 && encodeBase64(encodedVoltages, encodedLength, encodedVoltagesBase64, sizeof(encodedVoltagesBase64)) > 0)
+            {
+                encodedVoltagesText = encodedVoltagesBase64;
+            }
+        }
+
+        char json[512];
         JSONBufferWriter jsonWriter(json, sizeof(json));
         jsonWriter.beginObject();
-        jsonWriter.name("lcdFirstLine").value(lcdFirstLine);
-        jsonWriter.name("lcdSecondLine").value(lcdSecondLine);
+        jsonWriter.name("deviceID").value(System.deviceID());
+        jsonWriter.name("currentMode").value(currentMode);
+        if (encodedVoltagesText)
+        {
+            jsonWriter.name("voltageEncoded").value("{{insert}}");
+            jsonWriter.name("voltageScale").value(Features::Acquisition::voltageScale);
+        }
+        else
+        {
+            jsonWriter.name("voltageArray").value("{{insert}}");
+        }
+        jsonWriter.name("loopTime").value(loopTime, 2);
+        jsonWriter.name("Vmax").value(Vmax, Features::Acquisition::voltageDecimals);
+        jsonWriter.name("Vptp").value(Vptp, Features::Acquisition::voltageDecimals);
+        jsonWriter.name("peakWidth").value(round(peakWidth * 100 / 100));
+        jsonWriter.name("activatedSwitches").value(activatedSwitches);
+        jsonWriter.name("dischargeTime").value(dischargeTime);
+        writeCaptureTimes(jsonWriter);
+        if (depth >= 0)
+        {
+            jsonWriter.name("depth").value(depth, 1);
+        }
+        jsonWriter.name("freeHeap").value((unsigned int)memory.freeHeap);
+        jsonWriter.name("maxUsedHeap").value((unsigned int)memory.maxUsedHeap);
+        jsonWriter.name("largestFreeBlock").value((unsigned int)memory.largestFreeBlock);
+        jsonWriter.name("stackUsed").value((unsigned int)memory.stackUsed);
+        jsonWriter.name("lcdFirstLine").value(lcdFirstLine.text);
+        jsonWriter.name("lcdSecondLine").value(lcdSecondLine.text);
         jsonWriter.endObject();
         jsonWriter.buffer()[std::min(jsonWriter.bufferSize(), jsonWriter.dataSize())] = 0;
 
         String jsonOutput = String(json);
+        if (encodedVoltagesText)
+        {
+            jsonOutput = jsonOutput.replace("{{insert}}", encodedVoltagesText);
+        }
+        else
+        {
+            String arrayString = "[";
 
-#ifdef LOG_HTTP_REQUEST
-        Serial.println("POST /api HTTP/1.0");
-        Serial.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
-        Serial.println("Content-Type: application/json");
-        Serial.println(String::format("Content-Length: %d", jsonOutput.length()));
-        Serial.println("");
-        Serial.println(jsonOutput); // Data goes here.
-        Serial.println();
+            for (size_t i = 0; i < 1000; i++)
+            {
+                arrayString += String::format("%.*f,", Features::Acquisition::voltageDecimals, voltageArray[i]);
+            }
+
+            arrayString = arrayString.remove(arrayString.length() - 1);
+            arrayString += "]";
+
+            jsonOutput = jsonOutput.replace("\"{{insert}}\"", arrayString);
+        }
+
+        recordStage(Stage::JSON, stageStartTicks);
+
+        if (Features::RequestLog::enabled)
+        {
+            printJsonRequest(Serial, jsonOutput.c_str());
+        }
+
+        stageStartTicks = getProfilingTicks();
+
+        printJsonRequest(client, jsonOutput.c_str());
+        client.stop();
+
+        recordStage(Stage::TCP_SEND, stageStartTicks);
+    }
+    else
+    {
+        Serial.println("Data upload failed!");
+    }
+
+#ifdef UPLOAD_PROFILING
+    if (millis() - lastProfilingUploadTime >= PROFILING_UPLOAD_INTERVAL)
+    {
+        uploadProfilingData();
+        resetStageStatistics();
+        lastProfilingUploadTime = millis();
+    }
 #endif
+}
 
-        client.println("POST /api HTTP/1.0");
-        client.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
-        client.println("Content-Type: application/json");
-        client.println(String::format("Content-Length: %d", jsonOutput.length()));
-        client.println("");
-        client.println(jsonOutput); // Data goes here.
-        client.println();
+void uploadSpectrum(const uint16_t *spectrum, SpectrumPeak peak, float loopTime, float Vptp, uint8_t activatedSwitches)
+{
+    if (!isNetworkReady())
+    {
+        return;
+    }
+
+    uint32_t stageStartTicks = getProfilingTicks();
+    bool connected = client.connect(SERVER_ADDRESS, SERVER_PORT);
+    recordStage(Stage::TCP_CONNECT, stageStartTicks);
+
+    if (connected)
+    {
+        stageStartTicks = getProfilingTicks();
+
+        MemoryStatistics memory;
+        getMemoryStatistics(&memory);
+
+        static char json[1536];
+        JSONBufferWriter jsonWriter(json, sizeof(json));
+        jsonWriter.beginObject();
+        jsonWriter.name("deviceID").value(System.deviceID());
+        jsonWriter.name("currentMode").value((int)Mode::SPECTRUM);
+        jsonWriter.name("spectrum").beginArray();
+        for (size_t i = 0; i < SPECTRUM_BINS; i++)
+        {
+            jsonWriter.value((unsigned int)spectrum[i]);
+        }
+        jsonWriter.endArray();
+        jsonWriter.name("spectrumScale").value(getSpectrumScale(1000), 7);
+        jsonWriter.name("binFrequency").value(getBinFrequency(1, loopTime), 3);
+        jsonWriter.name("dominantFrequency").value(getBinFrequency(peak.bin, loopTime), 1);
+        jsonWriter.name("dominantAmplitude").value(peak.magnitude * getSpectrumScale(1000), Features::Acquisition::voltageDecimals);
+        jsonWriter.name("loopTime").value(loopTime, 2);
+        jsonWriter.name("Vptp").value(Vptp, Features::Acquisition::voltageDecimals);
+        jsonWriter.name("activatedSwitches").value(activatedSwitches);
+        writeCaptureTimes(jsonWriter);
+        jsonWriter.name("freeHeap").value((unsigned int)memory.freeHeap);
+        jsonWriter.name("maxUsedHeap").value((unsigned int)memory.maxUsedHeap);
+        jsonWriter.name("largestFreeBlock").value((unsigned int)memory.largestFreeBlock);
+        jsonWriter.name("stackUsed").value((unsigned int)memory.stackUsed);
+        jsonWriter.name("lcdFirstLine").value(lcdFirstLine.text);
+        jsonWriter.name("lcdSecondLine").value(lcdSecondLine.text);
+        jsonWriter.endObject();
+        jsonWriter.buffer()[std::min(jsonWriter.bufferSize(), jsonWriter.dataSize())] = 0;
+
+        recordStage(Stage::JSON, stageStartTicks);
+
+        if (Features::RequestLog::enabled)
+        {
+            printJsonRequest(Serial, json);
+        }
+
+        stageStartTicks = getProfilingTicks();
+
+        printJsonRequest(client, json);
+        client.stop();
+
+        recordStage(Stage::TCP_SEND, stageStartTicks);
+    }
+    else
+    {
+        Serial.println("Data upload failed!");
+    }
+}
+
+void printJsonRequest(Print &out, const char *json)
+{
+    out.println("POST /api HTTP/1.0");
+    out.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
+    out.println("Content-Type: application/json");
+    out.println(String::format("Content-Length: %d", strlen(json)));
+#ifdef LATENCY_TRACING
+    // A header rather than a field, so it is taken after the body has been serialized.
+    if (clockSync.synced)
+    {
+        out.println(String::format("X-Send-Time: %.0f", (double)toServerTime(&clockSync, millis())));
+    }
+#endif
+    out.println("");
+    out.println(json); // Data goes here.
+    out.println();
+}
+
+void uploadLCDData()
+{
+    if (!isNetworkReady())
+    {
+        return;
+    }
+
+    if (client.connect(SERVER_ADDRESS, SERVER_PORT))
+    {
+        char json[200];
+        JSONBufferWriter jsonWriter(json, sizeof(json));
+        jsonWriter.beginObject();
+        // Keys the state of this detector on the server, like `uploadData()`.
+        jsonWriter.name("deviceID").value(System.deviceID());
+        jsonWriter.name("lcdFirstLine").value(lcdFirstLine.text);
+        jsonWriter.name("lcdSecondLine").value(lcdSecondLine.text);
+        jsonWriter.endObject();
+        jsonWriter.buffer()[std::min(jsonWriter.bufferSize(), jsonWriter.dataSize())] = 0;
+
+        if (Features::RequestLog::enabled)
+        {
+            printJsonRequest(Serial, json);
+        }
+        printJsonRequest(client, json);
         client.stop();
     }
     else
@@ -548,24 +1109,607 @@ void uploadLCDData()
     }
 }
 
-void runDischargeCycle()
+bool isNetworkReady()
+{
+    if (!WiFi.ready())
+    {
+        return false;
+    }
+
+    if (!networkSessionEstablished)
+    {
+        networkSessionEstablished = true;
+        recordBootPhase(&bootTimings.wifi);
+        Serial.println("[WiFi] Success!");
+    }
+
+    // Only a response counts as the session with the server, not a failed connection or a timeout, so the check is
+    // retried until there is one. Set first, as the check uploads through this function too.
+    if (bootTimings.server == 0 && (lastServerCheckTime == 0 || millis() - lastServerCheckTime >= SERVER_CHECK_RETRY_INTERVAL))
+    {
+        lastServerCheckTime = millis();
+        if (checkForCalibrationUpdate())
+        {
+            recordBootPhase(&bootTimings.server);
+        }
+    }
+
+#ifdef LATENCY_TRACING
+    // Until the clock has been synced once, every failed round is retried sooner.
+    unsigned long syncInterval = clockSync.synced ? CLOCK_SYNC_INTERVAL : CLOCK_SYNC_RETRY_INTERVAL;
+    if (lastClockSyncTime == 0 || millis() - lastClockSyncTime >= syncInterval)
+    {
+        syncClock();
+    }
+#endif
+
+    // Only complete once there has been a measurement and a response of the server as well. Retried at the next call
+    // when the upload fails.
+    if (!bootTimingsUploaded && bootTimings.firstMeasurement && bootTimings.server)
+    {
+        bootTimingsUploaded = uploadBootTimings();
+    }
+
+    return true;
+}
+
+void recordBootPhase(unsigned long *phase)
+{
+    if (*phase == 0)
+    {
+        *phase = millis();
+    }
+}
+
+bool uploadBootTimings()
+{
+    if (client.connect(SERVER_ADDRESS, SERVER_PORT))
+    {
+        char json[300];
+        JSONBufferWriter jsonWriter(json, sizeof(json));
+        jsonWriter.beginObject();
+        jsonWriter.name("deviceID").value(System.deviceID());
+        jsonWriter.name("boot").beginObject();
+        jsonWriter.name("setup").value((unsigned int)bootTimings.setup);
+        jsonWriter.name("calibration").value((unsigned int)bootTimings.calibration);
+        jsonWriter.name("lcd").value((unsigned int)bootTimings.lcd);
+        jsonWriter.name("firstMeasurement").value((unsigned int)bootTimings.firstMeasurement);
+        jsonWriter.name("wifi").value((unsigned int)bootTimings.wifi);
+        jsonWriter.name("server").value((unsigned int)bootTimings.server);
+        jsonWriter.endObject();
+        jsonWriter.endObject();
+        jsonWriter.buffer()[std::min(jsonWriter.bufferSize(), jsonWriter.dataSize())] = 0;
+
+        if (Features::RequestLog::enabled)
+        {
+            printJsonRequest(Serial, json);
+        }
+
+        printJsonRequest(client, json);
+        client.stop();
+        return true;
+    }
+    else
+    {
+        Serial.println("Data upload failed!");
+        return false;
+    }
+}
+
+void streamLiveMeasurement(float voltage)
+{
+    if (liveFrame.sampleCount == 0)
+    {
+        liveFrame.timestamp = micros();
+    }
+    liveFrame.samples[liveFrame.sampleCount++] = (uint16_t)constrain(lround(voltage * LIVE_SAMPLE_SCALE), 0L, 65535L);
+
+    if (liveFrame.sampleCount < LIVE_FRAME_SAMPLES)
+    {
+        return;
+    }
+    liveFrame.sampleInterval = (micros() - liveFrame.timestamp) / (LIVE_FRAME_SAMPLES - 1);
+
+    // Never connects, see `connectLiveStream()`. Frames are dropped until it has.
+    if (liveClient.connected())
+    {
+        // A partially written frame would corrupt the stream, so start over with a new connection.
+        if (liveClient.write((const uint8_t *)&liveFrame, sizeof(liveFrame)) != sizeof(liveFrame))
+        {
+            liveClient.stop();
+        }
+    }
+
+    // Frames that could not be sent still use up a sequence number, so the server sees the gap.
+    liveFrame.sequence++;
+    liveFrame.sampleCount = 0;
+}
+
+void connectLiveStream()
+{
+    if (liveClient.connected() || !isNetworkReady() || millis() - lastLiveConnectTime < liveReconnectInterval)
+    {
+        return;
+    }
+
+    lastLiveConnectTime = millis();
+    if (liveClient.connect(SERVER_ADDRESS, LIVE_STREAM_PORT))
+    {
+        // Identify the device once per connection.
+        String deviceID = System.deviceID();
+        liveClient.write((const uint8_t *)deviceID.c_str(), deviceID.length());
+        liveReconnectInterval = 0;
+    }
+    else
+    {
+        // Connecting blocks for as long as the server is unreachable, so back off while it stays that way.
+        liveReconnectInterval = std::min(std::max(2 * liveReconnectInterval, (unsigned long)LIVE_STREAM_RECONNECT_INTERVAL), (unsigned long)LIVE_STREAM_MAX_RECONNECT_INTERVAL);
+    }
+}
+
+void uploadProfilingData()
+{
+    if (!isNetworkReady())
+    {
+        return;
+    }
+
+    if (client.connect(SERVER_ADDRESS, SERVER_PORT))
+    {
+        static char json[2048];
+        JSONBufferWriter jsonWriter(json, sizeof(json));
+        jsonWriter.beginObject();
+        jsonWriter.name("deviceID").value(System.deviceID());
+        jsonWriter.name("profile").beginObject();
+        for (int i = 0; i < (int)Stage::COUNT; i++)
+        {
+            StageStatistics *statistics = &stageStatistics[i];
+            jsonWriter.name(getStageName((Stage)i)).beginObject();
+            jsonWriter.name("count").value((unsigned int)statistics->count);
+            jsonWriter.name("min").value((unsigned int)statistics->minTime);
+            jsonWriter.name("avg").value((unsigned int)(statistics->count ? statistics->totalTime / statistics->count : 0));
+            jsonWriter.name("max").value((unsigned int)statistics->maxTime);
+            jsonWriter.name("histogram").beginArray();
+            for (int bin = 0; bin < PROFILING_HISTOGRAM_BINS; bin++)
+            {
+                jsonWriter.value((unsigned int)statistics->histogram[bin]);
+            }
+            jsonWriter.endArray();
+            jsonWriter.endObject();
+        }
+        jsonWriter.endObject();
+        jsonWriter.endObject();
+        jsonWriter.buffer()[std::min(jsonWriter.bufferSize(), jsonWriter.dataSize())] = 0;
+
+        if (Features::RequestLog::enabled)
+        {
+            printJsonRequest(Serial, json);
+        }
+        printJsonRequest(client, json);
+        client.stop();
+    }
+    else
+    {
+        Serial.println("Profiling upload failed!");
+    }
+}
+
+bool checkForCalibrationUpdate()
+{
+    if (!isNetworkReady())
+    {
+        return false;
+    }
+
+    if (!client.connect(SERVER_ADDRESS, SERVER_PORT))
+    {
+        Serial.println("[Calibration] Checking for calibration update failed!");
+        return false;
+    }
+
+    client.println(String::format("GET /api/calibration?device=%s&checksum=%lu HTTP/1.0", System.deviceID().c_str(), activeCalibrationChecksum));
+    client.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
+    client.println();
+
+    unsigned long startTime = millis();
+
+    // Only `200 OK` carries a calibration, `204 No Content` means it is up to date.
+    char statusLine[16] = {0};
+    if (!readResponseHeaders(statusLine, sizeof(statusLine), startTime, CALIBRATION_RESPONSE_TIMEOUT))
+    {
+        client.stop();
+        return false;
+    }
+    if (strstr(statusLine, " 200") == NULL)
+    {
+        client.stop();
+        return strstr(statusLine, " 204") != NULL;
+    }
+
+    // Read the calibration blob.
+    CalibrationBlob blob;
+    uint8_t *blobBytes = (uint8_t *)&blob;
+    size_t received = 0;
+    while (received < sizeof(blob))
+    {
+        if (millis() - startTime > CALIBRATION_RESPONSE_TIMEOUT || (!client.connected() && !client.available()))
+        {
+            break;
+        }
+        if (client.available())
+        {
+            blobBytes[received++] = client.read();
+        }
+    }
+    client.stop();
+
+    if (received == sizeof(blob) && applyCalibrationBlob(&blob))
+    {
+        storeCalibrationInEEPROM(&blob);
+        Serial.println(String::format("[Calibration] New calibration stored. Checksum: %08lx", activeCalibrationChecksum));
+    }
+    else
+    {
+        Serial.println("[Calibration] Received invalid calibration!");
+    }
+    return received == sizeof(blob);
+}
+
+void serviceBurstCapture()
 {
-#ifndef NO_DISCHARGE_CYCLE
+#ifdef BURST_CAPTURE
+    if (burstLogBlocks == 0 || !isNetworkReady())
+    {
+        return;
+    }
+
+    // Chunks follow each other right away, only a failed one waits before it is retried.
+    if (burstUploadPending && millis() - lastBurstPollTime >= BURST_POLL_INTERVAL)
+    {
+        if (uploadBurstChunk())
+        {
+            burstUploadPending = false;
+            Serial.println(String::format("[Burst] Recording %lu uploaded.", burstUpload.recordingId));
+        }
+        else if (burstUploadOffset == BURST_ERASED)
+        {
+            lastBurstPollTime = millis();
+        }
+        return;
+    }
+
+    if (burstUploadPending || millis() - lastBurstPollTime < BURST_POLL_INTERVAL)
+    {
+        return;
+    }
+    lastBurstPollTime = millis();
+
+    char body[16];
+    if (requestText(String::format("GET /api/burst/request?device=%s HTTP/1.0", System.deviceID().c_str()), body, sizeof(body)))
+    {
+        uint32_t seconds = strtoul(body, NULL, 10);
+        if (seconds > 0)
+        {
+            burstCaptureRoutine(std::min(seconds, (uint32_t)BURST_MAX_DURATION));
+        }
+    }
+#endif
+}
+
+void burstCaptureRoutine(uint32_t seconds)
+{
+    // All blocks are erased before recording starts, which takes a while for long recordings.
+    setLine(&lcdFirstLine, "Burst capture");
+    setLine(&lcdSecondLine, "Recording ");
+    appendInt(&lcdSecondLine, seconds);
+    appendText(&lcdSecondLine, " s");
+    lcd_clear_printLines();
+    uploadLCDData();
+
+    // Static rather than on the heap, which may not have room for it left. Only called when `BURST_CAPTURE` is
+    // defined, otherwise the linker drops it with the function.
+    static uint16_t buffer[BURST_BUFFER_SAMPLES];
+    unsigned long startTime = millis();
+    BurstRecording recording;
+    bool complete = captureBurst(MEASUREMENT_PIN, BURST_SAMPLE_TIME, BURST_SAMPLE_RATE, seconds * BURST_SAMPLE_RATE, buffer, BURST_BUFFER_SAMPLES, &recording);
+
+    Serial.println(String::format("[Burst] Recording %lu: %lu samples in %lu ms%s", recording.recordingId, recording.sampleCount, millis() - startTime, complete ? "." : ", cut short!"));
+    if (recording.sampleCount > 0)
+    {
+        burstUpload = recording;
+        burstUploadOffset = 0;
+        burstUploadPending = true;
+    }
+
+    setLine(&lcdSecondLine, complete ? "Done" : "Cut short");
+    lcd_clear_printLines();
+    uploadLCDData();
+}
+
+bool uploadBurstChunk()
+{
+    char body[16];
+    if (burstUploadOffset == BURST_ERASED)
+    {
+        if (!requestText(String::format("GET /api/burst?device=%s&recording=%lu HTTP/1.0", System.deviceID().c_str(), burstUpload.recordingId), body, sizeof(body)))
+        {
+            return false;
+        }
+        burstUploadOffset = strtoul(body, NULL, 10);
+    }
+
+    uint32_t dataSize = getBurstDataSize(burstUpload.sampleCount);
+    if (burstUploadOffset >= dataSize)
+    {
+        return true;
+    }
+    uint32_t length = std::min(dataSize - burstUploadOffset, (uint32_t)BURST_UPLOAD_CHUNK_SIZE);
+
+    if (!client.connect(SERVER_ADDRESS, SERVER_PORT))
+    {
+        burstUploadOffset = BURST_ERASED;
+        return false;
+    }
+
+    // An incomplete recording is sent with `BURST_ERASED` as checksum, which the server does not check.
+    client.println(String::format("POST /api/burst?device=%s&recording=%lu&offset=%lu&sampleRate=%lu&sampleCount=%lu&checksum=%lu HTTP/1.0",
+                                  System.deviceID().c_str(), burstUpload.recordingId, burstUploadOffset, burstUpload.sampleRate, burstUpload.sampleCount, burstUpload.dataChecksum));
+    client.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
+    client.println("Content-Type: application/octet-stream");
+    client.println(String::format("Content-Length: %lu", length));
+    client.println();
+
+    // Streamed from the flash a page at a time, as a chunk does not fit in RAM next to a window.
+    uint8_t data[SPI_FLASH_PAGE_SIZE];
+    for (uint32_t sent = 0; sent < length; sent += sizeof(data))
+    {
+        size_t part = std::min(length - sent, (uint32_t)sizeof(data));
+        readBurstData(&burstUpload, burstUploadOffset + sent, data, part);
+        client.write(data, part);
+    }
+
+    unsigned long startTime = millis();
+    char statusLine[16] = {0};
+    bool success = readResponseHeaders(statusLine, sizeof(statusLine), startTime, BURST_RESPONSE_TIMEOUT) && strstr(statusLine, " 200") != NULL;
+    if (success)
+    {
+        readResponseBody(body, sizeof(body), startTime, BURST_RESPONSE_TIMEOUT);
+    }
+    client.stop();
+
+    // The server responds with how much it has, which is also where to continue when the chunk was rejected.
+    // Without a response it is unknown whether the chunk arrived, so the server is asked before the next one.
+    burstUploadOffset = success ? strtoul(body, NULL, 10) : BURST_ERASED;
+    return success && burstUploadOffset >= dataSize;
+}
+
+bool requestText(const String &request, char *body, size_t bodySize)
+{
+    body[0] = 0;
+    if (!client.connect(SERVER_ADDRESS, SERVER_PORT))
+    {
+        return false;
+    }
+
+    client.println(request);
+    client.println(String::format("Host: %s:%d", SERVER_ADDRESS, SERVER_PORT));
+    client.println();
+
+    unsigned long startTime = millis();
+    char statusLine[16] = {0};
+    bool success = readResponseHeaders(statusLine, sizeof(statusLine), startTime, BURST_RESPONSE_TIMEOUT) && strstr(statusLine, " 200") != NULL;
+    if (success)
+    {
+        readResponseBody(body, bodySize, startTime, BURST_RESPONSE_TIMEOUT);
+    }
+    client.stop();
+    return success;
+}
+
+void readResponseBody(char *body, size_t bodySize, unsigned long startTime, unsigned long timeout)
+{
+    // The server closes the connection after the body, as the requests are HTTP/1.0.
+    size_t length = 0;
+    while (millis() - startTime <= timeout && (client.connected() || client.available()))
+    {
+        if (!client.available())
+        {
+            continue;
+        }
+        char c = client.read();
+        if (length < bodySize - 1)
+        {
+            body[length++] = c;
+        }
+    }
+    body[length] = 0;
+}
+
+bool readResponseHeaders(char *statusLine, size_t statusLineSize, unsigned long startTime, unsigned long timeout)
+{
+    size_t statusLength = 0;
+    const char *headerTerminator = "\r\n\r\n";
+    int terminatorMatched = 0;
+    while (terminatorMatched < 4)
+    {
+        if (millis() - startTime > timeout || (!client.connected() && !client.available()))
+        {
+            return false;
+        }
+        if (!client.available())
+        {
+            continue;
+        }
+
+        char c = client.read();
+        if (statusLength < statusLineSize - 1)
+        {
+            statusLine[statusLength++] = c;
+        }
+
+        if (c == headerTerminator[terminatorMatched])
+        {
+            terminatorMatched++;
+        }
+        else
+        {
+            terminatorMatched = (c == '\r') ? 1 : 0;
+        }
+    }
+    return true;
+}
+
+void syncClock()
+{
+    ClockSync sync;
+    resetClockSync(&sync);
+
+    for (int i = 0; i < CLOCK_SYNC_SAMPLES; i++)
+    {
+        if (!client.connect(SERVER_ADDRESS, SERVER_PORT))
+        {
+            break;
+        }
+
+        // Connecting is not part of the round trip. The request is written at once, so it leaves in a single packet.
+        uint32_t sendTime = millis();
+        client.print(String::format("GET /api/time HTTP/1.0\r\nHost: %s:%d\r\n\r\n", SERVER_ADDRESS, SERVER_PORT));
+
+        char statusLine[16] = {0};
+        char body[24] = {0};
+        size_t bodyLength = 0;
+        uint32_t receiveTime = 0;
+        if (readResponseHeaders(statusLine, sizeof(statusLine), sendTime, CLOCK_SYNC_TIMEOUT) && strstr(statusLine, " 200") != NULL)
+        {
+            // The server closes the connection after the body.
+            while (millis() - sendTime <= CLOCK_SYNC_TIMEOUT && (client.connected() || client.available()))
+            {
+                if (!client.available())
+                {
+                    continue;
+                }
+                // The body arrives in one packet, so the round trip ends at its first byte.
+                if (bodyLength == 0)
+                {
+                    receiveTime = millis();
+                }
+                char c = client.read();
+                if (bodyLength < sizeof(body) - 1)
+                {
+                    body[bodyLength++] = c;
+                }
+            }
+        }
+        client.stop();
+
+        if (bodyLength > 0)
+        {
+            addClockSample(&sync, sendTime, strtoull(body, NULL, 10), receiveTime);
+        }
+    }
+
+    if (sync.synced)
+    {
+        clockSync = sync;
+        Serial.println(String::format("[Clock] Synced with the server to within %lu ms.", (unsigned long)(sync.roundTrip / 2 + 1)));
+    }
+    else
+    {
+        Serial.println("[Clock] Syncing with the server failed!");
+    }
+    lastClockSyncTime = millis();
+}
+
+void writeCaptureTimes(JSONBufferWriter &jsonWriter)
+{
+#ifdef LATENCY_TRACING
+    if (clockSync.synced)
+    {
+        // Server times do not fit in 32 bits, but are exact as a double.
+        jsonWriter.name("captureStart").value((double)toServerTime(&clockSync, lastCaptureStart), 0);
+        jsonWriter.name("captureEnd").value((double)toServerTime(&clockSync, lastCaptureEnd), 0);
+    }
+#endif
+}
+
+float readMeasurementVoltage()
+{
+    if (Features::Acquisition::oversampling > 1)
+    {
+        // Averaging N conversions with independent noise gains log4(N) bits of resolution.
+        uint32_t sum = 0;
+        for (int n = 0; n < Features::Acquisition::oversampling; n++)
+        {
+            sum += analogRead(MEASUREMENT_PIN);
+        }
+        return map((float)sum / Features::Acquisition::oversampling, 0.0, 4095.0, 0.0, 3.3);
+    }
+    return map((float)analogRead(MEASUREMENT_PIN), 0.0, 4095.0, 0.0, 3.3);
+}
+
+unsigned long runDischargeCycle()
+{
+    if (!Features::Discharge::enabled)
+    {
+        return 0;
+    }
+
+    unsigned long startTime = millis();
+
+    // The capacitors never charged up far enough to distort the measurement, so there is nothing to discharge.
+    if (Features::Discharge::skipUnsaturated && !lastMeasurementSaturated)
+    {
+        return 0;
+    }
+
     // Pull pin to ground and discharge capacitors.
     pinMode(DISCHARGE_PIN, INPUT_PULLDOWN);
 
-    // Delay to allow capacitors to discharge.
-    delay(50);
+    if (Features::Discharge::adaptive)
+    {
+        // Keep discharging until enough consecutive measurements are below the threshold,
+        // or until the maximum discharge time has passed.
+        int settledMeasurements = 0;
+        while (settledMeasurements < DISCHARGE_SETTLED_COUNT && millis() - startTime < DISCHARGE_MAX_TIME)
+        {
+            float currentMeasurement = map((float)analogRead(MEASUREMENT_PIN), 0.0, 4095.0, 0.0, 3.3);
+
+            if (currentMeasurement < DISCHARGE_SETTLED_THRESHOLD)
+            {
+                settledMeasurements++;
+            }
+            else
+            {
+                settledMeasurements = 0;
+            }
+        }
 
-    // Return pin to high-impedance state.
-    pinMode(DISCHARGE_PIN, INPUT);
+        // Return pin to high-impedance state.
+        pinMode(DISCHARGE_PIN, INPUT);
 
-    delay(50);
-#endif
+        delay(DISCHARGE_RECOVERY_TIME);
+    }
+    else
+    {
+        // Delay to allow capacitors to discharge.
+        delay(50);
+
+        // Return pin to high-impedance state.
+        pinMode(DISCHARGE_PIN, INPUT);
+
+        delay(50);
+    }
+
+    return millis() - startTime;
 }
 
 uint8_t determineActivatedSwitches()
 {
+    if (Features::Sensors::fixed)
+    {
+        return Features::Sensors::switches;
+    }
+
     digitalWrite(SWITCH_HIGH_PIN, HIGH);
 
     uint8_t output = 0b00000000;
@@ -592,6 +1736,11 @@ bool isSwitchActivated(uint8_t switchPositions, int position)
 
 Mode getModeSwitchState()
 {
+    if (Features::Modes::fixed)
+    {
+        return Features::Modes::mode;
+    }
+
     digitalWrite(SWITCH_HIGH_PIN, HIGH);
 
     int switchState = digitalRead(SWITCH_MODE_PIN1);
@@ -599,53 +1748,41 @@ Mode getModeSwitchState()
 
     digitalWrite(SWITCH_HIGH_PIN, LOW);
 
-#ifdef PERMA_MODE_POSITION
-    modeState = Mode::POSITION;
-#endif
-#ifdef PERMA_MODE_DEPTH
-    modeState = Mode::DEPTH;
-#endif
     return modeState;
 }
 
 void lcd_clear()
 {
-#ifndef NO_LCD
-    lcd->clear();
-#endif
+    Features::Display::clear();
 }
 
 void lcd_setCursor(uint8_t col, uint8_t row)
 {
-#ifndef NO_LCD
-    lcd->setCursor(col, row);
-#endif
+    Features::Display::setCursor(col, row);
 }
 
-void lcd_print(String text)
+void lcd_print(const char *text)
 {
-#ifndef NO_LCD
-    lcd->print(text);
-#endif
+    Features::Display::print(text);
 }
 
 void lcd_clear_printLines(bool printFirstLine /* = true */, bool printSecondLine /* = true */, bool clear /* = true */)
 {
-#ifndef NO_LCD
+    if (!Features::Display::enabled)
+    {
+        return;
+    }
+
+    uint32_t stageStartTicks = getProfilingTicks();
+
     if (clear)
         lcd_clear();
     lcd_setCursor(0, 0);
     if (printFirstLine)
-        lcd_print(lcdFirstLine);
+        lcd_print(lcdFirstLine.text);
     lcd_setCursor(0, 1);
     if (printSecondLine)
-        lcd_print(lcdSecondLine);
-#endif
-}
+        lcd_print(lcdSecondLine.text);
 
-void lcd_write(uint8_t byte)
-{
-#ifndef NO_LCD
-    lcd->write(byte);
-#endif
+    recordStage(Stage::LCD, stageStartTicks);
 }
@@ -2,6 +2,7 @@
 #define _MAIN_H_
 
 #include "setup.h"
+#include "spectrum.h"
 
 // ############
 // # IO Setup #
@@ -20,7 +21,12 @@
 #define SWITCH_MODE_PIN2 A2
 #define LCD_I2C_SDA D0
 #define LCD_I2C_SCL D1
+// The SPI flash of `BURST_CAPTURE` uses A3 as its clock, see spiflash.h, so the discharge moves to A7.
+#ifdef BURST_CAPTURE
+#define DISCHARGE_PIN A7
+#else
 #define DISCHARGE_PIN A3
+#endif
 
 // ###################
 // # Interface setup #
@@ -31,7 +37,8 @@
 enum class Mode
 {
     POSITION = 0,
-    DEPTH = 1
+    DEPTH = 1,
+    SPECTRUM = 2
 };
 
 // I2C address of the LCD.
@@ -43,6 +50,57 @@ enum class Mode
 #define SERVER_ADDRESS SETUP_SERVER_ADDRESS
 // Port of the API server.
 #define SERVER_PORT SETUP_SERVER_PORT
+// Time to wait for the server to send a calibration update. (ms)
+#define CALIBRATION_RESPONSE_TIMEOUT 2000
+// Time between calibration checks while the server has not responded since boot, see `isNetworkReady()`. (ms)
+#define SERVER_CHECK_RETRY_INTERVAL 10000
+// Time between uploads of the timing statistics when `UPLOAD_PROFILING` is defined. (ms)
+#define PROFILING_UPLOAD_INTERVAL 10000
+// Size of the buffer for a compressed window of `CompressedUpload`. Noisier windows are uploaded as text. (bytes)
+#define COMPRESSED_UPLOAD_BUFFER_SIZE 1024
+
+// #### Clock sync ####
+
+// Number of times the server time is requested in a clock sync round when `LATENCY_TRACING` is defined. The sample
+// with the shortest round trip is kept.
+#define CLOCK_SYNC_SAMPLES 4
+// Time between clock sync rounds. Keeps the drift of the crystal below about 50 ms. (ms)
+#define CLOCK_SYNC_INTERVAL 600000
+// Time between clock sync rounds while the clock has never been synced. (ms)
+#define CLOCK_SYNC_RETRY_INTERVAL 30000
+// Time to wait for the server to send its time. (ms)
+#define CLOCK_SYNC_TIMEOUT 1000
+
+// #### Live stream ####
+
+// Port of the live stream listener of the API server.
+#define LIVE_STREAM_PORT 5001
+// Time between attempts to open the live stream connection after the first failed one. Doubles with every failed
+// attempt after it, up to `LIVE_STREAM_MAX_RECONNECT_INTERVAL`. (ms)
+#define LIVE_STREAM_RECONNECT_INTERVAL 5000
+#define LIVE_STREAM_MAX_RECONNECT_INTERVAL 80000
+// Number of measurements in one live stream frame.
+#define LIVE_FRAME_SAMPLES 50
+// Marks the start of a live stream frame. Reads "DDLF" in memory.
+#define LIVE_FRAME_MAGIC 0x464C4444
+// Measurements are sent in units of 1 / `LIVE_SAMPLE_SCALE` V.
+#define LIVE_SAMPLE_SCALE 10000
+
+// Frame of consecutive measurements sent over the live stream connection, see `streamLiveMeasurement()`.
+// After connecting the device sends its device ID, followed by frames in this exact memory layout.
+// Keep it in sync with `LIVE_FRAME_HEADER` in server/app.py.
+struct LiveFrame
+{
+    uint32_t magic;
+    // Increases by one for every frame, including frames that could not be sent.
+    uint32_t sequence;
+    // Time the first measurement was taken, see `micros()`. (us)
+    uint32_t timestamp;
+    // Time between measurements. (us)
+    uint16_t sampleInterval;
+    uint16_t sampleCount;
+    uint16_t samples[LIVE_FRAME_SAMPLES];
+};
 
 // #### WiFi setup information ####
 
@@ -50,6 +108,19 @@ String wifi_SSID = SETUP_WIFI_SSID;
 String wifi_password = SETUP_WIFI_PSWD;
 int wifi_security = WPA2;
 
+// Time at which every phase of the startup finished, see `millis()`. 0 until the phase finished. (ms)
+// Measuring and the LCD come up first, WiFi and the server session follow in the background.
+struct BootTimings
+{
+    unsigned long setup;
+    unsigned long calibration;
+    unsigned long lcd;
+    unsigned long firstMeasurement;
+    unsigned long wifi;
+    // The first response of the server to the calibration check, which is retried until there is one.
+    unsigned long server;
+};
+
 // ##########################
 // # Measurement parameters #
 // ##########################
@@ -58,10 +129,92 @@ int wifi_security = WPA2;
 //     - parameters which defined how measurements behave.
 //     - thresholds used to prevent false positives for various measurements.
 
-// Defines how much the voltage should change before a peak is detected. (V)
-#define PEAK_MEASUREMENT_THRESHOLD 0.05
-// Defines how far back should be searched to see if a rise in voltage is happening.
-#define PEAK_DETECTION_BACKSEARCH 5
+// The peak detection thresholds are in peaks.h, as they are shared with the server.
+
+// #### ADC oversampling ####
+
+// Number of conversions averaged into one measurement by `OversampledAcquisition`. Every factor 4 adds one bit.
+#define ADC_OVERSAMPLING_FACTOR 4
+// Sample time of one conversion of `OversampledAcquisition`.
+// `analogRead()` averages 5 conversions of both ADCs, at 30 MHz and 12 cycles each on top of the sample time. At the
+// default 480 cycles that is the ~0.1 ms per measurement of a normal window, 4x at 112 cycles comes to about the same.
+// This only counts the conversions: every extra `analogRead()` also sets up the ADCs and DMA again, which has not been
+// measured. Check `loopTime` of an upload before raising the factor, 16x at 28 cycles is estimated rather than known.
+#define ADC_OVERSAMPLING_SAMPLE_TIME ADC_SampleTime_112Cycles
+
+// #### Interleaved acquisition ####
+
+// Combined sample rate of both ADCs of `InterleavedAcquisition`, about twice that of `analogRead()`. (Hz)
+#define INTERLEAVED_SAMPLE_RATE 20000
+// Sample time of every conversion of `InterleavedAcquisition`. Every ADC has 100 us per conversion at
+// 20 kHz, so the longest sample time fits and gives the input capacitance the most time to settle.
+#define INTERLEAVED_SAMPLE_TIME ADC_SampleTime_480Cycles
+
+// #### Burst capture ####
+
+// Sample rate of a burst capture when `BURST_CAPTURE` is defined. Two samples take three bytes, so this is bounded by
+// how fast pages can be programmed into the flash. (Hz)
+#define BURST_SAMPLE_RATE 100000
+// Sample time of every conversion of a burst capture. 10 us per conversion at 100 kHz leaves room for 112 cycles.
+#define BURST_SAMPLE_TIME ADC_SampleTime_112Cycles
+// Number of samples of the acquisition buffer of a burst capture. Absorbs the pauses while pages are programmed.
+#define BURST_BUFFER_SAMPLES 8192
+// Longest burst capture the server can request. (s)
+#define BURST_MAX_DURATION 60
+// Time between asking the server for a burst capture or uploading the next chunk of one. (ms)
+#define BURST_POLL_INTERVAL 10000
+// Number of bytes of a recording uploaded per request. Small enough that measuring is barely held up.
+#define BURST_UPLOAD_CHUNK_SIZE 16384
+// Time to wait for the server to respond to a burst request or chunk. (ms)
+#define BURST_RESPONSE_TIMEOUT 5000
+
+// #### Triggered capture ####
+
+// Voltage at which the trigger of `TriggeredAcquisition` fires. (V)
+#define TRIGGER_LEVEL 0.2
+// Direction in which the voltage should cross `TRIGGER_LEVEL`. 1 for a rising edge, -1 for a falling edge.
+#define TRIGGER_SLOPE 1
+// How far the voltage should be on the other side of `TRIGGER_LEVEL` before the trigger can fire again. (V)
+#define TRIGGER_HYSTERESIS 0.05
+// Number of measurements before the trigger in a captured window. The rest of the window comes after the trigger.
+#define TRIGGER_PRE_SAMPLES 200
+// Time to wait for a trigger before the last window is used as is. (ms)
+#define TRIGGER_TIMEOUT 500
+
+// #### Adaptive discharge cycle ####
+
+// Voltage below which the capacitors are considered discharged. (V)
+#define DISCHARGE_SETTLED_THRESHOLD 0.05
+// Number of consecutive measurements that should be below `DISCHARGE_SETTLED_THRESHOLD` before discharging stops.
+#define DISCHARGE_SETTLED_COUNT 10
+// Maximum time the discharge pin is pulled to ground. (ms)
+#define DISCHARGE_MAX_TIME 50
+// Time to wait after releasing the discharge pin before measuring. (ms)
+#define DISCHARGE_RECOVERY_TIME 10
+// A measurement reaching this voltage is considered to have saturated the front end. (V)
+#define DISCHARGE_SATURATION_VOLTAGE 3.2
+
+// #### Depth filter ####
+
+// Number of windows that should be combined before the depth can be considered stable.
+#define DEPTH_FILTER_MIN_WINDOWS 3
+// Uncertainty in the depth below which the depth is considered stable. (cm)
+#define DEPTH_STABLE_TOLERANCE 1.0
+
+// #### Fast position mode ####
+
+// Number of measurements in the sliding window. Should cover at least one period of the cable signal.
+#define POSITION_BUFFER_SIZE 250
+// Time between updates of the amplitude estimate. (ms)
+#define POSITION_UPDATE_INTERVAL 5
+// Time between LCD refreshes. (ms)
+#define POSITION_DISPLAY_INTERVAL 100
+// Time between uploads of the LCD data. (ms)
+#define POSITION_UPLOAD_INTERVAL 2000
+// Weight of the newest slope in the exponentially weighted slope. Between 0 and 1.
+#define POSITION_SLOPE_SMOOTHING 0.2
+// Slope of the amplitude above which the LCD shows "Warmer" or "Colder". (V/s)
+#define POSITION_SLOPE_THRESHOLD 0.1
 
 // #########################
 // # Function declarations #
@@ -79,34 +232,76 @@ void loop();
 /// @param *currentMode points to the current mode, so it can be changed when necessary.
 void positionModeRoutine(Mode *currentMode);
 
+/// @brief Runs the measurement loop of position mode when `FAST_POSITION_MODE` is defined.
+///
+/// Keeps the last `POSITION_BUFFER_SIZE` measurements in a circular buffer and updates the amplitude estimate every
+/// `POSITION_UPDATE_INTERVAL` ms. The trend shown on the LCD follows from an exponentially weighted slope of that estimate.
+/// @param currentMode points to the current mode, so it can be changed when necessary.
+void fastPositionModeLoop(Mode *currentMode);
+
 /// @brief Runs the procedure for depth mode.
 /// @param currentMode points to the current mode, so it can be changed when necessary.
 void depthModeRoutine(Mode *currentMode);
 
+/// @brief Runs the procedure for spectrum mode. Shows and uploads the dominant frequency of every window instead of the window.
+/// @param currentMode points to the current mode, so it can be changed when necessary.
+void spectrumModeRoutine(Mode *currentMode);
+
+/// @brief Samples `MEASUREMENT_PIN` continuously into `voltageArray` until a window aligned on the trigger is complete.
+/// The trigger fires when the voltage crosses `TRIGGER_LEVEL` in the direction of `TRIGGER_SLOPE`. It ends up at index
+/// `TRIGGER_PRE_SAMPLES`. When no trigger fires within `TRIGGER_TIMEOUT` ms, the last `numMeasurements` measurements are returned.
+/// @param voltageArray is an array of `numMeasurements` measurements, the oldest first.
+/// @param numMeasurements is the number of measurements in the window.
+/// @param loopTime is the time in milliseconds it took to do one voltage measurement.
+/// @return whether the window is aligned on a trigger.
+bool captureTriggeredWindow(float *voltageArray, unsigned int numMeasurements, float *loopTime);
+
 /// @brief Uploads all supplied data in the correct format to the API server. Also uploads LCD data.
+/// It does nothing when `Features::Acquisition` is `TriggeredAcquisition` and the last measurement did not trigger.
 /// @param currentMode is the current operating mode of the program. See `Mode`.
 /// @param voltageArray is an array containing voltages with respect to time.
-/// @param loopTime is the time in milliseconds it took to do one voltage measurement.
+/// @param loopTime is the time in milliseconds it took to do one voltage measurement. Excludes the discharge cycle, see `doMeasurement()`.
 /// @param Vmax is the maximum measured voltage.
 /// @param Vptp is the peak-to-peak voltage.
 /// @param peakWidth is the width of a peak in milliseconds.
 /// @param activatedSwitches is an integer representing the currently activated switches. See `uint8_t determineActivatedSwitches()`.
-void uploadData(int currentMode, float *voltageArray, float loopTime, float Vmax, float Vptp, float peakWidth, uint8_t activatedSwitches);
+/// @param dischargeTime is the time in milliseconds the discharge cycle before the measurement took.
+/// @param depth is the estimated depth of the cable in cm, or a negative value when there is no estimate.
+void uploadData(int currentMode, float *voltageArray, float loopTime, float Vmax, float Vptp, float peakWidth, uint8_t activatedSwitches, unsigned long dischargeTime, float depth);
+
+/// @brief Uploads the spectrum of a window to the API server, instead of the window itself. Also uploads LCD data.
+/// @param spectrum contains the magnitudes of the lowest `SPECTRUM_BINS` bins, see `computeSpectrum()`.
+/// @param peak is the largest bin of the spectrum.
+/// @param loopTime is the time between measurements of the window. (ms)
+/// @param Vptp is the peak to peak voltage of the window.
+/// @param activatedSwitches contains which switches are activated.
+void uploadSpectrum(const uint16_t *spectrum, SpectrumPeak peak, float loopTime, float Vptp, uint8_t activatedSwitches);
 
 /// @brief Does one measurement cycle. Puts the measured data in the variables specified by the pointers in the function arguments.
 /// @param voltageArray is an array containing voltages with respect to time.
-/// @param loopTime is the time in milliseconds it took to do one voltage measurement.
+/// @param loopTime is the time in milliseconds it took to do one voltage measurement. Excludes the discharge cycle, so
+/// it is the time between measurements.
 /// @param Vmax is the maximum measured voltage.
 /// @param Vmin is the minimum measured voltage.
 /// @param Vptp is the peak-to-peak voltage.
 /// @param peakWidth is the width of a peak in milliseconds.
-void doMeasurement(float *voltageArray, float *loopTime, float *Vmax, float *Vmin, float *Vptp, float *peakWidth);
+/// @param dischargeTime is the time in milliseconds the discharge cycle before the measurement took.
+void doMeasurement(float *voltageArray, float *loopTime, float *Vmax, float *Vmin, float *Vptp, float *peakWidth, unsigned long *dischargeTime);
+
+/// @brief Reads the voltage on `MEASUREMENT_PIN`.
+/// When `Features::Acquisition` is `OversampledAcquisition`, it returns the average of `ADC_OVERSAMPLING_FACTOR` conversions.
+/// @return the measured voltage in V.
+float readMeasurementVoltage();
 
 /// @brief Create a current sink on `DISCHARGE_PIN` to discharge the capacitors for a more accurate measurement.
-/// It does nothing when the `NO_DISCHARGE_CYCLE` flag is defined.
-void runDischargeCycle();
+/// It does nothing when `Features::Discharge` is `NoDischarge`.
+/// When it is `AdaptiveDischarge<...>`, `MEASUREMENT_PIN` is sampled during the discharge and the pin is released as
+/// soon as the voltage has settled below `DISCHARGE_SETTLED_THRESHOLD`.
+/// @return the time in milliseconds the discharge cycle took.
+unsigned long runDischargeCycle();
 
 /// @brief Determines which sensor switches are turned on or off.
+/// It returns the configuration of `Features::Sensors` without reading the switches if it is `FixedSensors<...>`.
 /// @return an uint8_t representing which switches are turned on.
 /// The format is as follows: 0b(uvwxy), where u-y represent the switches 1 through 5, and are 1 if they are turned on an 0 if not.
 uint8_t determineActivatedSwitches();
@@ -117,40 +312,119 @@ uint8_t determineActivatedSwitches();
 /// @return Returns whether the sensor switch at a certain position in turned on or off.
 bool isSwitchActivated(uint8_t switchPositions, int position);
 
-/// @brief Returns the mode which the mode switch is set to.
-/// It returns `Mode::POSITION` if `PERMA_MODE_POSITION` is defined.
-/// It returns `Mode::DEPTH` if `PERMA_MODE_DEPTH` is defined.
-/// If both `PERMA_MODE_POSITION` and `PERMA_MODE_DEPTH` are defined then `PERMA_MODE_DEPTH` has priority.
+/// @brief Returns the mode which the mode switch is set to, position or depth mode.
+/// It returns the locked mode without reading the switch if `Features::Modes` is `FixedMode<...>`, which is the only way
+/// to select spectrum mode.
 /// @return The mode which the mode switch is set to.
 Mode getModeSwitchState();
 
+/// @brief Adds a measurement to the live stream. Sends the frame once it is full, when the stream is connected.
+/// @param voltage is the measured voltage.
+void streamLiveMeasurement(float voltage);
+
+/// @brief Opens the live stream connection if it is closed and the last attempt was long enough ago.
+/// Connecting blocks until the server answers or the attempt times out, so it is only called where fast position mode
+/// already stops sampling to upload, never for every frame.
+void connectLiveStream();
+
+/// @brief Uploads the timing statistics of every stage of the measurement loop to the server API.
+/// See `StageStatistics`.
+void uploadProfilingData();
+
+/// @brief Asks the server whether a newer calibration is available for this device.
+/// When the server responds with a valid calibration blob it is applied and stored in EEPROM.
+/// @return whether the server responded in full, with a calibration or with `204 No Content`.
+bool checkForCalibrationUpdate();
+
+/// @brief Does the work of `BURST_CAPTURE` between measurements.
+/// Uploads the next chunk of the newest recording while it is not on the server yet, and otherwise asks the server
+/// every `BURST_POLL_INTERVAL` ms whether it wants a new burst capture. After a failed chunk it waits as long.
+/// It does nothing unless `BURST_CAPTURE` is defined, there is a flash and WiFi is connected.
+void serviceBurstCapture();
+
+/// @brief Records `MEASUREMENT_PIN` at `BURST_SAMPLE_RATE` into the flash without gaps, see `captureBurst()`.
+/// Blocks until the recording is complete. The recording is uploaded afterwards by `serviceBurstCapture()`.
+/// @param seconds is the length of the recording. (s)
+void burstCaptureRoutine(uint32_t seconds);
+
+/// @brief Uploads the next `BURST_UPLOAD_CHUNK_SIZE` bytes of `burstUpload`, starting where the server left off.
+/// Asks the server how much it already has first, so an upload interrupted by a reset or a lost connection resumes.
+/// @return whether the server has the whole recording.
+bool uploadBurstChunk();
+
+/// @brief Sends a request without a body to the API server and reads the start of the response body, see `client`.
+/// The connection is closed afterwards.
+/// @param request is the request line, e.g. "GET /api/burst HTTP/1.0".
+/// @param body is where the body is written to, terminated by a null character.
+/// @param bodySize is the size of `body`.
+/// @return whether the server responded with `200 OK`.
+bool requestText(const String &request, char *body, size_t bodySize);
+
+/// @brief Reads the rest of the response body from `client`, after `readResponseHeaders()`.
+/// @param body is where the body is written to, terminated by a null character. Anything that does not fit is dropped.
+/// @param bodySize is the size of `body`.
+/// @param startTime is the time the request was sent, see `millis()`. (ms)
+/// @param timeout is the time after `startTime` to give up. (ms)
+void readResponseBody(char *body, size_t bodySize, unsigned long startTime, unsigned long timeout);
+
+/// @brief Reads the status line and headers of an HTTP response from `client`, up to the body.
+/// @param statusLine is where the start of the status line is written to, terminated by a null character.
+/// @param statusLineSize is the size of `statusLine`.
+/// @param startTime is the time the request was sent, see `millis()`. (ms)
+/// @param timeout is the time after `startTime` to give up. (ms)
+/// @return whether all headers were read before the timeout or the connection closed.
+bool readResponseHeaders(char *statusLine, size_t statusLineSize, unsigned long startTime, unsigned long timeout);
+
+/// @brief Runs a clock sync round with the server, see clocksync.h. Replaces `clockSync` when it succeeds.
+void syncClock();
+
+/// @brief Writes the times the last window was captured to an upload, in server time.
+/// It does nothing unless `LATENCY_TRACING` is defined and the clock has been synced.
+/// @param jsonWriter is the JSON object of the upload.
+void writeCaptureTimes(JSONBufferWriter &jsonWriter);
+
+/// @brief Writes a JSON POST request to the API server.
+/// When `LATENCY_TRACING` is defined the send time is added as the `X-Send-Time` header.
+/// @param out is where to write the request to. Either the `TCPClient`, or `Serial` to log the request.
+/// @param json is the body of the request.
+void printJsonRequest(Print &out, const char *json);
+
 /// @brief Uploads what is written on the LCD to the server API.
 void uploadLCDData();
 
-/// @brief Print the strings stored in `lcdFirstLine` and `lcdSecondLine` to the connected LCD.
-/// It does nothing when the `NO_LCD` flag is defined.
+/// @brief Returns whether WiFi is connected, so data can be uploaded. Never waits for WiFi.
+/// The first time it is, the session with the server is established, retried until the server responds, and the
+/// boot timings are uploaded.
+/// When `LATENCY_TRACING` is defined it also runs the clock sync rounds, see `syncClock()`.
+bool isNetworkReady();
+
+/// @brief Records the end of a boot phase, unless it was recorded before.
+/// @param phase is the entry of `bootTimings` to record.
+void recordBootPhase(unsigned long *phase);
+
+/// @brief Uploads `bootTimings` to the server API.
+/// @return whether the server could be connected to.
+bool uploadBootTimings();
+
+/// @brief Print the lines stored in `lcdFirstLine` and `lcdSecondLine` to the connected LCD.
+/// It does nothing when `Features::Display` is `NullDisplay`.
 /// @param printFirstLine is whether to print the first line. Default: true.
 /// @param printSecondLine is whether to print the second line. Default: true.
 /// @param clear is whether to first clear the LCD before printing the lines. Default: true.
 void lcd_clear_printLines(bool printFirstLine = true, bool printSecondLine = true, bool clear = true);
 
 /// @brief Clears the LCD.
-/// It does nothing when the `NO_LCD` flag is defined.
+/// It does nothing when `Features::Display` is `NullDisplay`.
 void lcd_clear();
 
 /// @brief Sets the cursor position of the LCD.
-/// It does nothing when the `NO_LCD` flag is defined.
+/// It does nothing when `Features::Display` is `NullDisplay`.
 /// @param col Column of the cursor.
 /// @param row Row of the cursor.
 void lcd_setCursor(uint8_t col, uint8_t row);
 
 /// @brief Prints to the LCD. The position of the text on the LCD depends on the current cursor position (see `lcd_setCursor()`).
-/// It does nothing when the `NO_LCD` flag is defined.
+/// It does nothing when `Features::Display` is `NullDisplay`.
 /// @param text is the text to print to the LCD.
-void lcd_print(String text);
-
-/// @brief Writes a single byte to the LCD.
-/// It does nothing when the `NO_LCD` flag is defined.
-/// @param byte is the byte to write to the LCD.
-void lcd_write(uint8_t byte);
+void lcd_print(const char *text);
 #endif
\ No newline at end of file
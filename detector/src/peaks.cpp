@@ -0,0 +1,121 @@
+#include "peaks.h"
+
+void resetPeakDetector(PeakDetector *detector)
+{
+    detector->startPeak = 0;
+    detector->peakBase = 0;
+    detector->peakSummit = 0;
+    detector->peakPassed = false;
+    detector->stopPeak = 0;
+
+    detector->totalPeakTime = 0;
+    detector->totalVptp = 0;
+    detector->countedPeaks = 0;
+}
+
+void addPeakMeasurement(PeakDetector *detector, const float *voltageArray, size_t index, float measurement, unsigned long sampleTime)
+{
+    // ### Peak detection, version 2. Works well enough.
+    // Peak detection doesn't work when can't look back far enough, so skip it.
+    if (index < PEAK_DETECTION_BACKSEARCH)
+    {
+        return;
+    }
+
+    // Check if there is a rising trend in voltage.
+    if (measurement > voltageArray[index - PEAK_DETECTION_BACKSEARCH] + PEAK_MEASUREMENT_THRESHOLD)
+    {
+        // If a peak has already been passen but we're measuring an upwards trend,
+        // then something has gone wrong. So we reset.
+        if (detector->peakPassed)
+        {
+            detector->peakPassed = false;
+            detector->startPeak = 0;
+        }
+
+        // If we haven't measured a rising voltage before, anticipate that a peak
+        // is coming and start the timer.
+        if (!detector->startPeak)
+        {
+            detector->startPeak = sampleTime;
+
+            // Set the lower threshold that defines the base of the peak.
+            detector->peakBase = voltageArray[index - PEAK_DETECTION_BACKSEARCH];
+        }
+    }
+
+    // If we're measuring a peak, save the highest value we're finding.
+    if (measurement > detector->peakSummit && detector->startPeak)
+    {
+        detector->peakSummit = measurement;
+    }
+
+    /* Old way of doing it
+    // Check is there is a falling trend in voltage and if we had already anticipated
+    // there to be a peak coming.
+    // if (measurement < voltageArray[index - PEAK_DETECTION_BACKSEARCH] - PEAK_MEASUREMENT_THRESHOLD && startPeak)
+    */
+    // Check if the current measurement is lower than half the current measured max
+    // peak height.
+    if (measurement < detector->peakBase + 0.5 * (detector->peakSummit - detector->peakBase))
+    {
+        // We anticipated a peak and measure a falling voltage, so we must have passed
+        // the peak. So set the corresponding variable to true.
+        detector->peakPassed = true;
+    }
+
+    // If a peak has been passed and the foot of the peak is reached, we stop the timer.
+    if (measurement < detector->peakBase && detector->peakPassed)
+    {
+        detector->stopPeak = sampleTime;
+    }
+
+    // Save the timing result if we have a starting time and a stopping time of a peak.
+    if (detector->startPeak && detector->stopPeak)
+    {
+        detector->totalPeakTime += detector->stopPeak - detector->startPeak;
+        detector->totalVptp += detector->peakSummit - detector->peakBase;
+        detector->countedPeaks++;
+
+        detector->startPeak = 0;
+        detector->stopPeak = 0;
+        detector->peakPassed = false;
+        detector->peakBase = 0;
+        detector->peakSummit = 0;
+    }
+}
+
+void analyzeWindow(const float *voltageArray, size_t numMeasurements, float loopTime, WindowStatistics *statistics)
+{
+    float minMeasurement = 3.5;
+    float maxMeasurement = 0;
+
+    PeakDetector detector;
+    resetPeakDetector(&detector);
+
+    for (size_t i = 0; i < numMeasurements; i++)
+    {
+        float currentMeasurement = voltageArray[i];
+        // Start at 1 ms, as a start time of 0 means that no peak has started.
+        unsigned long sampleTime = 1 + (unsigned long)(i * loopTime);
+
+        if (currentMeasurement > maxMeasurement)
+        {
+            maxMeasurement = currentMeasurement;
+        }
+
+        if (currentMeasurement < minMeasurement)
+        {
+            minMeasurement = currentMeasurement;
+        }
+
+        addPeakMeasurement(&detector, voltageArray, i, currentMeasurement, sampleTime);
+    }
+
+    statistics->Vmax = maxMeasurement;
+    statistics->Vmin = minMeasurement;
+    statistics->Vptp = maxMeasurement - minMeasurement;
+    statistics->countedPeaks = detector.countedPeaks;
+    // Prevent division by zero.
+    statistics->peakWidth = detector.countedPeaks ? (float)detector.totalPeakTime / (float)detector.countedPeaks : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef _PEAKS_H_
+#define _PEAKS_H_
+
+#include <stddef.h>
+
+// Peak detection over a window of measurements, shared by `doMeasurement()` and the server's native extension
+// (server/native), which reprocesses stored windows with the same code. See `analyzeWindow()` for where the results of
+// the two can still differ.
+
+// Defines how much the voltage should change before a peak is detected. (V)
+#define PEAK_MEASUREMENT_THRESHOLD 0.05
+// Defines how far back should be searched to see if a rise in voltage is happening.
+#define PEAK_DETECTION_BACKSEARCH 5
+
+// State of the peak detection while a window is being measured.
+struct PeakDetector
+{
+    // Time the current peak started, or 0 when no peak has started. (ms)
+    unsigned long startPeak;
+    float peakBase;
+    float peakSummit;
+    bool peakPassed;
+    unsigned long stopPeak;
+
+    unsigned long totalPeakTime;
+    float totalVptp;
+    int countedPeaks;
+};
+
+// Statistics of a whole window, see `analyzeWindow()`.
+struct WindowStatistics
+{
+    float Vmax;
+    float Vmin;
+    float Vptp;
+    // Average width of the peaks, or 0 when no peak was found. (ms)
+    float peakWidth;
+    int countedPeaks;
+};
+
+/// @brief Prepares a peak detector for a new window.
+/// @param detector is the peak detector to reset.
+void resetPeakDetector(PeakDetector *detector);
+
+/// @brief Adds a measurement of the window to the peak detection. Measurements must be added in order.
+/// @param detector is the peak detector to add the measurement to.
+/// @param voltageArray is the window measured so far. It is looked `PEAK_DETECTION_BACKSEARCH` measurements back into.
+/// @param index is the index of the measurement in the window.
+/// @param measurement is the measurement, which may have more precision than what is stored in `voltageArray`. (V)
+/// @param sampleTime is the time the measurement was taken. Must not be 0. (ms)
+void addPeakMeasurement(PeakDetector *detector, const float *voltageArray, size_t index, float measurement, unsigned long sampleTime);
+
+/// @brief Runs the statistics of `doMeasurement()` over a window that has already been measured.
+/// The measurements are timed like a captured window: measurement i at `i * loopTime`, rounded down to whole ms.
+/// On a window that was uploaded rather than captured this differs from `doMeasurement()` in two ways:
+///     - `doMeasurement()` uses the measurements before they are rounded for the upload, to 0.01 V or to the scale of the
+///       compressed upload. So Vmax and Vmin can differ by up to half a step and Vptp by up to a step, and a peak that
+///       only just crosses `PEAK_MEASUREMENT_THRESHOLD` can be counted by one and not by the other.
+///     - Unless the window was captured before it was analysed, `doMeasurement()` times every measurement with `millis()`,
+///       so a peak width can differ by the jitter of the loop, about 1 ms. Captured windows are timed the same.
+/// Depth mode does not compute the depth from this Vptp directly but from the median of the last windows, see filter.h.
+/// @param voltageArray is the window.
+/// @param numMeasurements is the number of measurements in the window.
+/// @param loopTime is the time between measurements. (ms)
+/// @param statistics is where the statistics are written to.
+void analyzeWindow(const float *voltageArray, size_t numMeasurements, float loopTime, WindowStatistics *statistics);
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef _POLICIES_H_
+#define _POLICIES_H_
+
+// Policies that select the features the firmware is compiled with. See `DetectorFeatures` and the `Features` typedef
+// in main.cpp. Every policy of a kind has the same static interface, so the code using it does not need to know which
+// one is selected. A disabled policy has `enabled` set to false and empty inline functions, so calls to it and any
+// code behind `if (Features::<Policy>::enabled)` are removed by the compiler.
+//
+// Needs `Mode`, `LCD_ADDRESS` and the ADC parameters, so include it after main.h.
+
+#include "Particle.h"
+#include "LiquidCrystal_I2C_Spark.h"
+
+// LCD class for interfacing with the LCD. Defined in main.cpp.
+extern LiquidCrystal_I2C *lcd;
+
+// ####################
+// # Display policies #
+// ####################
+
+// Prints to the 16x2 LCD on the I2C bus.
+struct LcdDisplay
+{
+    static const bool enabled = true;
+
+    static void begin()
+    {
+        lcd = new LiquidCrystal_I2C(LCD_ADDRESS, 16, 2);
+        lcd->init();
+        lcd->backlight();
+
+        // Register the ``≈`` character at address 0.
+        byte approximatelyChar[] = {
+            0B00000,
+            0B01000,
+            0B10101,
+            0B00010,
+            0B01000,
+            0B10101,
+            0B00010,
+            0B00000};
+        lcd->createChar(0, approximatelyChar);
+    }
+    static void clear() { lcd->clear(); }
+    static void setCursor(uint8_t col, uint8_t row) { lcd->setCursor(col, row); }
+    static void print(const char *text) { lcd->print(text); }
+};
+
+// Discards everything, for running without an LCD.
+struct NullDisplay
+{
+    static const bool enabled = false;
+
+    static void begin() {}
+    static void clear() {}
+    static void setCursor(uint8_t col, uint8_t row) {}
+    static void print(const char *text) {}
+};
+
+// #################
+// # Mode policies #
+// #################
+
+// Follows the mode switch.
+struct SwitchedMode
+{
+    static const bool fixed = false;
+    static const Mode mode = Mode::POSITION;
+};
+
+// Locks the operating mode to `M`, without reading the mode switch.
+template <Mode M>
+struct FixedMode
+{
+    static const bool fixed = true;
+    static const Mode mode = M;
+};
+
+// ###################
+// # Sensor policies #
+// ###################
+
+// Reads the sensor switches.
+struct SwitchedSensors
+{
+    static const bool fixed = false;
+    static const uint8_t switches = 0b00000;
+};
+
+// Assumes the sensors in `S` are turned on, without reading the sensor switches. See `determineActivatedSwitches()` for the format.
+template <uint8_t S>
+struct FixedSensors
+{
+    static const bool fixed = true;
+    static const uint8_t switches = S;
+};
+
+// ######################
+// # Discharge policies #
+// ######################
+
+// Discharges the capacitors through `DISCHARGE_PIN` for a fixed time before every measurement. See `runDischargeCycle()`.
+struct PulldownDischarge
+{
+    static const bool enabled = true;
+    static const bool adaptive = false;
+    static const bool skipUnsaturated = false;
+};
+
+// Discharges the capacitors until the measured voltage has settled below `DISCHARGE_SETTLED_THRESHOLD`, instead of for
+// a fixed time. With `SkipUnsaturated`, no discharge is done after a measurement that did not reach
+// `DISCHARGE_SATURATION_VOLTAGE`, as the capacitors did not charge up far enough to distort the next one.
+template <bool SkipUnsaturated>
+struct AdaptiveDischarge
+{
+    static const bool enabled = true;
+    static const bool adaptive = true;
+    static const bool skipUnsaturated = SkipUnsaturated;
+};
+
+// Measures without discharging the capacitors first.
+struct NoDischarge
+{
+    static const bool enabled = false;
+    static const bool adaptive = false;
+    static const bool skipUnsaturated = false;
+};
+
+// ########################
+// # Acquisition policies #
+// ########################
+
+// Takes every measurement with one `analogRead()` while the window is analysed, rounded to 0.01 V.
+struct SingleAcquisition
+{
+    // Whether the whole window is captured before it is analysed, see `doMeasurement()`.
+    static const bool captureFirst = false;
+    static const bool interleaved = false;
+    static const bool triggered = false;
+    // Number of conversions averaged into one measurement.
+    static const int oversampling = 1;
+    // Number of decimals of the uploaded voltages, and the scale of the compressed voltages that keeps them all.
+    static const int voltageDecimals = 2;
+    static const int voltageScale = 100;
+
+    static void begin() {}
+};
+
+// Averages `ADC_OVERSAMPLING_FACTOR` shorter conversions per measurement and keeps the extra resolution up to the server.
+struct OversampledAcquisition
+{
+    static const bool captureFirst = false;
+    static const bool interleaved = false;
+    static const bool triggered = false;
+    static const int oversampling = ADC_OVERSAMPLING_FACTOR;
+    // Oversampled measurements resolve well below 10 mV.
+    static const int voltageDecimals = 4;
+    static const int voltageScale = 10000;
+
+    static void begin()
+    {
+        // Shorten every conversion, so the oversampled window takes about as long as a normal one.
+        setADCSampleTime(ADC_OVERSAMPLING_SAMPLE_TIME);
+    }
+};
+
+// Samples every window at `INTERLEAVED_SAMPLE_RATE` with two ADCs taking turns, before it is analysed. See interleaved.h.
+struct InterleavedAcquisition
+{
+    static const bool captureFirst = true;
+    static const bool interleaved = true;
+    static const bool triggered = false;
+    static const int oversampling = 1;
+    static const int voltageDecimals = 2;
+    static const int voltageScale = 100;
+
+    static void begin() {}
+};
+
+// Captures windows aligned on a trigger on the measured voltage, like an oscilloscope, and skips uploads without a
+// trigger. See `captureTriggeredWindow()`.
+struct TriggeredAcquisition
+{
+    static const bool captureFirst = true;
+    static const bool interleaved = false;
+    static const bool triggered = true;
+    static const int oversampling = 1;
+    static const int voltageDecimals = 2;
+    static const int voltageScale = 100;
+
+    static void begin() {}
+};
+
+// ###################
+// # Upload policies #
+// ###################
+
+// Uploads the window as decimal text.
+struct TextUpload
+{
+    static const bool compressed = false;
+};
+
+// Uploads the window losslessly compressed, see codec.h. Windows too noisy for `COMPRESSED_UPLOAD_BUFFER_SIZE` are
+// uploaded as text.
+struct CompressedUpload
+{
+    static const bool compressed = true;
+};
+
+// ########################
+// # Request log policies #
+// ########################
+
+// Logs every HTTP request made to the API server on Serial.
+struct SerialRequestLog
+{
+    static const bool enabled = true;
+};
+
+// Does not log HTTP requests.
+struct NullRequestLog
+{
+    static const bool enabled = false;
+};
+
+// #####################
+// # Feature selection #
+// #####################
+
+/// @brief Bundles one policy of every kind.
+/// @tparam DisplayPolicy is `LcdDisplay` or `NullDisplay`.
+/// @tparam ModePolicy is `SwitchedMode` or `FixedMode<...>`.
+/// @tparam SensorPolicy is `SwitchedSensors` or `FixedSensors<...>`.
+/// @tparam DischargePolicy is `PulldownDischarge`, `AdaptiveDischarge<...>` or `NoDischarge`.
+/// @tparam AcquisitionPolicy is `SingleAcquisition`, `OversampledAcquisition`, `InterleavedAcquisition` or `TriggeredAcquisition`.
+/// @tparam UploadPolicy is `TextUpload` or `CompressedUpload`.
+/// @tparam RequestLogPolicy is `SerialRequestLog` or `NullRequestLog`.
+template <class DisplayPolicy, class ModePolicy, class SensorPolicy, class DischargePolicy, class AcquisitionPolicy, class UploadPolicy, class RequestLogPolicy>
+struct DetectorFeatures
+{
+    typedef DisplayPolicy Display;
+    typedef ModePolicy Modes;
+    typedef SensorPolicy Sensors;
+    typedef DischargePolicy Discharge;
+    typedef AcquisitionPolicy Acquisition;
+    typedef UploadPolicy Upload;
+    typedef RequestLogPolicy RequestLog;
+};
+
+#endif
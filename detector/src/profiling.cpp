@@ -0,0 +1,184 @@
+#ifdef PLATFORM_ID
+#include "Particle.h"
+#else
+#include <algorithm>
+#include <chrono>
+#include <malloc.h>
+#include <pthread.h>
+#include <string.h>
+#endif
+#include "profiling.h"
+
+StageStatistics stageStatistics[(int)Stage::COUNT];
+
+// Lowest address and size of the painted stack region, see `paintStack()`.
+volatile uint8_t *stackPaintBottom = NULL;
+uint32_t stackPaintSize = 0;
+
+const char *stageNames[] = {"acquisition", "peakDetection", "calibration", "lcd", "json", "tcpConnect", "tcpSend", "discharge"};
+
+const char *getStageName(Stage stage)
+{
+    return stageNames[(int)stage];
+}
+
+#ifdef PLATFORM_ID
+
+uint32_t getProfilingTicks()
+{
+    // Reads the DWT cycle counter.
+    return System.ticks();
+}
+
+uint32_t getProfilingTicksPerMicrosecond()
+{
+    return System.ticksPerMicrosecond();
+}
+
+#else
+
+uint32_t getProfilingTicks()
+{
+    return (uint32_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() / PROFILING_HOST_TICK_TIME);
+}
+
+uint32_t getProfilingTicksPerMicrosecond()
+{
+    return 1000 / PROFILING_HOST_TICK_TIME;
+}
+
+#endif
+
+void recordStage(Stage stage, uint32_t startTicks)
+{
+    // Unsigned subtraction also handles the counter wrapping around.
+    recordStageTicks(stage, getProfilingTicks() - startTicks);
+}
+
+void recordStageTicks(Stage stage, uint32_t ticks)
+{
+    StageStatistics *statistics = &stageStatistics[(int)stage];
+    uint32_t time = ticks / getProfilingTicksPerMicrosecond();
+
+    if (statistics->count == 0 || time < statistics->minTime)
+    {
+        statistics->minTime = time;
+    }
+    if (time > statistics->maxTime)
+    {
+        statistics->maxTime = time;
+    }
+    statistics->totalTime += time;
+    statistics->count++;
+
+    // Find the logarithmic bin of this duration.
+    int bin = 0;
+    while (time > 1 && bin < PROFILING_HISTOGRAM_BINS - 1)
+    {
+        time >>= 1;
+        bin++;
+    }
+    statistics->histogram[bin]++;
+}
+
+void resetStageStatistics()
+{
+    memset(stageStatistics, 0, sizeof(stageStatistics));
+}
+
+/// @brief Returns the number of bytes of the painted region that the stack has grown into.
+static uint32_t getStackUsed()
+{
+    // The stack grows down, so count the untouched bytes from the bottom of the painted region.
+    uint32_t untouched = 0;
+    while (untouched < stackPaintSize && stackPaintBottom[untouched] == STACK_PAINT_PATTERN)
+    {
+        untouched++;
+    }
+    return stackPaintSize - untouched;
+}
+
+/// @brief Paints `size` bytes below `top`, see `paintStack()`.
+static void paintStackRegion(volatile uint8_t *top, uint32_t size)
+{
+    stackPaintBottom = top - size;
+    stackPaintSize = size;
+    for (volatile uint8_t *address = stackPaintBottom; address < top; address++)
+    {
+        *address = STACK_PAINT_PATTERN;
+    }
+}
+
+#ifdef PLATFORM_ID
+
+__attribute__((noinline)) void paintStack()
+{
+    // Device OS does not tell the application where the stack of its thread ends, so this relies on the frames above
+    // `setup()` leaving enough of it, see `STACK_PAINT_SIZE`.
+    volatile uint8_t marker = 0;
+    paintStackRegion((volatile uint8_t *)((uintptr_t)&marker - STACK_PAINT_MARGIN), STACK_PAINT_SIZE);
+}
+
+void getMemoryStatistics(MemoryStatistics *statistics)
+{
+    // Before the statistics of the heap, so the stack they need is not counted.
+    statistics->stackUsed = getStackUsed();
+    runtime_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.size = sizeof(info);
+    HAL_Core_Runtime_Info(&info, NULL);
+
+    statistics->freeHeap = info.freeheap;
+    statistics->maxUsedHeap = info.max_used_heap;
+    statistics->largestFreeBlock = info.largest_free_block_heap;
+}
+
+#else
+
+// Most heap in use seen by `getMemoryStatistics()`, as the host allocator does not keep it.
+static uint32_t maxUsedHeap = 0;
+// Most stack used seen by `getMemoryStatistics()`, as it paints over what `mallinfo2()` used.
+static uint32_t maxStackUsed = 0;
+
+__attribute__((noinline)) void paintStack()
+{
+    volatile uint8_t marker = 0;
+    volatile uint8_t *top = (volatile uint8_t *)((uintptr_t)&marker - STACK_PAINT_MARGIN);
+
+    // Stop a page above the real end of the stack of the thread, in case it is smaller than what is painted.
+    pthread_attr_t attributes;
+    void *stackEnd = NULL;
+    size_t stackSize = 0;
+    uint32_t size = STACK_PAINT_HOST_SIZE;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+    {
+        pthread_attr_getstack(&attributes, &stackEnd, &stackSize);
+        pthread_attr_destroy(&attributes);
+        uintptr_t available = (uintptr_t)top - (uintptr_t)stackEnd;
+        size = available > STACK_PAINT_HOST_SIZE + 4096 ? STACK_PAINT_HOST_SIZE : (available > 4096 ? available - 4096 : 0);
+    }
+    paintStackRegion(top, size);
+}
+
+void getMemoryStatistics(MemoryStatistics *statistics)
+{
+    maxStackUsed = std::max(maxStackUsed, getStackUsed());
+    struct mallinfo2 info = mallinfo2();
+    maxUsedHeap = std::max(maxUsedHeap, (uint32_t)info.uordblks);
+
+    // `mallinfo2()` alone needs most of the painted region, so paint it again below this frame.
+    volatile uint8_t marker = 0;
+    uintptr_t limit = (uintptr_t)&marker - STACK_PAINT_MARGIN;
+    for (volatile uint8_t *address = stackPaintBottom; address < stackPaintBottom + stackPaintSize && (uintptr_t)address < limit; address++)
+    {
+        *address = STACK_PAINT_PATTERN;
+    }
+
+    statistics->freeHeap = info.fordblks;
+    statistics->maxUsedHeap = maxUsedHeap;
+    // Not known to the host allocator. All free memory is an upper bound.
+    statistics->largestFreeBlock = info.fordblks;
+    statistics->stackUsed = maxStackUsed;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef _PROFILING_H_
+#define _PROFILING_H_
+
+#include <stdint.h>
+
+// Number of bins in the histogram of a stage.
+// Bin i counts durations in [2^i, 2^(i+1)) µs, the last bin also counts everything longer.
+#define PROFILING_HISTOGRAM_BINS 21
+
+// Stages of the measurement loop that are timed.
+enum class Stage
+{
+    ACQUISITION = 0,
+    PEAK_DETECTION,
+    CALIBRATION,
+    LCD,
+    JSON,
+    TCP_CONNECT,
+    TCP_SEND,
+    DISCHARGE,
+    COUNT
+};
+
+// Time of a tick of the host clock that replaces the cycle counter off the device. Like the 120 MHz cycle counter it
+// wraps around after about 40 s, longer than any stage. (ns)
+#define PROFILING_HOST_TICK_TIME 10
+
+// Number of bytes below the stack frame of `paintStack()` that are painted to measure stack usage.
+// The application thread of the Photon has a 6 KB stack, of which `setup()` and its callers use the top. Device OS does
+// not expose where it ends, so together with `STACK_PAINT_MARGIN` this leaves them 2.75 KB to stay clear of the end.
+// The window of the mode routines is global (see `windowBuffer` in main.cpp), so they fit in what is painted.
+// A reported usage equal to this size means the stack has grown at least this deep.
+#define STACK_PAINT_SIZE 3072
+// Number of bytes painted on host instead, limited to the real stack of the thread. The C library of the host alone
+// needs about 3 KB of stack to grow a string.
+#define STACK_PAINT_HOST_SIZE 16384
+// Number of bytes right below the stack frame of `paintStack()` that are left alone, for the frames of the functions it
+// calls and the red zone below the frame on hosts that have one.
+#define STACK_PAINT_MARGIN 256
+// Pattern written to the painted stack region.
+#define STACK_PAINT_PATTERN 0xA5
+
+// Timing statistics of a single stage. All times are in µs.
+struct StageStatistics
+{
+    uint32_t count;
+    uint32_t minTime;
+    uint32_t maxTime;
+    uint64_t totalTime;
+    uint32_t histogram[PROFILING_HISTOGRAM_BINS];
+};
+
+// Memory usage of the device. All sizes are in bytes.
+struct MemoryStatistics
+{
+    uint32_t freeHeap;
+    uint32_t maxUsedHeap;
+    uint32_t largestFreeBlock;
+    uint32_t stackUsed;
+};
+
+/// @brief Returns the name of a stage as used in the uploaded data.
+/// @param stage is the stage to return the name of.
+/// @return the name of the stage.
+const char *getStageName(Stage stage);
+
+/// @brief Returns the current time in ticks, to time a stage with.
+/// On the device this is the cycle counter, see `System.ticks()`. Elsewhere it is the steady clock of the host in ticks of
+/// `PROFILING_HOST_TICK_TIME` ns, so the simulators can be profiled the same way.
+uint32_t getProfilingTicks();
+
+/// @brief Returns the number of ticks of `getProfilingTicks()` in a µs.
+uint32_t getProfilingTicksPerMicrosecond();
+
+/// @brief Records one run of a stage that started at `startTicks`, and ends now.
+/// @param stage is the stage that was run.
+/// @param startTicks is the value of `getProfilingTicks()` at the start of the stage.
+void recordStage(Stage stage, uint32_t startTicks);
+
+/// @brief Records one run of a stage that took `ticks` CPU cycles.
+/// @param stage is the stage that was run.
+/// @param ticks is the number of CPU cycles the stage took.
+void recordStageTicks(Stage stage, uint32_t ticks);
+
+/// @brief Clears the statistics of all stages.
+void resetStageStatistics();
+
+/// @brief Fills the unused part of the stack with `STACK_PAINT_PATTERN`, so `getMemoryStatistics()` can determine how deep
+/// the stack has grown since. Should be called once, at the start of `setup()`.
+void paintStack();
+
+/// @brief Determines the current memory usage of the device.
+/// @param statistics is where the memory usage is stored.
+void getMemoryStatistics(MemoryStatistics *statistics);
+
+extern StageStatistics stageStatistics[(int)Stage::COUNT];
+
+#endif
@@ -0,0 +1,218 @@
+#include "spectrum.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Number of points of the complex FFT the real FFT is computed with.
+#define FFT_COMPLEX_SIZE (FFT_SIZE / 2)
+
+// First quarter of a sine period in `FFT_SIZE` steps, in Q15. Filled on first use.
+static int16_t sineTable[FFT_SIZE / 4 + 1];
+static bool sineTableFilled = false;
+
+static void fillSineTable()
+{
+    for (unsigned int i = 0; i <= FFT_SIZE / 4; i++)
+    {
+        sineTable[i] = (int16_t)lroundf(32767 * sinf(2 * (float)M_PI * i / FFT_SIZE));
+    }
+    sineTableFilled = true;
+}
+
+/// @brief Returns sin(2 pi `k` / `FFT_SIZE`) in Q15.
+static int32_t lookupSine(unsigned int k)
+{
+    const unsigned int quarter = FFT_SIZE / 4;
+    k &= FFT_SIZE - 1;
+    if (k < quarter)
+    {
+        return sineTable[k];
+    }
+    else if (k < 2 * quarter)
+    {
+        return sineTable[2 * quarter - k];
+    }
+    else if (k < 3 * quarter)
+    {
+        return -sineTable[k - 2 * quarter];
+    }
+    return -sineTable[4 * quarter - k];
+}
+
+/// @brief Returns cos(2 pi `k` / `FFT_SIZE`) in Q15.
+static int32_t lookupCosine(unsigned int k)
+{
+    return lookupSine(k + FFT_SIZE / 4);
+}
+
+/// @brief Multiplies by a Q15 factor, rounding to nearest.
+static int32_t multiplyQ15(int32_t value, int32_t factor)
+{
+    return (value * factor + 0x4000) >> 15;
+}
+
+/// @brief Returns the integer square root of `value`, rounded down.
+static uint32_t squareRoot(uint32_t value)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+    while (bit)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+/// @brief Converts the window to samples, removes the mean, applies a Hann window and zero pads it to `FFT_SIZE`.
+static void prepareSamples(SpectrumBuffer *buffer, unsigned int numMeasurements)
+{
+    // Sample i only overwrites bytes of voltages up to i / 2, which have been read already.
+    int32_t sum = 0;
+    for (unsigned int i = 0; i < numMeasurements; i++)
+    {
+        int16_t sample = (int16_t)lroundf(buffer->voltages[i] * SPECTRUM_INPUT_SCALE);
+        buffer->samples[i] = sample;
+        sum += sample;
+    }
+    int32_t mean = sum / (int32_t)numMeasurements;
+
+    for (unsigned int i = 0; i < numMeasurements; i++)
+    {
+        // The window is looked up at the nearest step of the sine table.
+        unsigned int k = (i * FFT_SIZE + (numMeasurements - 1) / 2) / (numMeasurements - 1);
+        int32_t window = (32767 - lookupCosine(k)) >> 1;
+        buffer->samples[i] = (int16_t)multiplyQ15(buffer->samples[i] - mean, window);
+    }
+    for (unsigned int i = numMeasurements; i < FFT_SIZE; i++)
+    {
+        buffer->samples[i] = 0;
+    }
+}
+
+/// @brief Transforms `FFT_COMPLEX_SIZE` interleaved complex samples in place with a radix-2 decimation in time FFT.
+static void transformComplex(int16_t *data)
+{
+    // Bit reversed reordering.
+    for (unsigned int i = 1, j = 0; i < FFT_COMPLEX_SIZE; i++)
+    {
+        unsigned int bit = FFT_COMPLEX_SIZE >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j)
+        {
+            int16_t real = data[2 * i];
+            int16_t imaginary = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = real;
+            data[2 * j + 1] = imaginary;
+        }
+    }
+
+    for (unsigned int size = 2; size <= FFT_COMPLEX_SIZE; size <<= 1)
+    {
+        unsigned int half = size >> 1;
+        unsigned int twiddleStep = FFT_SIZE / size;
+        for (unsigned int k = 0; k < half; k++)
+        {
+            int32_t twiddleReal = lookupCosine(k * twiddleStep);
+            int32_t twiddleImaginary = -lookupSine(k * twiddleStep);
+            for (unsigned int i = k; i < FFT_COMPLEX_SIZE; i += size)
+            {
+                int16_t *a = &data[2 * i];
+                int16_t *b = &data[2 * (i + half)];
+                int32_t productReal = multiplyQ15(b[0], twiddleReal) - multiplyQ15(b[1], twiddleImaginary);
+                int32_t productImaginary = multiplyQ15(b[0], twiddleImaginary) + multiplyQ15(b[1], twiddleReal);
+                b[0] = (int16_t)((a[0] - productReal) >> 1);
+                b[1] = (int16_t)((a[1] - productImaginary) >> 1);
+                a[0] = (int16_t)((a[0] + productReal) >> 1);
+                a[1] = (int16_t)((a[1] + productImaginary) >> 1);
+            }
+        }
+    }
+}
+
+/// @brief Returns the magnitude of bin `k` of the real window, from the complex FFT of its even and odd samples.
+static uint16_t getRealMagnitude(const int16_t *data, unsigned int k)
+{
+    if (k == 0)
+    {
+        return (uint16_t)abs(data[0] + data[1]);
+    }
+
+    // Z[k] and the conjugate of Z[N/2 - k] give the spectra of the even samples (E) and odd samples (O).
+    int32_t real = data[2 * k];
+    int32_t imaginary = data[2 * k + 1];
+    int32_t mirrorReal = data[2 * (FFT_COMPLEX_SIZE - k)];
+    int32_t mirrorImaginary = -data[2 * (FFT_COMPLEX_SIZE - k) + 1];
+
+    int32_t evenReal = (real + mirrorReal) >> 1;
+    int32_t evenImaginary = (imaginary + mirrorImaginary) >> 1;
+    // O = (Z[k] - conj(Z[N/2 - k])) / 2i
+    int32_t oddReal = (imaginary - mirrorImaginary) >> 1;
+    int32_t oddImaginary = (mirrorReal - real) >> 1;
+
+    // X[k] = E + exp(-2 pi i k / N) O
+    int32_t twiddleReal = lookupCosine(k);
+    int32_t twiddleImaginary = -lookupSine(k);
+    int32_t binReal = evenReal + multiplyQ15(oddReal, twiddleReal) - multiplyQ15(oddImaginary, twiddleImaginary);
+    int32_t binImaginary = evenImaginary + multiplyQ15(oddReal, twiddleImaginary) + multiplyQ15(oddImaginary, twiddleReal);
+
+    // A bin is at most the sum of the samples divided by N/2, so the squares fit comfortably in 32 bits.
+    uint32_t magnitude = squareRoot((uint32_t)(binReal * binReal) + (uint32_t)(binImaginary * binImaginary));
+    return (uint16_t)(magnitude > 65535 ? 65535 : magnitude);
+}
+
+void computeSpectrum(SpectrumBuffer *buffer, unsigned int numMeasurements, uint16_t *spectrum, SpectrumPeak *peak)
+{
+    if (!sineTableFilled)
+    {
+        fillSineTable();
+    }
+
+    prepareSamples(buffer, numMeasurements);
+    transformComplex(buffer->samples);
+
+    peak->bin = 0;
+    peak->magnitude = 0;
+    for (unsigned int k = 0; k < FFT_COMPLEX_SIZE; k++)
+    {
+        uint16_t magnitude = getRealMagnitude(buffer->samples, k);
+        if (k < SPECTRUM_BINS)
+        {
+            spectrum[k] = magnitude;
+        }
+        if (k > 0 && magnitude > peak->magnitude)
+        {
+            peak->bin = k;
+            peak->magnitude = magnitude;
+        }
+    }
+}
+
+float getSpectrumScale(unsigned int numMeasurements)
+{
+    // A sine wave of amplitude A gives a DFT bin of A / 2 times the sum of the Hann window, (n - 1) / 2.
+    return 2.0 * FFT_SIZE / ((numMeasurements - 1) * (float)SPECTRUM_INPUT_SCALE);
+}
+
+float getBinFrequency(unsigned int bin, float loopTime)
+{
+    return bin * 1000.0 / (loopTime * FFT_SIZE);
+}
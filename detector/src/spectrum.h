@@ -0,0 +1,52 @@
+#ifndef _SPECTRUM_H_
+#define _SPECTRUM_H_
+
+#include <stdint.h>
+
+// Fixed-point magnitude spectrum of a window of measurements, see `computeSpectrum()`.
+//
+// The window is converted to 16 bit samples in place, has its mean removed and a Hann window applied, and is zero padded
+// to `FFT_SIZE` samples. Those are transformed as a complex FFT of `FFT_SIZE` / 2 points (even samples as the real part,
+// odd samples as the imaginary part) and split into the spectrum of the real window afterwards. Every butterfly stage
+// halves its results so nothing overflows, which makes the magnitudes 2 / `FFT_SIZE` of those of an unscaled DFT.
+
+// Number of points of the real FFT. Must be a power of 2 and at least the number of measurements in a window.
+#define FFT_SIZE 1024
+// Number of lowest frequency bins uploaded in spectrum mode.
+#define SPECTRUM_BINS 128
+// Conversion of voltages to samples. Deviations from the mean of up to 3.3 V must stay within 32767 / sqrt(2). (1/V)
+#define SPECTRUM_INPUT_SCALE 6000
+
+// Window of measurements that is transformed in place, so spectrum mode needs no memory besides the measurement buffer.
+union SpectrumBuffer
+{
+    float voltages[1000];
+    int16_t samples[FFT_SIZE];
+};
+
+// Largest bin of a spectrum.
+struct SpectrumPeak
+{
+    uint16_t bin;
+    uint16_t magnitude;
+};
+
+/// @brief Computes the magnitude spectrum of a window of measurements.
+/// @param buffer holds the window in `voltages`. It is overwritten by the transform.
+/// @param numMeasurements is the number of measurements in the window, at most `FFT_SIZE`.
+/// @param spectrum is where the magnitudes of the lowest `SPECTRUM_BINS` bins are written to. See `getSpectrumScale()`.
+/// @param peak is where the largest bin above DC of the whole spectrum is written to.
+void computeSpectrum(SpectrumBuffer *buffer, unsigned int numMeasurements, uint16_t *spectrum, SpectrumPeak *peak);
+
+/// @brief Returns the amplitude of a sine wave in the middle of a bin with a magnitude of 1.
+/// @param numMeasurements is the number of measurements the spectrum was computed of.
+/// @return the amplitude. (V)
+float getSpectrumScale(unsigned int numMeasurements);
+
+/// @brief Returns the frequency of a bin.
+/// @param bin is the index of the bin.
+/// @param loopTime is the time between measurements. (ms)
+/// @return the frequency. (Hz)
+float getBinFrequency(unsigned int bin, float loopTime);
+
+#endif
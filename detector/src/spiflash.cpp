@@ -0,0 +1,147 @@
+#include "spiflash.h"
+
+#ifdef PLATFORM_ID
+
+#include "Particle.h"
+
+// Commands of the W25Q series, which most SPI NOR flash chips share.
+#define COMMAND_WRITE_ENABLE 0x06
+#define COMMAND_READ_STATUS 0x05
+#define COMMAND_READ_DATA 0x03
+#define COMMAND_PAGE_PROGRAM 0x02
+#define COMMAND_BLOCK_ERASE 0xD8
+#define COMMAND_JEDEC_ID 0x9F
+#define COMMAND_RELEASE_POWER_DOWN 0xAB
+// Set in the status register while a program or erase is in progress.
+#define STATUS_BUSY 0x01
+
+/// @brief Selects the flash and sends a command with a 24 bit address.
+static void beginCommand(uint8_t command, uint32_t address)
+{
+    digitalWrite(SPI_FLASH_CS_PIN, LOW);
+    SPI.transfer(command);
+    SPI.transfer((address >> 16) & 0xFF);
+    SPI.transfer((address >> 8) & 0xFF);
+    SPI.transfer(address & 0xFF);
+}
+
+static void endCommand()
+{
+    digitalWrite(SPI_FLASH_CS_PIN, HIGH);
+}
+
+static void sendCommand(uint8_t command)
+{
+    digitalWrite(SPI_FLASH_CS_PIN, LOW);
+    SPI.transfer(command);
+    endCommand();
+}
+
+static void waitWhileBusy()
+{
+    digitalWrite(SPI_FLASH_CS_PIN, LOW);
+    SPI.transfer(COMMAND_READ_STATUS);
+    while (SPI.transfer(0) & STATUS_BUSY)
+    {
+    }
+    endCommand();
+}
+
+uint32_t beginSpiFlash()
+{
+    pinMode(SPI_FLASH_CS_PIN, OUTPUT);
+    digitalWrite(SPI_FLASH_CS_PIN, HIGH);
+    SPI.begin(SPI_MODE_MASTER, SPI_FLASH_CS_PIN);
+    SPI.setBitOrder(MSBFIRST);
+    SPI.setDataMode(SPI_MODE0);
+    SPI.setClockSpeed(SPI_FLASH_CLOCK, MHZ);
+
+    sendCommand(COMMAND_RELEASE_POWER_DOWN);
+    delayMicroseconds(5);
+
+    digitalWrite(SPI_FLASH_CS_PIN, LOW);
+    SPI.transfer(COMMAND_JEDEC_ID);
+    uint8_t manufacturer = SPI.transfer(0);
+    SPI.transfer(0);
+    uint8_t capacity = SPI.transfer(0);
+    endCommand();
+
+    // A missing chip reads as all zeros or all ones. The capacity is the base 2 logarithm of the size.
+    if (manufacturer == 0x00 || manufacturer == 0xFF || capacity < 16 || capacity > 24)
+    {
+        return 0;
+    }
+    return 1UL << capacity;
+}
+
+void readSpiFlash(uint32_t address, void *data, size_t length)
+{
+    beginCommand(COMMAND_READ_DATA, address);
+    SPI.transfer(NULL, data, length, NULL);
+    endCommand();
+}
+
+void programSpiFlash(uint32_t address, const void *data, size_t length)
+{
+    sendCommand(COMMAND_WRITE_ENABLE);
+    beginCommand(COMMAND_PAGE_PROGRAM, address);
+    SPI.transfer((void *)data, NULL, length, NULL);
+    endCommand();
+    waitWhileBusy();
+}
+
+void eraseSpiFlashBlock(uint32_t address)
+{
+    sendCommand(COMMAND_WRITE_ENABLE);
+    beginCommand(COMMAND_BLOCK_ERASE, address);
+    endCommand();
+    waitWhileBusy();
+}
+
+#else
+
+#include <string.h>
+
+uint8_t *simulatedFlash = NULL;
+long simulatedFlashProgramLimit = -1;
+unsigned long simulatedFlashPrograms = 0;
+unsigned long simulatedFlashErases = 0;
+
+uint32_t beginSpiFlash()
+{
+    if (simulatedFlash == NULL)
+    {
+        simulatedFlash = new uint8_t[SIMULATED_FLASH_SIZE];
+        memset(simulatedFlash, 0xFF, SIMULATED_FLASH_SIZE);
+    }
+    return SIMULATED_FLASH_SIZE;
+}
+
+void readSpiFlash(uint32_t address, void *data, size_t length)
+{
+    memcpy(data, simulatedFlash + address, length);
+}
+
+void programSpiFlash(uint32_t address, const void *data, size_t length)
+{
+    if (simulatedFlashProgramLimit >= 0 && simulatedFlashPrograms >= (unsigned long)simulatedFlashProgramLimit)
+    {
+        return;
+    }
+    simulatedFlashPrograms++;
+
+    // Like the real chip, an address past the end of the page wraps around to its start.
+    uint32_t page = address - address % SPI_FLASH_PAGE_SIZE;
+    for (size_t i = 0; i < length; i++)
+    {
+        simulatedFlash[page + (address + i) % SPI_FLASH_PAGE_SIZE] &= ((const uint8_t *)data)[i];
+    }
+}
+
+void eraseSpiFlashBlock(uint32_t address)
+{
+    simulatedFlashErases++;
+    memset(simulatedFlash + address - address % SPI_FLASH_BLOCK_SIZE, 0xFF, SPI_FLASH_BLOCK_SIZE);
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _SPIFLASH_H_
+#define _SPIFLASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SPI NOR flash for burst capture, see burst.h.
+//
+// On the device this drives a W25Q-compatible chip (W25Q64, W25Q128, ...) on the hardware SPI pins, with its chip
+// select on `SPI_FLASH_CS_PIN`. Like any NOR flash, programming can only clear bits, so every block has to be erased
+// (set to all ones) before it is programmed again.
+//
+// On any other platform the chip is simulated in memory with the same semantics, so burst capture can be run on host.
+
+// Size of a page, the most that can be programmed at once. (bytes)
+#define SPI_FLASH_PAGE_SIZE 256
+// Size of a block, the unit of erasing. (bytes)
+#define SPI_FLASH_BLOCK_SIZE 65536
+// Chip select of the flash. A6 is the only free pin next to the SPI pins, see `DISCHARGE_PIN` in main.h.
+#define SPI_FLASH_CS_PIN A6
+// Clock of the SPI bus, within what any W25Q part supports for all commands used. (MHz)
+#define SPI_FLASH_CLOCK 30
+// Size of the simulated flash, that of a W25Q64. (bytes)
+#define SIMULATED_FLASH_SIZE (8UL * 1024 * 1024)
+
+/// @brief Wakes up the flash and checks that it responds.
+/// @return the size of the flash, or 0 when no flash responds. (bytes)
+uint32_t beginSpiFlash();
+
+/// @brief Reads from the flash. May cross page and block boundaries.
+/// @param address is the address to start reading at.
+/// @param data is where the bytes are written to.
+/// @param length is the number of bytes to read.
+void readSpiFlash(uint32_t address, void *data, size_t length);
+
+/// @brief Programs part of a page and waits for it to finish, which typically takes 0.7 ms.
+/// Bytes that were already programmed can only have more bits cleared. Bytes still erased can be programmed later.
+/// @param address is the address to start programming at.
+/// @param data is the bytes to program.
+/// @param length is the number of bytes. Must not cross a page boundary.
+void programSpiFlash(uint32_t address, const void *data, size_t length);
+
+/// @brief Erases a block to all ones and waits for it to finish, which typically takes 150 ms.
+/// @param address is the address of the block, a multiple of `SPI_FLASH_BLOCK_SIZE`.
+void eraseSpiFlashBlock(uint32_t address);
+
+#ifndef PLATFORM_ID
+// Contents of the simulated flash. Allocated erased by the first `beginSpiFlash()` and kept after that, like a real chip
+// keeps its contents over a reboot.
+extern uint8_t *simulatedFlash;
+// Number of page programs after which the simulated flash ignores programs, like after a power loss. -1 for never.
+extern long simulatedFlashProgramLimit;
+// Number of page programs and block erases done by the simulated flash.
+extern unsigned long simulatedFlashPrograms;
+extern unsigned long simulatedFlashErases;
+#endif
+
+#endif
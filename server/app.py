@@ -1,54 +1,626 @@
 from distutils.log import debug
 import os
 import time
+import argparse
+import threading
+from collections import deque
 import json
+import struct
+import zlib
+import socketserver
 import sqlite3
 from flask import Flask, g, request
 import flask_socketio as sio
 from httplogging import LoggingMiddleware
+from codec import decode_voltages
+import burst
+from latency import LatencyMetrics
 
 app = Flask(__name__)
 app.config['SECRET_KEY'] = 'My super secret secret'
 
 DATABASE = os.path.join(os.getcwd(), 'database.db')
+# Where the recordings of burst capture are stored, see burst.py.
+BURST_DIRECTORY = os.path.join(os.getcwd(), 'bursts')
 
-socketio = sio.SocketIO(app, cors_allowed_origins=['http://localhost:8080', 'http://192.168.2.31:8080', 'http://192.168.25.220:8080', 'https://hoog3059.pythonanywhere.com', 'http://hoog3059.pythonanywhere.com'])
+# Calibration blob format, see detector/src/calibration.h.
+CALIBRATION_BLOB_MAGIC = b'DDCB'
+CALIBRATION_BLOB_VERSION = 1
+CALIBRATION_BLOB_ENTRIES = 5
+CALIBRATION_BLOB_SIZE = 292
+
+# Memory telemetry fields that are stored as a time series.
+MEMORY_FIELDS = ['freeHeap', 'maxUsedHeap', 'largestFreeBlock', 'stackUsed']
+
+# Fields of which the history is kept, and the rollup resolutions in ms with how long they are kept in ms.
+HISTORY_METRICS = ['Vptp', 'Vmax', 'peakWidth', 'depth']
+HISTORY_RESOLUTIONS = {1000: 2 * 24 * 3600 * 1000, 60 * 1000: 60 * 24 * 3600 * 1000, 3600 * 1000: None}
+# How long every window is kept for reprocessing, see reprocess.py. (ms)
+WINDOW_RETENTION = 7 * 24 * 3600 * 1000
+# Samples per volt of the stored windows, which keeps the 4 decimals of `OversampledAcquisition`. A window of 1000
+# samples takes about 0.8 KB, see `encode_window()`, so a detector uploading 2 windows a second stores about 1 GB over
+# `WINDOW_RETENTION`. As JSON text it would take 5.7 KB, about 7 GB.
+WINDOW_SAMPLE_SCALE = 10000
+# Fields stored with every window, next to its voltages.
+WINDOW_COLUMNS = ['currentMode', 'activatedSwitches', 'loopTime', 'Vptp', 'peakWidth', 'depth']
+# Maximum number of points returned by a history query when no resolution is given.
+HISTORY_MAX_POINTS = 5000
+# Time between removals of expired rollups. (ms)
+HISTORY_PRUNE_INTERVAL = 3600 * 1000
+
+# Resolution of the downsampled oscilloscope trace, in points.
+TRACE_DEFAULT_POINTS = 200
+TRACE_MAX_POINTS = 1000
+
+# Live stream frame format, see `LiveFrame` in detector/src/main.h.
+LIVE_STREAM_PORT = 5001
+LIVE_FRAME_MAGIC = b'DDLF'
+LIVE_FRAME_HEADER = struct.Struct('<4sIIHH')
+LIVE_FRAME_SAMPLES = 50
+LIVE_SAMPLE_SCALE = 10000
+LIVE_DEVICE_ID_LENGTH = 24
+
+# Fields of an upload with the detector's own times, see `LATENCY_TRACING` in detector/src/main.cpp. Uploads without them
+# clear them in the latest state, so they always belong to the latest upload.
+TRACE_FIELDS = ['captureStart', 'captureEnd', 'sendTime']
+
+# Operating mode of a detector that uploads spectra instead of windows, see `Mode` in detector/src/main.h.
+SPECTRUM_MODE = 2
+# Fields of a window upload that a spectrum upload does not have, and the other way around, see `uploadSpectrum()` in
+# detector/src/main.cpp. An upload clears the fields of the other kind in the latest state, so it never shows the
+# spectrum of one mode together with the window of another.
+WINDOW_FIELDS = ['voltageArray', 'Vmax', 'peakWidth', 'depth', 'dischargeTime']
+SPECTRUM_FIELDS = ['spectrum', 'spectrumScale', 'binFrequency', 'dominantFrequency', 'dominantAmplitude']
+
+# Longest burst capture that can be requested, see `BURST_MAX_DURATION` in detector/src/main.h. (s)
+BURST_MAX_DURATION = 60
+# Most samples returned by one query of a recording.
+BURST_MAX_SAMPLES = 100000
+
+# Most frames waiting to be merged, above which uploads are refused with 503 until the ingest task catches up.
+INGEST_QUEUE_LIMIT = 1000
+# Most frames waiting to be written. When the database falls further behind the oldest frames are dropped, which loses
+# their memory samples, history and stored window, which reprocess.py then lacks. The latest state is still written in full.
+WRITE_QUEUE_LIMIT = 10000
+
+# Time between runs of the background tasks. (s)
+INGEST_INTERVAL = 0.005
+BROADCAST_INTERVAL = 0.02
+WRITE_INTERVAL = 0.5
+
+# Frames posted by detectors that have not been merged by `ingest_task()` yet.
+ingest_queue = deque()
+# Frames that have been merged but not written to the database by `writer_task()` yet.
+write_queue = deque(maxlen=WRITE_QUEUE_LIMIT)
+# Frames that have been merged but not broadcast by `broadcast_task()` yet, only kept to time the broadcast.
+broadcast_frames = deque(maxlen=INGEST_QUEUE_LIMIT)
+# Latest merged state of all detectors together and of every detector by device id, see `Snapshot`.
+# Loaded from the database once, after which it is authoritative and the database is only written to.
+# Replaced, never modified, so other tasks can safely read it while it is updated.
+latest = None
+device_snapshots = {}
+broadcast_pending = False
+# Latency of every hop from the detectors to the dashboards, see latency.py.
+latency_metrics = LatencyMetrics()
+
+# Duration of the burst capture requested for every device, until the device picks it up. (s)
+burst_requests = {}
+
+# Requested trace resolution of every client subscribed to `trace_update`, by session id.
+trace_subscriptions = {}
+
+# Sequence number of the next live stream frame of every detector, by device id. Kept across connections, so frames
+# lost while a detector reconnects are reported as well.
+live_sequences = {}
+
+background_tasks_started = False
+background_tasks_lock = threading.Lock()
+
+# The background tasks, the writer thread and the live stream listener are plain threads, so eventlet and gevent, which
+# would need monkey patching, are not used. In production the app is served by gunicorn with a single worker of many
+# threads, see gunicorn.conf.py. A single one, as the latest states and the queues live in the worker's memory.
+socketio = sio.SocketIO(app, async_mode='threading', cors_allowed_origins=['http://localhost:8080', 'http://192.168.2.31:8080', 'http://192.168.25.220:8080', 'https://hoog3059.pythonanywhere.com', 'http://hoog3059.pythonanywhere.com'])
 
 
 @app.get('/api')
 def api_get():
-    data = get_data()
-    return data
+    start_background_tasks()
+    device = request.args.get('device')
+    snapshot = latest if device is None else device_snapshots.get(device)
+    if snapshot is None:
+        return "Unknown device", 404
+    return app.response_class(snapshot.json, mimetype='application/json')
 
 
 @app.post('/api')
 def api_post():
     data = request.get_json()
     data['timestamp'] = int(time.time() * 1000)
-    db_data = get_data()
-    db_data.update(data)
-    update_data(db_data)
-    socketio.emit("data_update", db_data)  # Broadcast
+    if data.get('currentMode') == SPECTRUM_MODE:
+        stale_fields = WINDOW_FIELDS
+    elif 'voltageArray' in data or 'voltageEncoded' in data:
+        stale_fields = SPECTRUM_FIELDS
+    else:
+        # Uploads of only the LCD, the boot timings or the profiling data leave the window and spectrum as they are.
+        stale_fields = []
+    for field in TRACE_FIELDS + stale_fields:
+        data.setdefault(field, None)
+    if 'X-Send-Time' in request.headers:
+        # Sent as a header, so the detector can stamp it after the body has been serialized.
+        data['sendTime'] = int(request.headers['X-Send-Time'])
+    if 'voltageEncoded' in data:
+        # Compressed window, see detector/src/codec.h.
+        data['voltageArray'] = decode_voltages(data.pop('voltageEncoded'), data.pop('voltageScale'))
+    start_background_tasks()
+    if len(ingest_queue) >= INGEST_QUEUE_LIMIT:
+        return "Server busy", 503
+    ingest_queue.append(data)  # Merged, stored and broadcast by the background tasks.
     return "OK", 200
 
 
+@app.get('/api/trace')
+def trace_get():
+    points = int(request.args.get('points', TRACE_DEFAULT_POINTS))
+    start_background_tasks()
+    return get_trace(latest.data, points)
+
+
+@app.get('/api/time')
+def time_get():
+    """Returns the server time in ms, to sync the clock of a detector. See detector/src/clocksync.h."""
+    return str(int(time.time() * 1000)), 200, {'Content-Type': 'text/plain'}
+
+
+@app.get('/api/metrics')
+def metrics_get():
+    return latency_metrics.to_dict()
+
+
+@app.get('/api/history')
+def history_get():
+    device = request.args.get('device', '')
+    metric = request.args.get('metric', 'Vptp')
+    end = int(request.args.get('end', time.time() * 1000))
+    start = int(request.args.get('start', end - 3600 * 1000))
+    if metric not in HISTORY_METRICS:
+        return f"Unknown metric, use one of {HISTORY_METRICS}", 400
+
+    if 'resolution' in request.args:
+        resolution = int(request.args['resolution'])
+        if resolution not in HISTORY_RESOLUTIONS:
+            return f"Unknown resolution, use one of {list(HISTORY_RESOLUTIONS)}", 400
+    else:
+        # Use the finest resolution that stays within the maximum number of points.
+        resolution = next((r for r in sorted(HISTORY_RESOLUTIONS) if (end - start) / r <= HISTORY_MAX_POINTS),
+                          max(HISTORY_RESOLUTIONS))
+
+    rows = query_db("select bucket, count, sum, min, max from rollup where device = ? and resolution = ? and metric = ? "
+                    "and bucket >= ? and bucket <= ? order by bucket;",
+                    (device, resolution, metric, start - start % resolution, end))
+    return {'device': device, 'metric': metric, 'resolution': resolution,
+            'history': [{'timestamp': bucket, 'count': count, 'avg': total / count, 'min': minimum, 'max': maximum}
+                        for bucket, count, total, minimum, maximum in rows]}
+
+
+@app.get('/api/memory')
+def memory_get():
+    device = request.args.get('device', '')
+    since = int(request.args.get('since', 0))
+    limit = int(request.args.get('limit', 1000))
+    rows = query_db("select timestamp, freeHeap, maxUsedHeap, largestFreeBlock, stackUsed from memory "
+                    "where device = ? and timestamp >= ? order by timestamp desc limit ?;", (device, since, limit))
+    return {'device': device, 'memory': [dict(zip(['timestamp', *MEMORY_FIELDS], row)) for row in reversed(rows)]}
+
+
+@app.get('/api/calibration')
+def calibration_get():
+    device = request.args.get('device', '')
+    checksum = int(request.args.get('checksum', 0))
+    blob = get_calibration(device)
+    if blob is None or get_calibration_checksum(blob) == checksum:
+        return "", 204  # Device is up to date.
+    return blob, 200, {'Content-Type': 'application/octet-stream'}
+
+
+@app.post('/api/calibration')
+def calibration_post():
+    blob = request.get_data()
+    if not validate_calibration_blob(blob):
+        return "Invalid calibration blob", 400
+    # Without a device the calibration becomes the default for all devices.
+    device = request.args.get('device', '')
+    query_db("insert or replace into calibration (device, blob) values (?, ?);", (device, blob))
+    return "OK", 200
+
+
+@app.get('/api/burst/request')
+def burst_request_get():
+    """Returns the duration of the burst capture requested for a device, once. See `serviceBurstCapture()`."""
+    seconds = burst_requests.pop(request.args.get('device', ''), None)
+    if seconds is None:
+        return "", 204
+    return str(seconds), 200, {'Content-Type': 'text/plain'}
+
+
+@app.post('/api/burst/request')
+def burst_request_post():
+    device = request.args.get('device', '')
+    seconds = int(request.args.get('seconds', 10))
+    if not device or not 0 < seconds <= BURST_MAX_DURATION:
+        return f"Requires a device and 1 to {BURST_MAX_DURATION} seconds", 400
+    burst_requests[device] = seconds
+    return "OK", 200
+
+
+@app.get('/api/burst')
+def burst_get():
+    """Returns how many bytes of a recording the server has, so the detector can resume uploading it."""
+    row = query_db("select received from burst where device = ? and recording = ?;",
+                   (request.args.get('device', ''), int(request.args.get('recording', 0))), one=True)
+    return str(row[0] if row else 0), 200, {'Content-Type': 'text/plain'}
+
+
+@app.post('/api/burst')
+def burst_post():
+    """Stores a chunk of a recording and returns how many bytes the server has. See `uploadBurstChunk()`."""
+    device = request.args.get('device', '')
+    recording = int(request.args['recording'])
+    sample_count = int(request.args['sampleCount'])
+    checksum = int(request.args['checksum'])
+    try:
+        path = burst.get_path(BURST_DIRECTORY, device, recording)
+    except ValueError as error:
+        return str(error), 400
+
+    # A recording with the same id but another length is a new one, after the flash of the detector was replaced.
+    row = query_db("select sampleCount, checksum from burst where device = ? and recording = ?;", (device, recording), one=True)
+    if row is not None and row != (sample_count, checksum) and os.path.exists(path):
+        os.remove(path)
+    received = burst.append_chunk(path, int(request.args['offset']), request.get_data())
+
+    complete = received >= burst.get_data_size(sample_count)
+    if complete and not burst.is_checksum_valid(path, checksum):
+        # Start over, the detector uploads it again from the start.
+        os.remove(path)
+        received = 0
+        complete = False
+    query_db("insert or replace into burst (device, recording, timestamp, sampleRate, sampleCount, checksum, received, complete) "
+             "values (?, ?, ?, ?, ?, ?, ?, ?);",
+             (device, recording, int(time.time() * 1000), int(request.args['sampleRate']), sample_count, checksum, received, complete))
+    return str(received), 200, {'Content-Type': 'text/plain'}
+
+
+@app.get('/api/bursts')
+def bursts_get():
+    device = request.args.get('device', '')
+    rows = query_db("select recording, timestamp, sampleRate, sampleCount, checksum, received, complete from burst "
+                    "where device = ? order by recording;", (device,))
+    return {'device': device, 'recordings': [
+        dict(zip(['recording', 'timestamp', 'sampleRate', 'sampleCount', 'checksum', 'received', 'complete'], row),
+             cutShort=row[4] == burst.CHECKSUM_UNKNOWN) for row in rows]}
+
+
+@app.get('/api/bursts/<device>/<int:recording>/data')
+def burst_data_get(device, recording):
+    """Returns the packed samples of a recording as they were uploaded, see detector/src/burst.h."""
+    try:
+        path = burst.get_path(BURST_DIRECTORY, device, recording)
+    except ValueError as error:
+        return str(error), 400
+    if not os.path.exists(path):
+        return "Unknown recording", 404
+    with open(path, 'rb') as file:
+        return file.read(), 200, {'Content-Type': 'application/octet-stream'}
+
+
+@app.get('/api/bursts/<device>/<int:recording>/samples')
+def burst_samples_get(device, recording):
+    """Returns part of a recording in V, as far as it has been uploaded."""
+    row = query_db("select sampleRate, received from burst where device = ? and recording = ?;", (device, recording), one=True)
+    if row is None:
+        return "Unknown recording", 404
+    sample_rate, received = row
+    start = max(0, int(request.args.get('start', 0)))
+    count = min(int(request.args.get('count', 1000)), BURST_MAX_SAMPLES, max(0, received * 2 // 3 - start))
+    codes = []
+    if count > 0:
+        # Only the pairs of samples that are asked for.
+        with open(burst.get_path(BURST_DIRECTORY, device, recording), 'rb') as file:
+            file.seek(start // 2 * 3)
+            codes = burst.unpack_samples(file.read(burst.get_data_size(count + start % 2)), start % 2, count)
+    return {'device': device, 'recording': recording, 'sampleRate': sample_rate, 'start': start,
+            'voltages': burst.to_voltages(codes)}
+
+
 @socketio.on('connect')
 def new_connection(auth):
-    sio.emit("data_update", get_data())
+    start_background_tasks()
+    sio.emit("data_update", latest.update)
 
 
-def get_data():
-    return json.loads(query_db("select data from datatable where id = 1;", one=True)[0])
+@socketio.on('subscribe_trace')
+def subscribe_trace(options):
+    points = clamp_trace_points(int(options.get('points', TRACE_DEFAULT_POINTS)))
+    # A client gets one resolution, so a new subscription replaces the previous one.
+    previous = trace_subscriptions.get(request.sid)
+    if previous is not None and previous != points:
+        sio.leave_room(f"trace-{previous}")
+    trace_subscriptions[request.sid] = points
+    sio.join_room(f"trace-{points}")
+    sio.emit("trace_update", get_trace(latest.data, points))
 
 
-def update_data(data):
-    query_db("update datatable set data = ? where id = 1;", (json.dumps(data),))
+@socketio.on('subscribe_live')
+def subscribe_live():
+    sio.join_room('live')
+
+
+@socketio.on('unsubscribe_live')
+def unsubscribe_live():
+    sio.leave_room('live')
+
+
+@socketio.on('disconnect')
+def disconnect():
+    trace_subscriptions.pop(request.sid, None)
+
+
+def clamp_trace_points(points):
+    return min(max(points, 2), TRACE_MAX_POINTS)
+
+
+def without_trace(data):
+    """Returns the state without the raw voltages, which are sent separately through `trace_update`."""
+    return {key: value for key, value in data.items() if key != 'voltageArray'}
+
+
+def get_trace(data, points):
+    """Downsamples the voltages to about `points` points, keeping the minimum and maximum of every bucket so peaks survive."""
+    voltages = data.get('voltageArray') or []
+    loop_time = data.get('loopTime', 0)
+    trace = {'timestamp': data.get('timestamp'), 'loopTime': loop_time, 'x': [], 'y': [],
+             'Vmin': min(voltages, default=0), 'Vmax': max(voltages, default=0),
+             'Vavg': sum(voltages) / len(voltages) if voltages else 0}
+
+    points = clamp_trace_points(points)
+    if len(voltages) <= points:
+        trace['x'] = [i * loop_time for i in range(len(voltages))]
+        trace['y'] = voltages
+        return trace
+
+    bucket_size = len(voltages) / (points // 2)
+    for bucket in range(points // 2):
+        start = int(bucket * bucket_size)
+        end = int((bucket + 1) * bucket_size)
+        indices = range(start, end)
+        low = min(indices, key=voltages.__getitem__)
+        high = max(indices, key=voltages.__getitem__)
+        for i in sorted((low, high)):
+            trace['x'].append(i * loop_time)
+            trace['y'].append(voltages[i])
+    return trace
+
+
+class Snapshot:
+    """A state with everything that is sent from it computed once, so serving it costs nothing."""
+    __slots__ = ('data', 'json', 'update')
+
+    def __init__(self, data):
+        self.data = data
+        # Response of `GET /api`.
+        self.json = json.dumps(data).encode()
+        # Payload of `data_update`.
+        self.update = without_trace(data)
+
+
+def load_snapshots():
+    """Loads the latest states from the database. Only called once, at startup."""
+    global latest, device_snapshots
+    with app.app_context():
+        latest = Snapshot(json.loads(query_db("select data from datatable where id = 1;", one=True)[0]))
+        device_snapshots = {device: Snapshot(json.loads(data)) for device, data in query_db("select device, data from devices;")}
+
+
+def start_background_tasks(live_port=LIVE_STREAM_PORT):
+    """Starts the background tasks and the live stream listener, once. The first request starts them otherwise."""
+    global background_tasks_started
+    with background_tasks_lock:
+        if background_tasks_started:
+            return
+        load_snapshots()
+        background_tasks_started = True
+    socketio.start_background_task(ingest_task)
+    socketio.start_background_task(broadcast_task)
+    # Database writes block, so they are batched on a thread of their own.
+    threading.Thread(target=writer_task, daemon=True).start()
+    threading.Thread(target=live_stream_task, args=(live_port,), daemon=True).start()
+
+
+def ingest_task():
+    global latest, broadcast_pending
+    while True:
+        socketio.sleep(INGEST_INTERVAL)
+        if not ingest_queue:
+            continue
+        state = latest.data
+        device_states = {}
+        while ingest_queue:
+            data = ingest_queue.popleft()
+            data['ingestTime'] = int(time.time() * 1000)
+            latency_metrics.record_received(data)
+            broadcast_frames.append(data)
+            state = {**state, **data}
+            device = data.get('deviceID')
+            if device is not None:
+                previous = device_states.get(device) or getattr(device_snapshots.get(device), 'data', {})
+                device_states[device] = {**previous, **data}
+            write_queue.append(data)
+        # Serialize once per batch instead of once per request.
+        latest = Snapshot(state)
+        for device, device_state in device_states.items():
+            device_snapshots[device] = Snapshot(device_state)
+        broadcast_pending = True
+
+
+def broadcast_task():
+    global broadcast_pending
+    while True:
+        socketio.sleep(BROADCAST_INTERVAL)
+        if broadcast_pending:
+            broadcast_pending = False
+            snapshot = latest
+            state = snapshot.data
+            # Taken together with the snapshot, as frames merged while emitting are only in the next one.
+            frames = [broadcast_frames.popleft() for _ in range(len(broadcast_frames))]
+            socketio.emit("data_update", snapshot.update)  # Broadcast
+            # Downsample once per requested resolution.
+            for points in set(trace_subscriptions.values()):
+                socketio.emit("trace_update", get_trace(state, points), to=f"trace-{points}")
+
+            now = int(time.time() * 1000)
+            for data in frames:
+                latency_metrics.record('broadcast', data['ingestTime'], now)
+                latency_metrics.record('total', data['captureStart'], now)
+
+
+def writer_task():
+    last_prune = 0
+    with app.app_context():
+        while True:
+            time.sleep(WRITE_INTERVAL)
+            if not write_queue:
+                continue
+            frames = []
+            while write_queue:
+                frames.append(write_queue.popleft())
+
+            # Write the whole batch in a single transaction.
+            db = get_db()
+            snapshot = latest
+            db.execute("update datatable set data = ? where id = 1;", (snapshot.json.decode(),))
+            devices = {data['deviceID'] for data in frames if 'deviceID' in data}
+            db.executemany("insert or replace into devices (device, data) values (?, ?);",
+                           [(device, device_snapshots[device].json.decode()) for device in devices if device in device_snapshots])
+            db.executemany("insert into memory (device, timestamp, freeHeap, maxUsedHeap, largestFreeBlock, stackUsed) values (?, ?, ?, ?, ?, ?);",
+                           [(data.get('deviceID', ''), data['timestamp'], *[data[field] for field in MEMORY_FIELDS])
+                            for data in frames if all(field in data for field in MEMORY_FIELDS)])
+            db.executemany("insert into rollup (device, resolution, bucket, metric, count, sum, min, max) values (?, ?, ?, ?, 1, ?, ?, ?) "
+                           "on conflict (device, resolution, bucket, metric) do update set count = count + 1, sum = sum + excluded.sum, "
+                           "min = min(min, excluded.min), max = max(max, excluded.max);",
+                           get_rollup_rows(frames))
+            db.executemany("insert into windows (device, timestamp, currentMode, activatedSwitches, loopTime, Vptp, peakWidth, depth, "
+                           "voltageArray) values (?, ?, ?, ?, ?, ?, ?, ?, ?);",
+                           [(data.get('deviceID', ''), data['timestamp'], *[data.get(field) for field in WINDOW_COLUMNS],
+                             encode_window(data['voltageArray'])) for data in frames if data.get('voltageArray')])
+
+            now = int(time.time() * 1000)
+            if now - last_prune >= HISTORY_PRUNE_INTERVAL:
+                for resolution, retention in HISTORY_RESOLUTIONS.items():
+                    if retention is not None:
+                        db.execute("delete from rollup where resolution = ? and bucket < ?;", (resolution, now - retention))
+                db.execute("delete from windows where timestamp < ?;", (now - WINDOW_RETENTION,))
+                last_prune = now
+            db.commit()
+
+            now = int(time.time() * 1000)
+            for data in frames:
+                latency_metrics.record('persist', data['ingestTime'], now)
+
+
+class LiveStreamHandler(socketserver.StreamRequestHandler):
+    """Relays the frames of one detector in live stream mode to the `live` room, without touching the database."""
+
+    def handle(self):
+        device = self.rfile.read(LIVE_DEVICE_ID_LENGTH).decode(errors='replace')
+        while True:
+            header = self.rfile.read(LIVE_FRAME_HEADER.size)
+            if len(header) < LIVE_FRAME_HEADER.size:
+                return
+            magic, sequence, timestamp, sample_interval, sample_count = LIVE_FRAME_HEADER.unpack(header)
+            payload = self.rfile.read(2 * LIVE_FRAME_SAMPLES)
+            if magic != LIVE_FRAME_MAGIC or sample_count > LIVE_FRAME_SAMPLES or len(payload) < 2 * LIVE_FRAME_SAMPLES:
+                # Out of sync. Dropping the connection makes the detector reconnect and start with a fresh frame.
+                return
+
+            # Number of frames lost since the previous frame. The sequence number wraps around at 32 bits. A detector
+            # that restarted counts from 0 again, which shows up as going back and does not count as lost frames.
+            expected_sequence = live_sequences.get(device)
+            lost = 0 if expected_sequence is None else (sequence - expected_sequence) & 0xFFFFFFFF
+            if lost >= 0x80000000:
+                lost = 0
+            live_sequences[device] = (sequence + 1) & 0xFFFFFFFF
+
+            samples = struct.unpack_from(f'<{sample_count}H', payload)
+            socketio.emit('live_frame', {'deviceID': device, 'sequence': sequence, 'lost': lost,
+                                         'timestamp': timestamp, 'sampleInterval': sample_interval,
+                                         'samples': [sample / LIVE_SAMPLE_SCALE for sample in samples]}, to='live')
+
+
+def live_stream_task(port=LIVE_STREAM_PORT):
+    """Accepts persistent connections from detectors in live stream mode, one thread per detector."""
+    server = socketserver.ThreadingTCPServer(('0.0.0.0', port), LiveStreamHandler)
+    server.daemon_threads = True
+    server.serve_forever()
+
+
+def encode_window(voltages):
+    """Compresses the voltages of a window for the `windows` table, see `decode_window()` in reprocess.py.
+
+    Stored as the zlib compressed differences between the samples at `WINDOW_SAMPLE_SCALE`.
+    """
+    samples = [round(voltage * WINDOW_SAMPLE_SCALE) for voltage in voltages]
+    differences = [sample - previous for sample, previous in zip(samples, [0] + samples)]
+    return zlib.compress(struct.pack(f'<{len(differences)}i', *differences))
+
+
+def get_rollup_rows(frames):
+    """Returns a rollup row for every resolution and history metric in the frames."""
+    rows = []
+    for data in frames:
+        device = data.get('deviceID', '')
+        for resolution in HISTORY_RESOLUTIONS:
+            bucket = data['timestamp'] - data['timestamp'] % resolution
+            for metric in HISTORY_METRICS:
+                if isinstance(data.get(metric), (int, float)):
+                    rows.append((device, resolution, bucket, metric, data[metric], data[metric], data[metric]))
+    return rows
+
+
+def get_calibration(device):
+    row = query_db("select blob from calibration where device = ?;", (device,), one=True)
+    if row is None and device != '':
+        row = query_db("select blob from calibration where device = '';", one=True)
+    return row[0] if row else None
+
+
+def get_calibration_checksum(blob):
+    return struct.unpack_from('<I', blob, CALIBRATION_BLOB_SIZE - 4)[0]
+
+
+def validate_calibration_blob(blob):
+    if len(blob) != CALIBRATION_BLOB_SIZE or blob[:4] != CALIBRATION_BLOB_MAGIC:
+        return False
+    if struct.unpack_from('<HH', blob, 4) != (CALIBRATION_BLOB_VERSION, CALIBRATION_BLOB_ENTRIES):
+        return False
+    return zlib.crc32(blob[:-4]) == get_calibration_checksum(blob)
 
 
 def get_db():
     db = getattr(g, '_database', None)
     if db is None:
         db = g._database = sqlite3.connect(DATABASE)
+        db.execute("create table if not exists calibration (device text primary key, blob blob);")
+        db.execute("create table if not exists devices (device text primary key, data text);")
+        db.execute("create table if not exists memory (device text, timestamp integer, freeHeap integer, maxUsedHeap integer, "
+                   "largestFreeBlock integer, stackUsed integer);")
+        db.execute("create index if not exists memory_device_timestamp on memory (device, timestamp);")
+        db.execute("create table if not exists rollup (device text, resolution integer, bucket integer, metric text, count integer, "
+                   "sum real, min real, max real, primary key (device, resolution, metric, bucket));")
+        db.execute("create table if not exists burst (device text, recording integer, timestamp integer, sampleRate integer, "
+                   "sampleCount integer, checksum integer, received integer, complete integer, primary key (device, recording));")
+        db.execute("create table if not exists windows (device text, timestamp integer, currentMode integer, activatedSwitches integer, "
+                   "loopTime real, Vptp real, peakWidth real, depth real, voltageArray blob);")
+        db.execute("create index if not exists windows_device_timestamp on windows (device, timestamp);")
     return db
 
 
@@ -69,7 +641,18 @@ def close_connection(exception):
 
 
 if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--debug', action='store_true', help="enable the reloader and debugger, never use in production")
+    parser.add_argument('--live-port', type=int, default=LIVE_STREAM_PORT, help="port of the live stream listener")
+    args = parser.parse_args()
+
     print(f"Cwd: {os.getcwd()}")
     print(f"Database loaded: {DATABASE}")
     # app.wsgi_app = LoggingMiddleware(app.wsgi_app)
-    socketio.run(app, host="0.0.0.0", port=5000, debug=True)
+    print(f"Async mode: {socketio.async_mode}")
+    # With the reloader the script also runs in the watching parent process, which should not take the port.
+    if not args.debug or os.environ.get('WERKZEUG_RUN_MAIN') == 'true':
+        start_background_tasks(args.live_port)
+    # The Werkzeug development server, which refuses to run outside a terminal. In production run gunicorn, see
+    # gunicorn.conf.py.
+    socketio.run(app, host="0.0.0.0", port=5000, debug=args.debug)
@@ -0,0 +1,65 @@
+"""Recordings of burst capture, the counterpart of detector/src/burst.cpp.
+
+See detector/src/burst.h for the format. A recording is uploaded in chunks of its packed samples, without the block
+headers, and stored as is in `<directory>/<device>/<recording>.bin`. Keep the constants below in sync with it.
+"""
+import os
+import zlib
+
+# `BURST_ERASED`, the checksum of a recording that was cut short by a reset, which can not be checked.
+CHECKSUM_UNKNOWN = 0xFFFFFFFF
+# Full scale of the 12 bit codes. (V)
+FULL_SCALE_VOLTAGE = 3.3
+FULL_SCALE_CODE = 4095
+
+
+def get_data_size(sample_count):
+    """Returns the number of bytes the packed samples take up, like `getBurstDataSize()`."""
+    return (sample_count * 3 + 1) // 2
+
+
+def unpack_samples(data, start, count):
+    """Unpacks `count` codes starting at sample `start` from the packed samples of a whole recording.
+
+    Two samples take three bytes, the first in the low 12 bits, little-endian.
+    """
+    offset = start // 2 * 3
+    packed = data[offset:offset + get_data_size(count + start % 2)]
+    codes = []
+    for i in range(0, len(packed) - 1, 3):
+        codes.append(packed[i] | (packed[i + 1] & 0x0F) << 8)
+        if i + 2 < len(packed):
+            codes.append(packed[i + 1] >> 4 | packed[i + 2] << 4)
+    return codes[start % 2:start % 2 + count]
+
+
+def to_voltages(codes):
+    return [round(code * FULL_SCALE_VOLTAGE / FULL_SCALE_CODE, 4) for code in codes]
+
+
+def get_path(directory, device, recording):
+    # Device ids are hex, but they come from the query string.
+    if not device.isalnum():
+        raise ValueError(f"Invalid device id {device!r}")
+    return os.path.join(directory, device, f'{int(recording)}.bin')
+
+
+def append_chunk(path, offset, chunk):
+    """Appends a chunk when it continues where the stored part ends, and returns the size of the stored part.
+
+    Chunks that overlap or leave a gap are dropped, the detector continues from the returned size.
+    """
+    received = os.path.getsize(path) if os.path.exists(path) else 0
+    if offset == received and chunk:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, 'ab') as file:
+            file.write(chunk)
+        received += len(chunk)
+    return received
+
+
+def is_checksum_valid(path, checksum):
+    if checksum == CHECKSUM_UNKNOWN:
+        return True
+    with open(path, 'rb') as file:
+        return zlib.crc32(file.read()) == checksum
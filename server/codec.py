@@ -0,0 +1,75 @@
+"""Lossless codec for windows of measurements, the counterpart of detector/src/codec.cpp.
+
+See detector/src/codec.h for the format. Keep the constants below in sync with it.
+"""
+import base64
+
+BLOCK_SIZE = 32
+ESCAPE_LENGTH = 16
+ESCAPE_BITS = 24
+
+
+def decode_waveform(data):
+    """Decodes an encoded window to the list of samples."""
+    count = int.from_bytes(data[:2], 'little')
+    # Working on a string of bits lets `str.find()` do the unary decoding.
+    payload = data[2:]
+    bits = bin(int.from_bytes(b'\x01' + payload, 'big'))[3:]
+
+    samples = []
+    position = 0
+    previous = 0
+    while len(samples) < count:
+        k = int(bits[position:position + 5], 2)
+        position += 5
+        for _ in range(min(BLOCK_SIZE, count - len(samples))):
+            end = bits.find('0', position, position + ESCAPE_LENGTH)
+            if end < 0:
+                position += ESCAPE_LENGTH
+                value = int(bits[position:position + ESCAPE_BITS], 2)
+                position += ESCAPE_BITS
+            else:
+                value = (end - position) << k
+                position = end + 1
+                if k:
+                    value |= int(bits[position:position + k], 2)
+                    position += k
+            previous += (value >> 1) ^ -(value & 1)
+            samples.append(previous)
+    return samples
+
+
+def encode_waveform(samples):
+    """Encodes a window of integer samples like `WaveformEncoder` does on the device."""
+    bits = []
+    previous = 0
+    residuals = []
+    for sample in samples:
+        residual = sample - previous
+        previous = sample
+        residuals.append(residual << 1 if residual >= 0 else (-residual << 1) - 1)
+
+    for start in range(0, len(residuals), BLOCK_SIZE):
+        block = residuals[start:start + BLOCK_SIZE]
+        k = 0
+        while k < ESCAPE_BITS and len(block) << (k + 1) <= sum(block):
+            k += 1
+        bits.append(format(k, '05b'))
+        for value in block:
+            quotient = value >> k
+            if quotient < ESCAPE_LENGTH:
+                bits.append('1' * quotient + '0')
+                if k:
+                    bits.append(format(value & ((1 << k) - 1), f'0{k}b'))
+            else:
+                bits.append('1' * ESCAPE_LENGTH + format(value, f'0{ESCAPE_BITS}b'))
+
+    bit_string = ''.join(bits)
+    bit_string += '0' * (-len(bit_string) % 8)
+    payload = int(bit_string, 2).to_bytes(len(bit_string) // 8, 'big') if bit_string else b''
+    return len(samples).to_bytes(2, 'little') + payload
+
+
+def decode_voltages(encoded, scale):
+    """Decodes the base64 encoded window of an upload to voltages, given the number of samples per volt."""
+    return [sample / scale for sample in decode_waveform(base64.b64decode(encoded))]
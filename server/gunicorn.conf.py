@@ -0,0 +1,25 @@
+"""Production configuration of gunicorn for app.py.
+
+Run from this directory, which is where the database is:
+    gunicorn -c gunicorn.conf.py app:app
+
+The WebSocket transport of Socket.IO needs simple-websocket in threading mode.
+"""
+import os
+
+bind = '0.0.0.0:5000'
+# A single worker, as the latest states and the queues of app.py live in its memory. Its threads serve the requests,
+# and every dashboard connected through a WebSocket keeps one of them.
+workers = 1
+worker_class = 'gthread'
+threads = 100
+# Dashboards keep their connection open, so it is not a stuck request when it stays open.
+timeout = 0
+# Port of the live stream listener, see `LIVE_STREAM_PORT` in app.py.
+live_port = int(os.environ.get('LIVE_STREAM_PORT', 5001))
+
+
+def post_worker_init(worker):
+    # Detectors in live stream mode connect before any dashboard does, so do not wait for the first request.
+    import app
+    app.start_background_tasks(live_port)
@@ -0,0 +1,85 @@
+"""Latency histograms of every hop a measurement takes from the detector to the dashboards, see `GET /api/metrics`.
+
+All times are in ms since the Unix epoch on the clock of the server. The detector converts its own times with the
+clock it synced with `GET /api/time`, see detector/src/clocksync.h, so the times of the device hops are only known
+for detectors with `LATENCY_TRACING` defined. The hops, each starting where the previous one ended:
+    capture     captureStart -> captureEnd      measuring the window
+    device      captureEnd -> sendTime          analysis, display and serialization on the detector
+    network     sendTime -> timestamp           connecting and sending the request, `timestamp` being the receive time
+    ingest      timestamp -> ingestTime         waiting for `ingest_task()` to merge it into the latest state
+    broadcast   ingestTime -> broadcast         waiting for `broadcast_task()` to send it to the dashboards
+    persist     ingestTime -> persist           waiting for `writer_task()` to commit it to the database
+and `total` from captureStart until the dashboards have it.
+"""
+import threading
+import time
+
+# Upper bounds of the histogram buckets, the last bucket counts everything above. (ms)
+BUCKETS = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000]
+HOPS = ['capture', 'device', 'network', 'ingest', 'broadcast', 'persist', 'total']
+
+
+class Histogram:
+    __slots__ = ('counts', 'count', 'sum', 'min', 'max')
+
+    def __init__(self):
+        self.counts = [0] * (len(BUCKETS) + 1)
+        self.count = 0
+        self.sum = 0
+        self.min = None
+        self.max = None
+
+    def add(self, value):
+        self.counts[next((i for i, bound in enumerate(BUCKETS) if value <= bound), len(BUCKETS))] += 1
+        self.count += 1
+        self.sum += value
+        self.min = value if self.min is None else min(self.min, value)
+        self.max = value if self.max is None else max(self.max, value)
+
+    def percentile(self, fraction):
+        """Returns the upper bound of the bucket the percentile falls in, or the maximum for the last bucket."""
+        if not self.count:
+            return None
+        remaining = fraction * self.count
+        for i, count in enumerate(self.counts):
+            remaining -= count
+            if remaining <= 0:
+                return min(BUCKETS[i], self.max) if i < len(BUCKETS) else self.max
+        return self.max
+
+    def to_dict(self):
+        return {'count': self.count, 'min': self.min, 'avg': self.sum / self.count if self.count else None, 'max': self.max,
+                'p50': self.percentile(0.5), 'p90': self.percentile(0.9), 'p99': self.percentile(0.99),
+                'histogram': self.counts}
+
+
+class LatencyMetrics:
+    """Histograms of all hops. Recorded from the background tasks, one of which is a real thread."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.since = int(time.time() * 1000)
+        self.histograms = {hop: Histogram() for hop in HOPS}
+
+    def record(self, hop, start, end):
+        """Adds the time from `start` to `end` to the histogram of a hop, unless either is unknown.
+
+        Hops that cross from the detector clock to the server clock can come out slightly negative when the detector is
+        synced less accurately than the hop takes. Those count as 0.
+        """
+        if not isinstance(start, (int, float)) or not isinstance(end, (int, float)):
+            return
+        with self.lock:
+            self.histograms[hop].add(max(0, end - start))
+
+    def record_received(self, data):
+        """Records the hops up to and including ingest of a frame that has just been merged."""
+        self.record('capture', data.get('captureStart'), data.get('captureEnd'))
+        self.record('device', data.get('captureEnd'), data.get('sendTime'))
+        self.record('network', data.get('sendTime'), data.get('timestamp'))
+        self.record('ingest', data.get('timestamp'), data.get('ingestTime'))
+
+    def to_dict(self):
+        with self.lock:
+            return {'since': self.since, 'buckets': BUCKETS,
+                    'hops': {hop: histogram.to_dict() for hop, histogram in self.histograms.items()}}
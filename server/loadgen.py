@@ -0,0 +1,237 @@
+"""Load generator for the API server.
+
+Simulates a fleet of detectors posting measurements and a number of dashboards subscribed over Socket.IO, and
+reports ingest throughput, latencies and server memory usage. Only meant to be run against a local server instance.
+
+The requests follow `uploadData()` in detector/src/main.cpp: same HTTP/1.0 framing, field order and number
+formatting. They differ in that the fields that are not measured, like the memory statistics and the switches, are
+fixed, and in an extra `loadgenId` field that the server passes on in `data_update`, so events can be matched to
+uploads. Keep them in sync when the upload format changes.
+
+Example:
+    python loadgen.py --detectors 20 --rate 2 --subscribers 5 --duration 60 --server-pid 1234
+"""
+import argparse
+import base64
+import json
+import math
+import random
+import socket
+import threading
+import time
+import urllib.request
+
+import socketio
+
+from codec import encode_waveform
+from latency import HOPS
+
+SAMPLES_PER_WINDOW = 1000
+
+# Time after which an upload is no longer expected to reach the subscribers. (s)
+# The server coalesces the uploads of a device between broadcasts, so most are never seen by a subscriber.
+PENDING_UPLOAD_TIMEOUT = 30
+
+lock = threading.Lock()
+# Send time of every upload of the last `PENDING_UPLOAD_TIMEOUT` seconds, by `loadgenId`.
+pending_uploads = {}
+post_latencies = []
+# Latency of every event on every subscriber.
+event_latencies = []
+posts_sent = 0
+posts_failed = 0
+
+
+def generate_window(amplitude, phase):
+    """Generates a window like `doMeasurement()` does: a rectified mains signal on a baseline, quantized to 0.01 V."""
+    loop_time = random.uniform(0.095, 0.105)
+    voltages = []
+    for i in range(SAMPLES_PER_WINDOW):
+        t = i * loop_time / 1000
+        signal = amplitude * max(0.0, math.sin(2 * math.pi * 50 * t + phase)) ** 3
+        voltages.append(round(min(3.3, max(0.0, 0.3 + signal + random.gauss(0, 0.01))), 2))
+    return voltages, loop_time
+
+
+def serialize_upload(device_id, loadgen_id, voltages, loop_time, compressed=False, capture_times=None):
+    """Serializes a measurement like `uploadData()`, optionally like `CompressedUpload`.
+
+    Fields that are not simulated have fixed values, and `loadgen_id` is added as `loadgenId`.
+
+    With `LATENCY_TRACING` defined, `capture_times` holds when the window started and finished being captured in ms.
+    """
+    v_max = max(voltages)
+    v_ptp = v_max - min(voltages)
+    if compressed:
+        encoded = base64.b64encode(encode_waveform([round(v * 100) for v in voltages])).decode()
+        voltage_fields = f'"voltageEncoded":"{encoded}","voltageScale":100'
+    else:
+        voltage_fields = '"voltageArray":[' + ",".join(f"{v:.2f}" for v in voltages) + "]"
+    capture_fields = f'"captureStart":{capture_times[0]},"captureEnd":{capture_times[1]},' if capture_times else ''
+    json_output = (f'{{"deviceID":"{device_id}","currentMode":0,{voltage_fields},'
+                   f'"loopTime":{loop_time:.2f},"Vmax":{v_max:.2f},"Vptp":{v_ptp:.2f},"peakWidth":0,'
+                   f'"activatedSwitches":4,"dischargeTime":100,{capture_fields}"freeHeap":40000,"maxUsedHeap":20000,'
+                   f'"largestFreeBlock":30000,"stackUsed":4600,'
+                   f'"lcdFirstLine":"Scanning: Warmer","lcdSecondLine":"Vptp = {v_ptp:.2f} V",'
+                   f'"loadgenId":"{loadgen_id}"}}')
+    return json_output
+
+
+def build_request(host, port, json_output, send_time=None):
+    """Frames the request like `TCPClient::println()` does on the device, with the send time of `LATENCY_TRACING`."""
+    lines = ["POST /api HTTP/1.0",
+             f"Host: {host}:{port}",
+             "Content-Type: application/json",
+             f"Content-Length: {len(json_output)}",
+             *([f"X-Send-Time: {send_time}"] if send_time is not None else []),
+             "",
+             json_output,
+             ""]
+    return "".join(line + "\r\n" for line in lines).encode()
+
+
+def run_detector(index, args, stop):
+    global posts_sent, posts_failed
+    device_id = f"{index:024x}"
+    amplitude = random.uniform(0.2, 1.2)
+    sequence = 0
+    next_time = time.monotonic()
+
+    while not stop.is_set():
+        voltages, loop_time = generate_window(amplitude, random.uniform(0, 2 * math.pi))
+        loadgen_id = f"{index}-{sequence}"
+        # As if the window was captured up to now. Runs on the same clock as the server, so there is nothing to sync.
+        capture_end = int(time.time() * 1000)
+        capture_times = (capture_end - round(loop_time * SAMPLES_PER_WINDOW), capture_end) if args.traced else None
+        json_output = serialize_upload(device_id, loadgen_id, voltages, loop_time, args.compressed, capture_times)
+        request = build_request(args.host, args.port, json_output, int(time.time() * 1000) if args.traced else None)
+        sequence += 1
+
+        start = time.monotonic()
+        with lock:
+            pending_uploads[loadgen_id] = start
+        try:
+            with socket.create_connection((args.host, args.port), timeout=10) as connection:
+                connection.sendall(request)
+                # Unlike the device, wait for the response to measure ingest latency.
+                while connection.recv(4096):
+                    pass
+            with lock:
+                posts_sent += 1
+                post_latencies.append(time.monotonic() - start)
+        except OSError:
+            with lock:
+                posts_failed += 1
+                pending_uploads.pop(loadgen_id, None)
+
+        next_time += 1 / args.rate
+        stop.wait(max(0.0, next_time - time.monotonic()))
+
+
+def run_subscriber(args, stop):
+    client = socketio.Client()
+
+    @client.on('data_update')
+    def data_update(data):
+        received = time.monotonic()
+        with lock:
+            # Left for the other subscribers, `report()` evicts it.
+            sent = pending_uploads.get(data.get('loadgenId'))
+            if sent is not None:
+                event_latencies.append(received - sent)
+
+    client.connect(f"http://{args.host}:{args.port}")
+    stop.wait()
+    client.disconnect()
+
+
+def print_latency_metrics(args):
+    """Prints the latency of every hop as measured by the server, see `GET /api/metrics`."""
+    try:
+        with urllib.request.urlopen(f"http://{args.host}:{args.port}/api/metrics", timeout=10) as response:
+            metrics = json.load(response)
+    except OSError:
+        print("Latency metrics unavailable")
+        return
+    for hop in HOPS:
+        histogram = metrics['hops'][hop]
+        if histogram['count']:
+            print(f"{hop:>10}: {histogram['count']:6d} frames | avg {histogram['avg']:7.1f} ms | "
+                  f"p50 <= {histogram['p50']} ms p99 <= {histogram['p99']} ms max {histogram['max']} ms")
+
+
+def get_server_memory(pid):
+    """Returns the resident memory of the server in MB, or None when it cannot be determined."""
+    if pid is None:
+        return None
+    try:
+        with open(f"/proc/{pid}/status") as status:
+            for line in status:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1]) / 1024
+    except OSError:
+        return None
+
+
+def percentile(values, fraction):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+def evict_pending_uploads():
+    """Forgets the uploads sent more than `PENDING_UPLOAD_TIMEOUT` seconds ago. Call with `lock` held."""
+    oldest = time.monotonic() - PENDING_UPLOAD_TIMEOUT
+    for loadgen_id in [loadgen_id for loadgen_id, sent in pending_uploads.items() if sent < oldest]:
+        del pending_uploads[loadgen_id]
+
+
+def report(elapsed, args):
+    global posts_sent, posts_failed, post_latencies, event_latencies
+    with lock:
+        sent, failed, posts, events = posts_sent, posts_failed, post_latencies, event_latencies
+        posts_sent, posts_failed, post_latencies, event_latencies = 0, 0, [], []
+        evict_pending_uploads()
+
+    memory = get_server_memory(args.server_pid)
+    print(f"{sent / elapsed:7.1f} posts/s ({failed} failed) | "
+          f"POST p50 {percentile(posts, 0.5) * 1000:7.1f} ms p99 {percentile(posts, 0.99) * 1000:7.1f} ms | "
+          f"event p50 {percentile(events, 0.5) * 1000:7.1f} ms p99 {percentile(events, 0.99) * 1000:7.1f} ms" +
+          (f" | server {memory:.1f} MB" if memory is not None else ""))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Simulates a fleet of detectors and dashboards against a local server.")
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5000)
+    parser.add_argument('--detectors', type=int, default=10, help="number of simulated detectors")
+    parser.add_argument('--rate', type=float, default=1.0, help="uploads per second per detector")
+    parser.add_argument('--subscribers', type=int, default=1, help="number of simulated dashboards")
+    parser.add_argument('--duration', type=float, default=30.0, help="duration of the test in seconds")
+    parser.add_argument('--interval', type=float, default=5.0, help="time between reports in seconds")
+    parser.add_argument('--compressed', action='store_true', help="upload compressed windows, like `CompressedUpload`")
+    parser.add_argument('--traced', action='store_true', help="upload capture and send times, like `LATENCY_TRACING`")
+    parser.add_argument('--server-pid', type=int, help="process id of the server, to report its memory usage")
+    args = parser.parse_args()
+
+    if args.host not in ('127.0.0.1', 'localhost', '::1'):
+        parser.error("only run the load generator against a local server instance")
+
+    stop = threading.Event()
+    threads = [threading.Thread(target=run_subscriber, args=(args, stop)) for _ in range(args.subscribers)]
+    threads += [threading.Thread(target=run_detector, args=(i, args, stop)) for i in range(args.detectors)]
+    for thread in threads:
+        thread.start()
+
+    start = last_report = time.monotonic()
+    while time.monotonic() - start < args.duration:
+        time.sleep(min(args.interval, args.duration - (time.monotonic() - start)))
+        now = time.monotonic()
+        report(now - last_report, args)
+        last_report = now
+
+    stop.set()
+    for thread in threads:
+        thread.join()
+    print_latency_metrics(args)
@@ -0,0 +1,366 @@
+// Python extension running the firmware's own calibration, peak detection and median filter
+// (detector/src/calibration.cpp, detector/src/peaks.cpp and detector/src/filter.cpp) on batches of stored windows, so
+// they can be reprocessed after a recalibration.
+//
+// Every function takes NumPy arrays of many windows and spreads them over threads, with the GIL released, except the
+// median filter, which runs through the windows in order. See setup.py for building it.
+//
+// The results match the device's up to what the stored windows lost, see `analyzeWindow()` in peaks.h.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "calibration.h"
+#include "filter.h"
+#include "peaks.h"
+
+// The active calibration is global state of calibration.cpp. It is only changed by `load_calibration()`.
+static std::mutex calibrationMutex;
+// The compiled-in calibration as a blob, so `reset_calibration()` can go back to it.
+static CalibrationBlob compiledCalibration;
+
+/// @brief Runs `work(begin, end)` over [0, `count`) split in contiguous ranges over `threads` threads.
+template <class Work>
+static void runThreaded(npy_intp count, int threads, Work work)
+{
+    if (threads <= 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = (int)std::min<npy_intp>(threads, std::max<npy_intp>(count, 1));
+
+    std::vector<std::thread> workers;
+    npy_intp chunk = (count + threads - 1) / threads;
+    for (int t = 1; t < threads; t++)
+    {
+        npy_intp begin = std::min(count, t * chunk);
+        npy_intp end = std::min(count, begin + chunk);
+        workers.emplace_back(work, begin, end);
+    }
+    work(0, std::min(count, chunk));
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/// @brief Converts an object to a C-contiguous array of `type`, broadcasting a scalar to `count` elements.
+/// @return a new reference, or NULL with an exception set when the object does not fit.
+static PyArrayObject *getVector(PyObject *object, int type, npy_intp count, const char *name)
+{
+    PyArrayObject *array = (PyArrayObject *)PyArray_FROM_OTF(object, type, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (array == NULL)
+    {
+        return NULL;
+    }
+    if (PyArray_NDIM(array) == 0)
+    {
+        PyArrayObject *broadcast = (PyArrayObject *)PyArray_SimpleNew(1, &count, type);
+        if (broadcast != NULL)
+        {
+            PyArray_FillWithScalar(broadcast, object);
+        }
+        Py_DECREF(array);
+        return broadcast;
+    }
+    if (PyArray_NDIM(array) != 1 || PyArray_DIM(array, 0) != count)
+    {
+        PyErr_Format(PyExc_ValueError, "%s must be a scalar or have one element per window", name);
+        Py_DECREF(array);
+        return NULL;
+    }
+    return array;
+}
+
+static PyObject *analyze(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = {"windows", "loop_time", "threads", NULL};
+    PyObject *windowsObject;
+    PyObject *loopTimeObject;
+    int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|i", (char **)keywords, &windowsObject, &loopTimeObject, &threads))
+    {
+        return NULL;
+    }
+
+    PyArrayObject *windows = (PyArrayObject *)PyArray_FROM_OTF(windowsObject, NPY_FLOAT32, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (windows == NULL)
+    {
+        return NULL;
+    }
+    if (PyArray_NDIM(windows) != 2)
+    {
+        PyErr_SetString(PyExc_ValueError, "windows must be a 2D array with one window per row");
+        Py_DECREF(windows);
+        return NULL;
+    }
+    npy_intp count = PyArray_DIM(windows, 0);
+    npy_intp length = PyArray_DIM(windows, 1);
+    if (length == 0)
+    {
+        // Would come out as a window that never rose above 0 V nor fell below 3.5 V.
+        PyErr_SetString(PyExc_ValueError, "windows must have at least one measurement");
+        Py_DECREF(windows);
+        return NULL;
+    }
+
+    PyArrayObject *loopTimes = getVector(loopTimeObject, NPY_FLOAT32, count, "loop_time");
+    if (loopTimes == NULL)
+    {
+        Py_DECREF(windows);
+        return NULL;
+    }
+
+    PyArrayObject *Vmax = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_FLOAT32);
+    PyArrayObject *Vmin = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_FLOAT32);
+    PyArrayObject *Vptp = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_FLOAT32);
+    PyArrayObject *peakWidth = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_FLOAT32);
+    PyArrayObject *countedPeaks = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_INT32);
+    PyObject *result = NULL;
+    if (Vmax && Vmin && Vptp && peakWidth && countedPeaks)
+    {
+        const float *windowData = (const float *)PyArray_DATA(windows);
+        const float *loopTimeData = (const float *)PyArray_DATA(loopTimes);
+        float *VmaxData = (float *)PyArray_DATA(Vmax);
+        float *VminData = (float *)PyArray_DATA(Vmin);
+        float *VptpData = (float *)PyArray_DATA(Vptp);
+        float *peakWidthData = (float *)PyArray_DATA(peakWidth);
+        int32_t *countedPeaksData = (int32_t *)PyArray_DATA(countedPeaks);
+
+        Py_BEGIN_ALLOW_THREADS;
+        runThreaded(count, threads, [&](npy_intp begin, npy_intp end)
+                    {
+            for (npy_intp i = begin; i < end; i++)
+            {
+                WindowStatistics statistics;
+                analyzeWindow(windowData + i * length, length, loopTimeData[i], &statistics);
+                VmaxData[i] = statistics.Vmax;
+                VminData[i] = statistics.Vmin;
+                VptpData[i] = statistics.Vptp;
+                peakWidthData[i] = statistics.peakWidth;
+                countedPeaksData[i] = statistics.countedPeaks;
+            } });
+        Py_END_ALLOW_THREADS;
+
+        result = Py_BuildValue("{sOsOsOsOsO}", "Vmax", Vmax, "Vmin", Vmin, "Vptp", Vptp, "peakWidth", peakWidth, "countedPeaks", countedPeaks);
+    }
+
+    Py_XDECREF(Vmax);
+    Py_XDECREF(Vmin);
+    Py_XDECREF(Vptp);
+    Py_XDECREF(peakWidth);
+    Py_XDECREF(countedPeaks);
+    Py_DECREF(loopTimes);
+    Py_DECREF(windows);
+    return result;
+}
+
+static PyObject *depth(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = {"Vptp", "activated_switches", "threads", NULL};
+    PyObject *VptpObject;
+    PyObject *switchesObject;
+    int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|i", (char **)keywords, &VptpObject, &switchesObject, &threads))
+    {
+        return NULL;
+    }
+
+    PyArrayObject *Vptp = (PyArrayObject *)PyArray_FROM_OTF(VptpObject, NPY_FLOAT32, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (Vptp == NULL)
+    {
+        return NULL;
+    }
+    npy_intp count = PyArray_SIZE(Vptp);
+    PyArrayObject *switches = getVector(switchesObject, NPY_UINT8, count, "activated_switches");
+    PyArrayObject *depths = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_FLOAT32);
+    if (switches == NULL || depths == NULL)
+    {
+        Py_XDECREF(switches);
+        Py_XDECREF(depths);
+        Py_DECREF(Vptp);
+        return NULL;
+    }
+
+    const float *VptpData = (const float *)PyArray_DATA(Vptp);
+    const uint8_t *switchesData = (const uint8_t *)PyArray_DATA(switches);
+    float *depthData = (float *)PyArray_DATA(depths);
+
+    Py_BEGIN_ALLOW_THREADS;
+    {
+        std::lock_guard<std::mutex> lock(calibrationMutex);
+        runThreaded(count, threads, [&](npy_intp begin, npy_intp end)
+                    {
+            for (npy_intp i = begin; i < end; i++)
+            {
+                // Like `depthModeRoutine()`, which only uploads a depth within the calibrated range.
+                int index = getIndexByConfiguration(switchesData[i]);
+                if (index == CALIBRATED_CONFIGURATIONS || VptpData[i] >= confDomainMax[index] || VptpData[i] <= confDomainMin[index])
+                {
+                    depthData[i] = NAN;
+                }
+                else
+                {
+                    depthData[i] = getDepthByFit(switchesData[i], VptpData[i]);
+                }
+            } });
+    }
+    Py_END_ALLOW_THREADS;
+
+    Py_DECREF(switches);
+    Py_DECREF(Vptp);
+    return (PyObject *)depths;
+}
+
+static PyObject *medianFilter(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    static const char *keywords[] = {"Vptp", "restart", NULL};
+    PyObject *VptpObject;
+    PyObject *restartObject = Py_False;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", (char **)keywords, &VptpObject, &restartObject))
+    {
+        return NULL;
+    }
+
+    PyArrayObject *Vptp = (PyArrayObject *)PyArray_FROM_OTF(VptpObject, NPY_FLOAT32, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (Vptp == NULL)
+    {
+        return NULL;
+    }
+    npy_intp count = PyArray_SIZE(Vptp);
+    PyArrayObject *restart = getVector(restartObject, NPY_BOOL, count, "restart");
+    PyArrayObject *filtered = (PyArrayObject *)PyArray_SimpleNew(1, &count, NPY_FLOAT32);
+    if (restart == NULL || filtered == NULL)
+    {
+        Py_XDECREF(restart);
+        Py_XDECREF(filtered);
+        Py_DECREF(Vptp);
+        return NULL;
+    }
+
+    const float *VptpData = (const float *)PyArray_DATA(Vptp);
+    const npy_bool *restartData = (const npy_bool *)PyArray_DATA(restart);
+    float *filteredData = (float *)PyArray_DATA(filtered);
+
+    Py_BEGIN_ALLOW_THREADS;
+    // Like `depthModeRoutine()`, which starts over when depth mode is entered and when the sensors change.
+    MedianFilter filter;
+    resetMedianFilter(&filter);
+    for (npy_intp i = 0; i < count; i++)
+    {
+        if (restartData[i])
+        {
+            resetMedianFilter(&filter);
+        }
+        addToMedianFilter(&filter, VptpData[i]);
+        filteredData[i] = getMedian(&filter);
+    }
+    Py_END_ALLOW_THREADS;
+
+    Py_DECREF(restart);
+    Py_DECREF(Vptp);
+    return (PyObject *)filtered;
+}
+
+static PyObject *loadCalibration(PyObject *self, PyObject *args)
+{
+    Py_buffer blob;
+    if (!PyArg_ParseTuple(args, "y*", &blob))
+    {
+        return NULL;
+    }
+
+    bool applied = false;
+    if (blob.len == sizeof(CalibrationBlob))
+    {
+        CalibrationBlob calibration;
+        memcpy(&calibration, blob.buf, sizeof(calibration));
+        std::lock_guard<std::mutex> lock(calibrationMutex);
+        applied = applyCalibrationBlob(&calibration);
+    }
+    PyBuffer_Release(&blob);
+
+    return PyBool_FromLong(applied);
+}
+
+static PyObject *resetCalibration(PyObject *self, PyObject *args)
+{
+    std::lock_guard<std::mutex> lock(calibrationMutex);
+    applyCalibrationBlob(&compiledCalibration);
+    activeCalibrationChecksum = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject *getCalibrationChecksum(PyObject *self, PyObject *args)
+{
+    return PyLong_FromUnsignedLong(activeCalibrationChecksum);
+}
+
+static PyMethodDef methods[] = {
+    {"analyze", (PyCFunction)(void (*)(void))analyze, METH_VARARGS | METH_KEYWORDS,
+     "analyze(windows, loop_time, threads=0)\n\n"
+     "Runs the statistics of doMeasurement() over every row of `windows`, measured `loop_time` ms apart.\n"
+     "Returns a dict of arrays: Vmax, Vmin, Vptp, peakWidth (ms) and countedPeaks.\n"
+     "Every window needs at least one measurement."},
+    {"median_filter", (PyCFunction)(void (*)(void))medianFilter, METH_VARARGS | METH_KEYWORDS,
+     "median_filter(Vptp, restart=False)\n\n"
+     "Runs the median filter of depth mode over consecutive windows, and returns the filtered Vptp after every window.\n"
+     "The filter starts over at the windows where `restart` is set, like at entering depth mode or changing sensors."},
+    {"depth", (PyCFunction)(void (*)(void))depth, METH_VARARGS | METH_KEYWORDS,
+     "depth(Vptp, activated_switches, threads=0)\n\n"
+     "Returns the depth of every Vptp with the active calibration, or NaN where depth mode would not report one.\n"
+     "Depth mode computes it from the filtered Vptp, see median_filter()."},
+    {"load_calibration", loadCalibration, METH_VARARGS,
+     "load_calibration(blob)\n\n"
+     "Applies a calibration blob, like the device does. Returns whether it was valid."},
+    {"reset_calibration", resetCalibration, METH_NOARGS,
+     "reset_calibration()\n\n"
+     "Goes back to the compiled-in calibration."},
+    {"calibration_checksum", getCalibrationChecksum, METH_NOARGS,
+     "calibration_checksum()\n\n"
+     "Returns the checksum of the active calibration blob, 0 for the compiled-in calibration."},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef module = {PyModuleDef_HEAD_INIT, "firmware", "The detector firmware's calibration and peak detection.", -1, methods};
+
+PyMODINIT_FUNC PyInit_firmware(void)
+{
+    import_array();
+
+    PyObject *result = PyModule_Create(&module);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+    PyModule_AddIntConstant(result, "MEDIAN_FILTER_SIZE", MEDIAN_FILTER_SIZE);
+
+    // Like `setup()` on the device, tabulate the compiled-in calibration.
+    buildCalibrationTables();
+
+    compiledCalibration.magic = CALIBRATION_BLOB_MAGIC;
+    compiledCalibration.version = CALIBRATION_BLOB_VERSION;
+    compiledCalibration.entryCount = CALIBRATED_CONFIGURATIONS;
+    for (int index = 0; index < CALIBRATED_CONFIGURATIONS; index++)
+    {
+        CalibrationEntry *entry = &compiledCalibration.entries[index];
+        memset(entry, 0, sizeof(*entry));
+        entry->switchConfiguration = confSwitchConfigurations[index];
+        entry->degree = confFitDegrees[index];
+        entry->useLookupTable = confUseLookupTable[index];
+        entry->domainMin = confDomainMin[index];
+        entry->domainMax = confDomainMax[index];
+        memcpy(entry->coefs, confFitCoefs[index], sizeof(entry->coefs));
+    }
+    compiledCalibration.checksum = calculateCalibrationChecksum(&compiledCalibration);
+
+    return result;
+}
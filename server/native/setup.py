@@ -0,0 +1,21 @@
+"""Builds the `firmware` extension from the firmware sources in detector/src, see firmwaremodule.cpp.
+
+Build it in place from this directory, after which server/reprocess.py can import it:
+    python setup.py build_ext --inplace
+"""
+import os
+
+import numpy
+from setuptools import Extension, setup
+
+# Absolute, so the objects of the firmware sources end up in the build directory too.
+FIRMWARE_SOURCE = os.path.abspath(os.path.join(os.path.dirname(__file__), '..', '..', 'detector', 'src'))
+
+setup(name='firmware',
+      ext_modules=[Extension('firmware',
+                             sources=['firmwaremodule.cpp',
+                                      os.path.join(FIRMWARE_SOURCE, 'calibration.cpp'),
+                                      os.path.join(FIRMWARE_SOURCE, 'filter.cpp'),
+                                      os.path.join(FIRMWARE_SOURCE, 'peaks.cpp')],
+                             include_dirs=[FIRMWARE_SOURCE, numpy.get_include()],
+                             language='c++')])
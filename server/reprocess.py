@@ -0,0 +1,174 @@
+"""Recomputes the peak statistics and depth of stored windows with the firmware's own math.
+
+Uses the `firmware` extension in native/, which has to be built first (see native/setup.py). Every window the server
+stored in the `windows` table (see `writer_task()` in app.py) is analyzed with the calibration stored for its device, or
+with `--calibration`, and the results are written as CSV to stdout next to what the device reported. The windows are
+read and analyzed in batches of `--batch` windows, so the whole history never has to fit in memory.
+
+Like depth mode, the depth is computed from the median of the Vptp of the last windows. The server does not know when
+the detector entered depth mode, so the filter starts over when the mode or the sensors change and after a gap of
+`FILTER_RESTART_GAP`. See `analyzeWindow()` in detector/src/peaks.h for where the results can differ from the device's.
+
+Example:
+    python reprocess.py --database database.db --since 1700000000000 > reprocessed.csv
+"""
+import argparse
+import csv
+import math
+import os
+import sqlite3
+import sys
+import time
+import zlib
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native'))
+import firmware  # noqa: E402
+
+FIELDS = ('Vmax', 'Vmin', 'Vptp', 'peakWidth', 'countedPeaks', 'filteredVptp', 'depth')
+REPORTED_FIELDS = ('Vptp', 'peakWidth', 'depth')
+# `Mode::DEPTH` in detector/src/main.h, the only mode that reports a depth.
+DEPTH_MODE = 1
+# Longest time between two windows of depth mode, above which the detector must have left it in between. (ms)
+FILTER_RESTART_GAP = 10 * 1000
+# Samples per volt of the stored windows, see `WINDOW_SAMPLE_SCALE` in app.py.
+WINDOW_SAMPLE_SCALE = 10000
+WINDOW_FIELDS = ('deviceID', 'timestamp', 'currentMode', 'activatedSwitches', 'loopTime', 'Vptp', 'peakWidth', 'depth')
+
+
+def load_windows(db, device, since, batch_size):
+    """Yields the stored windows in batches of at most `batch_size`, by device and then by time.
+
+    Every batch only holds windows of a single device, so it is analyzed with a single calibration.
+    """
+    query = ("select device, timestamp, currentMode, activatedSwitches, loopTime, Vptp, peakWidth, depth, voltageArray "
+             "from windows where timestamp >= ?")
+    args = [since]
+    if device is not None:
+        query += " and device = ?"
+        args.append(device)
+    batch = []
+    for row in db.execute(query + " order by device, timestamp;", args):
+        data = dict(zip(WINDOW_FIELDS, row))
+        data['voltageArray'] = decode_window(row[-1])
+        if batch and (len(batch) == batch_size or batch[0]['deviceID'] != data['deviceID']):
+            yield batch
+            batch = []
+        batch.append(data)
+    if batch:
+        yield batch
+
+
+def decode_window(blob):
+    """Decodes the voltages of a window stored by `encode_window()` in app.py."""
+    return np.cumsum(np.frombuffer(zlib.decompress(blob), dtype='<i4')) / WINDOW_SAMPLE_SCALE
+
+
+def load_calibration(db, device):
+    """Returns the calibration blob of a device like `get_calibration()` in app.py, or None."""
+    if not has_table(db, 'calibration'):
+        return None
+    row = db.execute("select blob from calibration where device = ?;", (device,)).fetchone()
+    if row is None:
+        row = db.execute("select blob from calibration where device = '';").fetchone()
+    return row[0] if row else None
+
+
+def has_table(db, name):
+    return db.execute("select 1 from sqlite_master where type = 'table' and name = ?;", (name,)).fetchone() is not None
+
+
+class DepthFilter:
+    """The median filter of depth mode over consecutive batches of windows of one device."""
+
+    def __init__(self):
+        self.previous = None
+        # Vptp of the windows since the filter last started over, as far as the filter still holds them.
+        self.history = []
+
+    def filter(self, batch, Vptp):
+        """Returns the filtered Vptp after every window of `batch`, of which `Vptp` was analyzed."""
+        restart = []
+        for data in batch:
+            previous = self.previous
+            restart.append(previous is None or data['currentMode'] != previous['currentMode']
+                           or data['activatedSwitches'] != previous['activatedSwitches']
+                           or data['timestamp'] - previous['timestamp'] > FILTER_RESTART_GAP)
+            self.previous = data
+
+        # Run the windows the filter still holds through it again, so it continues where the previous batch ended.
+        carried = len(self.history)
+        filtered = firmware.median_filter(np.concatenate((np.array(self.history, dtype=np.float32), Vptp)),
+                                          [True] + [False] * (carried - 1) + restart if carried else restart)[carried:]
+
+        for value, restarted in zip(Vptp, restart):
+            self.history = ([] if restarted else self.history[-(firmware.MEDIAN_FILTER_SIZE - 2):]) + [value]
+        return filtered
+
+
+def reprocess(batch, threads):
+    """Analyzes the time-ordered windows of one device with the active calibration."""
+    results = {}
+    # Windows of different lengths can not share an array.
+    for length in {len(data['voltageArray']) for data in batch}:
+        indices = [i for i, data in enumerate(batch) if len(data['voltageArray']) == length]
+        windows = np.array([batch[i]['voltageArray'] for i in indices], dtype=np.float32)
+        loop_times = np.array([batch[i]['loopTime'] for i in indices], dtype=np.float32)
+        for field, values in firmware.analyze(windows, loop_times, threads=threads).items():
+            results.setdefault(field, np.zeros(len(batch), dtype=values.dtype))[indices] = values
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--database', default='database.db', help="database of the server")
+    parser.add_argument('--calibration', help="calibration blob to use for all devices instead of the stored ones")
+    parser.add_argument('--device', help="only reprocess the windows of this device")
+    parser.add_argument('--since', type=int, default=0, help="only reprocess the windows stored from this time on (ms)")
+    parser.add_argument('--batch', type=int, default=10000, help="number of windows analyzed at once")
+    parser.add_argument('--threads', type=int, default=0, help="number of threads, all cores by default")
+    args = parser.parse_args()
+
+    db = sqlite3.connect(args.database)
+    if not has_table(db, 'windows'):
+        print("No windows stored in the database, run the server first", file=sys.stderr)
+        sys.exit(1)
+    override = open(args.calibration, 'rb').read() if args.calibration else None
+
+    writer = csv.writer(sys.stdout)
+    writer.writerow(('device', 'timestamp', 'calibration') + FIELDS + tuple(f'reported{field[0].upper()}{field[1:]}' for field in REPORTED_FIELDS))
+    start = time.perf_counter()
+    windows = 0
+    device = None
+    for batch in load_windows(db, args.device, args.since, args.batch):
+        if batch[0]['deviceID'] != device:
+            device = batch[0]['deviceID']
+            depth_filter = DepthFilter()
+            blob = override if override is not None else load_calibration(db, device)
+            if blob is None:
+                firmware.reset_calibration()
+                valid = True
+            else:
+                valid = firmware.load_calibration(blob)
+                if not valid:
+                    print(f"Invalid calibration for {device!r}, skipped", file=sys.stderr)
+            checksum = firmware.calibration_checksum()
+        if not valid:
+            continue
+
+        results = reprocess(batch, args.threads)
+        results['filteredVptp'] = depth_filter.filter(batch, results['Vptp'])
+        switches = np.array([data['activatedSwitches'] or 0 for data in batch], dtype=np.uint8)
+        depths = firmware.depth(results['filteredVptp'], switches, threads=args.threads)
+        results['depth'] = np.where([data['currentMode'] == DEPTH_MODE for data in batch], depths, math.nan)
+        windows += len(batch)
+        for i, data in enumerate(batch):
+            writer.writerow((device, data['timestamp'], f'{checksum:08x}') + tuple(results[field][i] for field in FIELDS)
+                            + tuple(data[field] for field in REPORTED_FIELDS))
+    elapsed = time.perf_counter() - start
+    print(f"Reprocessed {windows} windows in {elapsed:.3f} s", file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()